@@ -231,6 +231,36 @@ ConVar cv_pt_denoise =
     .desc = "Denoise path tracing output",
 };
 
+ConVar cv_pt_denoise_spp =
+{
+    .type = cvart_int,
+    .name = "pt_denoise_spp",
+    .value = "8",
+    .minInt = 1,
+    .maxInt = 1 << 16,
+    .desc = "Path tracer samples between denoiser runs",
+};
+
+ConVar cv_pt_denoise_ms =
+{
+    .type = cvart_float,
+    .name = "pt_denoise_ms",
+    .value = "500",
+    .minFloat = 0.0f,
+    .maxFloat = 60000.0f,
+    .desc = "Path tracer milliseconds between denoiser runs",
+};
+
+ConVar cv_r_denoise_mem =
+{
+    .type = cvart_int,
+    .name = "r_denoise_mem",
+    .value = "4096",
+    .minInt = 256,
+    .maxInt = 1 << 16,
+    .desc = "Denoiser memory cap in megabytes, larger images are denoised in tiles",
+};
+
 ConVar cv_pt_normal =
 {
     .type = cvart_bool,
@@ -247,6 +277,34 @@ ConVar cv_pt_albedo =
     .desc = "Output path tracer albedo",
 };
 
+ConVar cv_pt_mlt =
+{
+    .type = cvart_bool,
+    .name = "pt_mlt",
+    .value = "0",
+    .desc = "Path tracer uses primary sample space metropolis light transport",
+};
+
+ConVar cv_pt_cache_bounce =
+{
+    .type = cvart_int,
+    .name = "pt_cache_bounce",
+    .value = "0",
+    .minInt = 0,
+    .maxInt = 64,
+    .desc = "Path tracer ends paths on baked lightmaps and cubemaps at this bounce; 0: off",
+};
+
+ConVar cv_pt_heatmap =
+{
+    .type = cvart_int,
+    .name = "pt_heatmap",
+    .value = "0",
+    .minInt = 0,
+    .maxInt = 2,
+    .desc = "Path tracer heatmap output; 0: off, 1: rays per pixel, 2: bounces per pixel",
+};
+
 ConVar cv_r_refl_gen =
 {
     .type = cvart_bool,
@@ -488,6 +546,16 @@ ConVar cv_lm_upload =
     .desc = "Upload the latest lightmap data to the GPU",
 };
 
+ConVar cv_lm_upload_kb =
+{
+    .type = cvart_int,
+    .name = "lm_upload_kb",
+    .value = "4096",
+    .minInt = 64,
+    .maxInt = 1 << 20,
+    .desc = "Lightmap baking: kilobytes of baked lightmap tiles uploaded to the GPU per frame",
+};
+
 ConVar cv_lm_gen =
 {
     .type = cvart_bool,
@@ -513,7 +581,7 @@ ConVar cv_lm_timeslice =
     .value = DEBUG_ONLY("60") RELEASE_ONLY("1"),
     .minInt = 1,
     .maxInt = 1024,
-    .desc = "Lightmap baking: number of frames per sample",
+    .desc = "Lightmap baking: number of frames per pass over unconverged texels",
 };
 
 ConVar cv_lm_spp =
@@ -526,6 +594,36 @@ ConVar cv_lm_spp =
     .desc = "Lightmap baking: samples per pixel",
 };
 
+ConVar cv_lm_error =
+{
+    .type = cvart_float,
+    .name = "lm_error",
+    .value = "0.02",
+    .minFloat = 0.001f,
+    .maxFloat = 1.0f,
+    .desc = "Lightmap baking: target relative standard error of each texel",
+};
+
+ConVar cv_lm_error_floor =
+{
+    .type = cvart_float,
+    .name = "lm_error_floor",
+    .value = "0.01",
+    .minFloat = 0.0f,
+    .maxFloat = 10.0f,
+    .desc = "Lightmap baking: luminance below which lm_error is measured as absolute error, so dark texels converge",
+};
+
+ConVar cv_lm_checkpoint =
+{
+    .type = cvart_float,
+    .name = "lm_checkpoint",
+    .value = "300",
+    .minFloat = 0.0f,
+    .maxFloat = 86400.0f,
+    .desc = "Lightmap baking: seconds between bake checkpoints, 0 to disable checkpoints and resuming",
+};
+
 // ----------------------------------------------------------------------------
 
 ConVar cv_fullscreen =
@@ -548,18 +646,28 @@ void ConVars_RegisterAll(void)
     ConVar_Reg(&cv_r_display_nits_min);
     ConVar_Reg(&cv_r_display_nits_max);
     ConVar_Reg(&cv_r_ui_nits);
+    ConVar_Reg(&cv_lm_checkpoint);
     ConVar_Reg(&cv_lm_density);
+    ConVar_Reg(&cv_lm_error);
+    ConVar_Reg(&cv_lm_error_floor);
     ConVar_Reg(&cv_lm_gen);
     ConVar_Reg(&cv_lm_spp);
     ConVar_Reg(&cv_lm_timeslice);
     ConVar_Reg(&cv_lm_upload);
+    ConVar_Reg(&cv_lm_upload_kb);
     ConVar_Reg(&cv_r_maxdelqueue);
     ConVar_Reg(&cv_r_bumpiness);
     ConVar_Reg(&cv_in_movescale);
     ConVar_Reg(&cv_in_pitchscale);
     ConVar_Reg(&cv_pt_albedo);
+    ConVar_Reg(&cv_pt_cache_bounce);
     ConVar_Reg(&cv_pt_denoise);
+    ConVar_Reg(&cv_pt_denoise_ms);
+    ConVar_Reg(&cv_pt_denoise_spp);
+    ConVar_Reg(&cv_r_denoise_mem);
     ConVar_Reg(&cv_pt_dist_meters);
+    ConVar_Reg(&cv_pt_heatmap);
+    ConVar_Reg(&cv_pt_mlt);
     ConVar_Reg(&cv_pt_normal);
     ConVar_Reg(&cv_pt_trace);
     ConVar_Reg(&cv_r_fov);
@@ -29,8 +29,14 @@ extern ConVar cv_r_brdflut_spf;
 extern ConVar cv_pt_dist_meters;
 extern ConVar cv_pt_trace;
 extern ConVar cv_pt_denoise;
+extern ConVar cv_pt_denoise_spp;
+extern ConVar cv_pt_denoise_ms;
+extern ConVar cv_r_denoise_mem;
 extern ConVar cv_pt_normal;
 extern ConVar cv_pt_albedo;
+extern ConVar cv_pt_mlt;
+extern ConVar cv_pt_cache_bounce;
+extern ConVar cv_pt_heatmap;
 
 extern ConVar cv_r_refl_gen;
 extern ConVar cv_r_sun_dir;
@@ -40,10 +46,14 @@ extern ConVar cv_r_sun_steps;
 extern ConVar cv_ui_opacity;
 
 extern ConVar cv_lm_upload;
+extern ConVar cv_lm_upload_kb;
 extern ConVar cv_lm_gen;
 extern ConVar cv_lm_density;
 extern ConVar cv_lm_timeslice;
 extern ConVar cv_lm_spp;
+extern ConVar cv_lm_error;
+extern ConVar cv_lm_error_floor;
+extern ConVar cv_lm_checkpoint;
 
 extern ConVar cv_exp_standard;
 extern ConVar cv_exp_manual;
@@ -19,6 +19,8 @@
 // eventually the call stack will run out in the Gui
 #define kDepthLimit (20)
 
+#define kCounterLimit (64)
+
 // ----------------------------------------------------------------------------
 
 typedef struct node_s
@@ -40,6 +42,12 @@ typedef struct stat_s
     double variance;
 } stat_t;
 
+typedef struct counter_s
+{
+    char const* name;
+    double value;
+} counter_t;
+
 typedef struct ctx_s
 {
     node_t prevroot;
@@ -70,6 +78,8 @@ static Dict ms_stats =
 };
 static i32 ms_avgWindow = 20;
 static bool ms_progressive;
+static counter_t ms_counters[kCounterLimit];
+static i32 ms_counterCount;
 
 // ----------------------------------------------------------------------------
 
@@ -122,6 +132,15 @@ void ProfileSys_Gui(bool* pEnabled)
             VisitGui(root);
         }
         igExColumns(1);
+
+        if (ms_counterCount > 0)
+        {
+            igSeparator();
+            for (i32 i = 0; i < ms_counterCount; ++i)
+            {
+                igText("%s: %g", ms_counters[i].name, ms_counters[i].value);
+            }
+        }
     }
     igEnd();
 
@@ -201,6 +220,25 @@ void _ProfileEnd(ProfMark *const mark)
     ctx->depth--;
 }
 
+void _ProfileCounter(char const *const name, double value)
+{
+    ASSERT(name);
+    for (i32 i = 0; i < ms_counterCount; ++i)
+    {
+        if (ms_counters[i].name == name)
+        {
+            ms_counters[i].value = value;
+            return;
+        }
+    }
+    if (ms_counterCount < kCounterLimit)
+    {
+        ms_counters[ms_counterCount].name = name;
+        ms_counters[ms_counterCount].value = value;
+        ++ms_counterCount;
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 pim_inline double VEC_CALL f64_lerp(double a, double b, double t)
@@ -334,5 +372,6 @@ void ProfileSys_Gui(bool* pEnabled) {}
 
 void _ProfileBegin(ProfMark *const mark) {}
 void _ProfileEnd(ProfMark *const mark) {}
+void _ProfileCounter(char const *const name, double value) {}
 
 #endif // PIM_PROFILE
@@ -15,6 +15,8 @@ void ProfileSys_Gui(bool* pEnabled);
 
 void _ProfileBegin(ProfMark *const mark);
 void _ProfileEnd(ProfMark *const mark);
+// sets a named value listed below the timings, name must be a string literal
+void _ProfileCounter(char const *const name, double value);
 
 #define PIM_PROFILE 1
 
@@ -22,10 +24,12 @@ void _ProfileEnd(ProfMark *const mark);
     #define ProfileMark(var, tag)   static ProfMark var = { #tag };
     #define ProfileBegin(mark)      _ProfileBegin(&(mark))
     #define ProfileEnd(mark)        _ProfileEnd(&(mark))
+    #define ProfileCounter(name, value) _ProfileCounter((name), (value))
 #else
     #define ProfileMark(var, tag)   
     #define ProfileBegin(mark)      (void)0
     #define ProfileEnd(mark)        (void)0
+    #define ProfileCounter(name, value) (void)0
 #endif // PIM_PROFILE
 
 PIM_C_END
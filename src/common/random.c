@@ -42,6 +42,17 @@ void Random_Init(void)
     }
 }
 
+void Random_Seed(u32 seed)
+{
+    for (i32 i = 0; i < NELEM(ms_prngs); ++i)
+    {
+        uint4 hash = { seed, (u32)i, 0, 0 };
+        hash = Pcg4_String(GetSeed(seed + (u32)i), hash);
+        hash = Pcg4_Permute(Pcg4_Lcg(hash));
+        ms_prngs[i].state = hash;
+    }
+}
+
 Prng Prng_New(void)
 {
     Prng rng;
@@ -64,6 +75,16 @@ Prng Prng_New(void)
     return rng;
 }
 
+Prng Prng_Seeded(u32 seed)
+{
+    Prng rng;
+    uint4 hash = { seed, 0, 0, 0 };
+    hash = Pcg4_String(GetSeed(seed), hash);
+    hash = Pcg4_Permute(Pcg4_Lcg(hash));
+    rng.state = hash;
+    return rng;
+}
+
 Prng* Prng_Get(void)
 {
     return &ms_prngs[Task_ThreadId()];
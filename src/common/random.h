@@ -6,8 +6,12 @@
 PIM_C_BEGIN
 
 void Random_Init(void);
+// reseeds every thread's generator deterministically, for reproducible runs
+void Random_Seed(u32 seed);
 
 Prng Prng_New(void);
+// a generator whose sequence depends only on seed
+Prng Prng_Seeded(u32 seed);
 Prng* Prng_Get(void);
 
 pim_inline void VEC_CALL Prng_Next1(Prng* pim_noalias rng)
@@ -1,4 +1,5 @@
 #include "io/dir.h"
+#include <stdio.h>
 
 pim_inline void* NotNull(void* x)
 {
@@ -17,6 +18,7 @@ static i32 ChDir(const char* path);
 static i32 RmDir(const char* path);
 static i32 ChMod(const char* filename, i32 mode);
 static i32 MkDir(const char* path);
+static i32 Rename(const char* src, const char* dst);
 
 bool IO_GetCwd(char* dst, i32 size)
 {
@@ -49,7 +51,21 @@ bool IO_ChMod(const char* path, i32 flags)
     return IsZero(ChMod(path, flags)) == 0;
 }
 
+bool IO_Remove(const char* path)
+{
+    ASSERT(path);
+    return remove(path) == 0;
+}
+
+bool IO_Rename(const char* src, const char* dst)
+{
+    ASSERT(src);
+    ASSERT(dst);
+    return Rename(src, dst) == 0;
+}
+
 #if PLAT_WINDOWS
+#include <windows.h>
 #include <direct.h>
 #include <io.h>
 
@@ -73,6 +89,11 @@ static i32 MkDir(const char* path)
 {
     return _mkdir(path);
 }
+static i32 Rename(const char* src, const char* dst)
+{
+    // rename() fails on windows when dst exists
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+}
 
 #else
 #include <unistd.h>
@@ -98,5 +119,9 @@ static i32 MkDir(const char* path)
 {
     return mkdir(path, 0755);
 }
+static i32 Rename(const char* src, const char* dst)
+{
+    return rename(src, dst);
+}
 
 #endif // PLAT_XXX
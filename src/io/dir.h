@@ -9,5 +9,8 @@ bool IO_ChDir(const char* path);
 bool IO_MkDir(const char* path);
 bool IO_RmDir(const char* path);
 bool IO_ChMod(const char* path, i32 flags);
+bool IO_Remove(const char* path);
+// replaces dst if it exists
+bool IO_Rename(const char* src, const char* dst);
 
 PIM_C_END
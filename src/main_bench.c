@@ -0,0 +1,273 @@
+#include "common/time.h"
+#include "common/random.h"
+#include "allocator/allocator.h"
+#include "threading/task.h"
+#include "rendering/render_system.h"
+#include "rendering/path_tracer.h"
+#include "rendering/denoise.h"
+#include "rendering/camera.h"
+#include "assets/asset_system.h"
+#include "common/profiler.h"
+#include "common/cvars.h"
+#include "common/cmd.h"
+#include "common/console.h"
+#include "common/stringutil.h"
+#include "common/serialize.h"
+#include "math/types.h"
+#include "math/scalar.h"
+#include <stdio.h>
+#include <string.h>
+
+// path tracer throughput benchmark, for catching performance regressions.
+// traces each scene from its load camera with fixed seeds, once per thread
+// count in [1, 2, 4, .., hardware threads], and writes the results as json.
+// the denoiser is timed once per scene, with every thread.
+// usage:
+//   pim_bench [-maps <name,name,..>] [-frames <n>] [-width <w>] [-height <h>]
+//     [-seed <n>] [-out <path>]
+
+#define kBenchMaxScenes 16
+
+typedef struct BenchArgs_s
+{
+    char maps[PIM_PATH];
+    const char* sceneNames[kBenchMaxScenes];
+    i32 sceneCount;
+    i32 frames;
+    int2 size;
+    u32 seed;
+    const char* output;
+} BenchArgs;
+
+typedef struct BenchRun_s
+{
+    i32 threads;
+    double buildMs;
+    double updateMs;
+    double traceMs;
+    u64 rays;
+} BenchRun;
+
+static void Init(void);
+static void Shutdown(void);
+static void ParseArgs(i32 argc, const char** argv, BenchArgs* args);
+static BenchRun RunScene(const BenchArgs* args, const Camera* camera, i32 threads);
+static double RunDenoise(const BenchArgs* args, const Camera* camera);
+static SerObj* RunToJson(const BenchArgs* args, const BenchRun* run);
+
+int main(int argc, char** argv)
+{
+    Init();
+
+    BenchArgs args = { 0 };
+    ParseArgs(argc - 1, (const char**)(argv + 1), &args);
+
+    SerObj* root = SerObj_Dict();
+    Ser_SetInt(root, "frames", args.frames);
+    Ser_SetInt(root, "width", args.size.x);
+    Ser_SetInt(root, "height", args.size.y);
+    Ser_SetInt(root, "seed", (i32)args.seed);
+    Ser_SetInt(root, "hardware_threads", Task_ThreadCount());
+    SerObj* scenes = SerObj_Array();
+    Ser_DictSet(root, "scenes", scenes);
+
+    i32 status = 0;
+    for (i32 i = 0; i < args.sceneCount; ++i)
+    {
+        const char* name = args.sceneNames[i];
+        if (!RenderSys_LoadMap(name))
+        {
+            fprintf(stderr, "pim_bench: failed to load '%s'\n", name);
+            status = -1;
+            continue;
+        }
+
+        // every run starts from the pose the map loaded with
+        Camera camera;
+        Camera_Get(&camera);
+
+        SerObj* scene = SerObj_Dict();
+        Ser_SetStr(scene, "name", name);
+        SerObj* runs = SerObj_Array();
+        Ser_DictSet(scene, "runs", runs);
+        Ser_ArrayAdd(scenes, scene);
+
+        const i32 maxThreads = Task_ThreadCount();
+        for (i32 threads = 1; ; threads = i1_min(threads * 2, maxThreads))
+        {
+            BenchRun run = RunScene(&args, &camera, threads);
+            SerObj* jrun = RunToJson(&args, &run);
+            Ser_ArrayAdd(runs, jrun);
+            printf("%s: %2d threads, %8.3f Mrays/s, %8.3f ms/frame\n",
+                name,
+                threads,
+                Ser_GetFloat(jrun, "mrays_per_sec"),
+                Ser_GetFloat(jrun, "trace_ms_per_frame"));
+            if (threads == maxThreads)
+            {
+                break;
+            }
+        }
+
+        // the denoiser runs on its own threads, so it is not part of the sweep
+        Ser_DictSet(scene, "denoise_ms", SerObj_Num(RunDenoise(&args, &camera)));
+    }
+
+    if (!Ser_WriteFile(args.output, root))
+    {
+        fprintf(stderr, "pim_bench: failed to write '%s'\n", args.output);
+        status = -1;
+    }
+    SerObj_Del(root);
+
+    Shutdown();
+    return status;
+}
+
+static void Init(void)
+{
+    TimeSys_Init();
+    Random_Init();
+    MemSys_Init();
+    ConVars_RegisterAll();
+    SerSys_Init();
+    cmd_sys_init();
+    ConSys_Init();
+    TaskSys_Init();
+    AssetSys_Init();
+    RenderSys_InitHeadless();
+}
+
+static void Shutdown(void)
+{
+    RenderSys_ShutdownHeadless();
+    AssetSys_Shutdown();
+    TaskSys_Shutdown();
+    ConSys_Shutdown();
+    cmd_sys_shutdown();
+    SerSys_Shutdown();
+    MemSys_Shutdown();
+    TimeSys_Shutdown();
+}
+
+static void ParseArgs(i32 argc, const char** argv, BenchArgs* args)
+{
+    const char* maps = cmd_getopt(argc, argv, "maps");
+    StrCpy(ARGS(args->maps), (maps && maps[0]) ? maps : "cornell_box");
+    char* cursor = args->maps;
+    while (cursor && cursor[0] && (args->sceneCount < kBenchMaxScenes))
+    {
+        args->sceneNames[args->sceneCount++] = cursor;
+        cursor = strchr(cursor, ',');
+        if (cursor)
+        {
+            *cursor++ = 0;
+        }
+    }
+
+    const char* frames = cmd_getopt(argc, argv, "frames");
+    const char* width = cmd_getopt(argc, argv, "width");
+    const char* height = cmd_getopt(argc, argv, "height");
+    const char* seed = cmd_getopt(argc, argv, "seed");
+    const char* output = cmd_getopt(argc, argv, "out");
+    args->frames = i1_max(1, (frames && frames[0]) ? ParseInt(frames) : 64);
+    args->size.x = i1_max(1, (width && width[0]) ? ParseInt(width) : 640);
+    args->size.y = i1_max(1, (height && height[0]) ? ParseInt(height) : 360);
+    args->seed = (seed && seed[0]) ? (u32)ParseInt(seed) : 1u;
+    args->output = (output && output[0]) ? output : "pt_bench.json";
+}
+
+static void ResetScene(const BenchArgs* args, const Camera* camera, i32 threads)
+{
+    TaskSys_SetThreadLimit(threads);
+    Camera_Set(camera);
+    PtSys_Seed(args->seed);
+    Random_Seed(args->seed);
+    // every run builds the scene from scratch, so build times compare
+    PtSys_ClearCaches();
+}
+
+static BenchRun RunScene(const BenchArgs* args, const Camera* camera, i32 threads)
+{
+    BenchRun run = { 0 };
+    ResetScene(args, camera, threads);
+    run.threads = TaskSys_GetThreadLimit();
+
+    PtDofInfo dof;
+    DofInfo_New(&dof);
+
+    // build: geometry, bvh and emissives. update: distributions, caches,
+    // and the light grid, which otherwise completes in the background.
+    u64 start = Time_Now();
+    PtScene* scene = PtScene_New();
+    run.buildMs = Time_Milli(Time_Now() - start);
+    start = Time_Now();
+    PtScene_Update(scene);
+    PtScene_Finish(scene);
+    run.updateMs = Time_Milli(Time_Now() - start);
+
+    PtTrace trace = { 0 };
+    PtTrace_New(&trace, args->size);
+
+    const u64 raysBegin = PtSys_RayCount();
+    start = Time_Now();
+    for (i32 i = 0; i < args->frames; ++i)
+    {
+        MemSys_Update();
+        trace.sampleWeight = 1.0f / (i + 1);
+        Pt_Trace(&trace, &dof, scene, camera);
+    }
+    run.traceMs = Time_Milli(Time_Now() - start);
+    run.rays = PtSys_RayCount() - raysBegin;
+
+    PtTrace_Del(&trace);
+    PtScene_Del(scene);
+    return run;
+}
+
+// denoises one frame traced with every thread. returns -1 on failure.
+static double RunDenoise(const BenchArgs* args, const Camera* camera)
+{
+    ResetScene(args, camera, Task_ThreadCount());
+
+    PtDofInfo dof;
+    DofInfo_New(&dof);
+    PtScene* scene = PtScene_New();
+    PtTrace trace = { 0 };
+    PtTrace_New(&trace, args->size);
+    trace.sampleWeight = 1.0f;
+    Pt_Trace(&trace, &dof, scene, camera);
+
+    u64 start = Time_Now();
+    bool denoised = Denoise(
+        DenoiseType_Image,
+        trace.imageSize,
+        trace.color,
+        trace.albedo,
+        trace.normal,
+        trace.denoised);
+    double ms = denoised ? Time_Milli(Time_Now() - start) : -1.0;
+
+    PtTrace_Del(&trace);
+    PtScene_Del(scene);
+    return ms;
+}
+
+static SerObj* RunToJson(const BenchArgs* args, const BenchRun* run)
+{
+    const double samples = (double)args->size.x * args->size.y * args->frames;
+    const double seconds = (run->traceMs > 0.0) ? (run->traceMs * 1e-3) : 1e-6;
+
+    SerObj* obj = SerObj_Dict();
+    Ser_SetInt(obj, "threads", run->threads);
+    Ser_DictSet(obj, "build_ms", SerObj_Num(run->buildMs));
+    Ser_DictSet(obj, "update_ms", SerObj_Num(run->updateMs));
+    Ser_DictSet(obj, "trace_ms", SerObj_Num(run->traceMs));
+    Ser_DictSet(obj, "trace_ms_per_frame", SerObj_Num(run->traceMs / args->frames));
+    Ser_DictSet(obj, "rays", SerObj_Num((double)run->rays));
+    Ser_DictSet(obj, "rays_per_sample", SerObj_Num(run->rays / samples));
+    Ser_DictSet(obj, "mrays_per_sec", SerObj_Num((run->rays / seconds) * 1e-6));
+    Ser_DictSet(obj, "msamples_per_sec", SerObj_Num((samples / seconds) * 1e-6));
+    Ser_DictSet(obj, "samples_per_sec_per_core", SerObj_Num((samples / seconds) / run->threads));
+    return obj;
+}
@@ -0,0 +1,165 @@
+#include "common/time.h"
+#include "common/random.h"
+#include "allocator/allocator.h"
+#include "threading/task.h"
+#include "rendering/render_system.h"
+#include "assets/asset_system.h"
+#include "common/profiler.h"
+#include "common/cvars.h"
+#include "common/cmd.h"
+#include "common/console.h"
+#include "common/stringutil.h"
+#include "common/serialize.h"
+#include "os/socket.h"
+#include <stdio.h>
+
+// batch renderer for machines without a display or gpu.
+// usage:
+//   pim_headless -map <name> [-out <name>] [-lm <spp>] [-cm <spp>] [-pt <spp>]
+//     [-time <seconds per stage>] [-width <w>] [-height <h>] [-denoise]
+//     [-eye <x,y,z> -at <x,y,z>] [-lmserve <port> -lmworkers <n>]
+//   pim_headless -map <name> -lmjoin <host:port>
+// -lmserve shares the lightmap bake with n workers, which load the same map
+// and join with -lmjoin. they exit once the coordinator's bake is done.
+
+static bool Init(const RenderBatch* batch);
+static bool Update(void);
+static void Shutdown(void);
+static bool ParseArgs(i32 argc, const char** argv, RenderBatch* batch);
+
+int main(int argc, char** argv)
+{
+    RenderBatch batch = { 0 };
+    if (!ParseArgs(argc - 1, (const char**)(argv + 1), &batch))
+    {
+        fprintf(stderr,
+            "usage: pim_headless -map <name> [-out <name>] [-lm <spp>] [-cm <spp>] [-pt <spp>]\n"
+            "    [-time <seconds per stage>] [-width <w>] [-height <h>] [-denoise]\n"
+            "    [-eye <x,y,z> -at <x,y,z>] [-lmserve <port> -lmworkers <n>]\n"
+            "   or: pim_headless -map <name> -lmjoin <host:port>\n");
+        return -1;
+    }
+    if (!Init(&batch))
+    {
+        Shutdown();
+        return -1;
+    }
+    while (Update())
+    {
+
+    }
+    const bool failed = RenderSys_BatchFailed();
+    Shutdown();
+    return failed ? -1 : 0;
+}
+
+static bool Init(const RenderBatch* batch)
+{
+    TimeSys_Init();
+    Random_Init();
+    MemSys_Init();
+    ConVars_RegisterAll();
+    SerSys_Init();
+    cmd_sys_init();
+    ConSys_Init();
+    TaskSys_Init();
+    NetSys_Init();
+    AssetSys_Init();
+    return RenderSys_InitHeadless() && RenderSys_BeginBatch(batch);
+}
+
+static void Shutdown(void)
+{
+    RenderSys_ShutdownHeadless();
+    AssetSys_Shutdown();
+    NetSys_Shutdown();
+    TaskSys_Shutdown();
+    ConSys_Shutdown();
+    cmd_sys_shutdown();
+    SerSys_Shutdown();
+    MemSys_Shutdown();
+    TimeSys_Shutdown();
+}
+
+ProfileMark(pm_update, Update)
+static bool Update(void)
+{
+    TimeSys_Update();           // bump frame id for profiler
+    MemSys_Update();            // reset linear allocator
+    ProfileBegin(pm_update);
+
+    AssetSys_Update();          // stream assets in
+    TaskSys_Update();           // schedule tasks
+    cmd_sys_update();           // execute console commands
+    bool running = RenderSys_UpdateHeadless();
+
+    TaskSys_EndFrame();
+    ProfileEnd(pm_update);
+    return running;
+}
+
+static bool ParseFloat3(const char* text, float4* dst)
+{
+    float4 v = { 0.0f, 0.0f, 0.0f, 1.0f };
+    if (!text || (sscanf(text, "%f,%f,%f", &v.x, &v.y, &v.z) != 3))
+    {
+        return false;
+    }
+    *dst = v;
+    return true;
+}
+
+static i32 GetOptInt(i32 argc, const char** argv, const char* key, i32 fallback)
+{
+    const char* value = cmd_getopt(argc, argv, key);
+    return (value && value[0]) ? ParseInt(value) : fallback;
+}
+
+static bool ParseArgs(i32 argc, const char** argv, RenderBatch* batch)
+{
+    const char* map = cmd_getopt(argc, argv, "map");
+    if (!map || !map[0])
+    {
+        return false;
+    }
+    batch->map = map;
+
+    const char* output = cmd_getopt(argc, argv, "out");
+    batch->output = (output && output[0]) ? output : NULL;
+    batch->lmSpp = GetOptInt(argc, argv, "lm", 0);
+    batch->cmSpp = GetOptInt(argc, argv, "cm", 0);
+    batch->ptSpp = GetOptInt(argc, argv, "pt", 0);
+    batch->size.x = GetOptInt(argc, argv, "width", 1280);
+    batch->size.y = GetOptInt(argc, argv, "height", 720);
+    batch->denoise = cmd_getopt(argc, argv, "denoise") != NULL;
+
+    const char* seconds = cmd_getopt(argc, argv, "time");
+    batch->seconds = (seconds && seconds[0]) ? ParseFloat(seconds) : 0.0f;
+
+    const char* eye = cmd_getopt(argc, argv, "eye");
+    const char* at = cmd_getopt(argc, argv, "at");
+    if (eye || at)
+    {
+        if (!ParseFloat3(eye, &batch->eye) || !ParseFloat3(at, &batch->at))
+        {
+            return false;
+        }
+        batch->setCamera = true;
+    }
+
+    const i32 port = GetOptInt(argc, argv, "lmserve", 0);
+    if ((port < 0) || (port > 0xffff))
+    {
+        return false;
+    }
+    batch->lmServe = (u16)port;
+    batch->lmWorkers = GetOptInt(argc, argv, "lmworkers", 0);
+    const char* join = cmd_getopt(argc, argv, "lmjoin");
+    batch->lmJoin = (join && join[0]) ? join : NULL;
+    if (batch->lmJoin)
+    {
+        return true;
+    }
+
+    return (batch->lmSpp > 0) || (batch->cmSpp > 0) || (batch->ptSpp > 0);
+}
@@ -151,6 +151,34 @@ pim_inline float4 VEC_CALL rgba16_f4(R16G16B16A16_t c)
     return f4_v(c.r * s, c.g * s, c.b * s, c.a * s);
 }
 
+// negatives clamp to zero, and values past 65408 saturate
+pim_inline E5B9G9R9_t VEC_CALL f4_rgb9e5(float4 v)
+{
+    // exponent bias 15, 9 mantissa bits, no implicit leading one
+    const float kMax = (511.0f / 512.0f) * 65536.0f;
+    v = f4_min(f4_max(v, f4_0), f4_s(kMax));
+    const float maxc = f1_max(v.x, f1_max(v.y, v.z));
+    i32 e = i1_max(-16, (i32)floorf(log2f(f1_max(maxc, 1e-30f)))) + 16;
+    float scale = exp2f((float)(24 - e));
+    if ((i32)floorf(maxc * scale + 0.5f) >= 512)
+    {
+        e += 1;
+        scale *= 0.5f;
+    }
+    v = f4_addvs(f4_mulvs(v, scale), 0.5f);
+    E5B9G9R9_t c;
+    c.r = (u32)v.x;
+    c.g = (u32)v.y;
+    c.b = (u32)v.z;
+    c.e = (u32)e;
+    return c;
+}
+pim_inline float4 VEC_CALL rgb9e5_f4(E5B9G9R9_t c)
+{
+    const float s = exp2f((float)c.e - 24.0f);
+    return f4_v(c.r * s, c.g * s, c.b * s, 1.0f);
+}
+
 // reference sRGB EOTF
 pim_inline float VEC_CALL f1_sRGB_EOTF(float V)
 {
@@ -248,6 +276,37 @@ pim_inline float4 VEC_CALL Xy16ToNormalTs(short2 xy)
     return n;
 }
 
+// octahedral encoding of a unit vector
+// "A Survey of Efficient Representations for Independent Unit Vectors", Cigolle et al
+pim_inline short2 VEC_CALL NormalToOct16(float4 n)
+{
+    n = f4_divvs(n, f1_abs(n.x) + f1_abs(n.y) + f1_abs(n.z) + kEpsilon);
+    float x = n.x;
+    float y = n.y;
+    if (n.z < 0.0f)
+    {
+        x = (1.0f - f1_abs(n.y)) * ((n.x >= 0.0f) ? 1.0f : -1.0f);
+        y = (1.0f - f1_abs(n.x)) * ((n.y >= 0.0f) ? 1.0f : -1.0f);
+    }
+    short2 oct;
+    oct.x = (i16)f1_round(f1_clamp(x, -1.0f, 1.0f) * 32767.0f);
+    oct.y = (i16)f1_round(f1_clamp(y, -1.0f, 1.0f) * 32767.0f);
+    return oct;
+}
+
+pim_inline float4 VEC_CALL Oct16ToNormal(short2 oct)
+{
+    float4 n;
+    n.x = oct.x * (1.0f / 32767.0f);
+    n.y = oct.y * (1.0f / 32767.0f);
+    n.z = 1.0f - (f1_abs(n.x) + f1_abs(n.y));
+    n.w = 0.0f;
+    float t = f1_sat(-n.z);
+    n.x += (n.x >= 0.0f) ? -t : t;
+    n.y += (n.y >= 0.0f) ? -t : t;
+    return f4_normalize3(n);
+}
+
 pim_inline R8G8B8A8_t VEC_CALL GammaEncode_rgba8(float4 lin)
 {
     return f4_rgba8(f4_sRGB_InverseEOTF_Fit(lin));
@@ -486,4 +486,65 @@ pim_inline i32 VEC_CALL u64_log2(u64 x)
     return y;
 }
 
+// ----------------------------------------------------------------------------
+// ieee 754 binary16
+
+typedef union f1_bits_u
+{
+    float f;
+    u32 u;
+} f1_bits_t;
+
+// round to nearest even, overflow to infinity
+pim_inline u16 VEC_CALL f1_half(float x)
+{
+    f1_bits_t b = { .f = x };
+    const u32 sign = b.u & 0x80000000u;
+    b.u ^= sign;
+    u32 h;
+    if (b.u >= 0x47800000u)
+    {
+        // inf or nan
+        h = (b.u > 0x7f800000u) ? 0x7e00u : 0x7c00u;
+    }
+    else if (b.u < 0x38800000u)
+    {
+        // subnormal or zero: let the fpu round the mantissa
+        const f1_bits_t denormMagic = { .u = 0x3f000000u };
+        b.f += denormMagic.f;
+        h = b.u - denormMagic.u;
+    }
+    else
+    {
+        const u32 mantOdd = (b.u >> 13) & 1u;
+        b.u += ((u32)(15 - 127) << 23) + 0xfffu;
+        b.u += mantOdd;
+        h = b.u >> 13;
+    }
+    return (u16)(h | (sign >> 16));
+}
+
+pim_inline float VEC_CALL half_f1(u16 h)
+{
+    const f1_bits_t magic = { .u = 113u << 23 };
+    const u32 shiftedExp = 0x7c00u << 13;
+    f1_bits_t b;
+    b.u = (h & 0x7fffu) << 13;
+    const u32 exp = shiftedExp & b.u;
+    b.u += (u32)(127 - 15) << 23;
+    if (exp == shiftedExp)
+    {
+        // inf or nan
+        b.u += (u32)(128 - 16) << 23;
+    }
+    else if (exp == 0)
+    {
+        // subnormal
+        b.u += 1u << 23;
+        b.f -= magic.f;
+    }
+    b.u |= (u32)(h & 0x8000u) << 16;
+    return b.f;
+}
+
 PIM_C_END
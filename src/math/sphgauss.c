@@ -16,11 +16,11 @@ pim_inline float4 VEC_CALL SampleDir(float2 Xi, SGDist dist)
     }
 }
 
-void SG_Accumulate(
+// one step of the progressive fit, given each lobe's basis value at the sample
+pim_inline void VEC_CALL SG_AccumulateBasis(
     float sampleWeight,
-    float4 dir,
     float4 rad,
-    const float4* pim_noalias axii,
+    const float* pim_noalias basis,
     float4* pim_noalias amplitudes,
     i32 length)
 {
@@ -35,20 +35,19 @@ void SG_Accumulate(
     float4 estimate = f4_0;
     for (i32 i = 0; i < length; ++i)
     {
-        estimate = f4_add(estimate, SG_Eval(axii[i], amplitudes[i], dir));
+        estimate = f4_add(estimate, f4_mulvs(amplitudes[i], basis[i]));
     }
 
     for (i32 i = 0; i < length; ++i)
     {
-        float4 axis = axii[i];
-        float basis = SG_BasisEval(axis, dir);
-        if (basis > 0.0f)
+        float b = basis[i];
+        if (b > 0.0f)
         {
             float4 amplitude = amplitudes[i];
             float weight = amplitude.w;
-            weight = f1_lerp(weight, basis, sampleWeight);
-            float4 otherLobes = f4_sub(estimate, f4_mulvs(amplitude, basis));
-            float4 thisLobe = f4_mulvs(f4_sub(rad, otherLobes), basis / weight);
+            weight = f1_lerp(weight, b, sampleWeight);
+            float4 otherLobes = f4_sub(estimate, f4_mulvs(amplitude, b));
+            float4 thisLobe = f4_mulvs(f4_sub(rad, otherLobes), b / weight);
             amplitude = f4_lerpvs(amplitude, thisLobe, sampleWeight);
             amplitude = f4_max(amplitude, f4_0);
             amplitude.w = weight;
@@ -57,6 +56,73 @@ void SG_Accumulate(
     }
 }
 
+void SG_Accumulate(
+    float sampleWeight,
+    float4 dir,
+    float4 rad,
+    const float4* pim_noalias axii,
+    float4* pim_noalias amplitudes,
+    i32 length)
+{
+    ASSERT(length <= kSGMaxLobes);
+    float basis[kSGMaxLobes];
+    for (i32 i = 0; i < length; ++i)
+    {
+        basis[i] = SG_BasisEval(axii[i], dir);
+    }
+    SG_AccumulateBasis(sampleWeight, rad, basis, amplitudes, length);
+}
+
+void SG_AccumulateN(
+    float sampleCount,
+    const float4* pim_noalias dirs,
+    const float4* pim_noalias rads,
+    i32 sampleLen,
+    const float4* pim_noalias axii,
+    float4* pim_noalias amplitudes,
+    i32 length)
+{
+    ASSERT(length <= kSGMaxLobes);
+    // the fit is order dependent, but the basis of each sample is not.
+    // evaluate it for a batch of samples at a time, lobe major,
+    // so the exponentials run over contiguous lanes.
+    for (i32 j0 = 0; j0 < sampleLen; j0 += kSGBatch)
+    {
+        const i32 n = i1_min(kSGBatch, sampleLen - j0);
+        float dx[kSGBatch];
+        float dy[kSGBatch];
+        float dz[kSGBatch];
+        for (i32 k = 0; k < n; ++k)
+        {
+            dx[k] = dirs[j0 + k].x;
+            dy[k] = dirs[j0 + k].y;
+            dz[k] = dirs[j0 + k].z;
+        }
+
+        float basis[kSGBatch][kSGMaxLobes];
+        for (i32 i = 0; i < length; ++i)
+        {
+            const float4 axis = axii[i];
+            float lane[kSGBatch];
+            for (i32 k = 0; k < kSGBatch; ++k)
+            {
+                float cosTheta = dx[k] * axis.x + dy[k] * axis.y + dz[k] * axis.z;
+                lane[k] = expf(axis.w * (cosTheta - 1.0f));
+            }
+            for (i32 k = 0; k < n; ++k)
+            {
+                basis[k][i] = lane[k];
+            }
+        }
+
+        for (i32 k = 0; k < n; ++k)
+        {
+            const float sampleWeight = 1.0f / (sampleCount + (j0 + k));
+            SG_AccumulateBasis(sampleWeight, rads[j0 + k], basis[k], amplitudes, length);
+        }
+    }
+}
+
 static float FitBasis(float target, i32 count)
 {
     float fit = 1.0f;
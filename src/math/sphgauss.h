@@ -17,6 +17,11 @@
 
 PIM_C_BEGIN
 
+// upper bound on the lobe count passed to the accumulators
+#define kSGMaxLobes     16
+// samples whose basis SG_AccumulateN evaluates at once
+#define kSGBatch        16
+
 // returns the value of a spherical gaussian basis when sampled by unit vector 'dir'
 pim_inline float VEC_CALL SG_BasisEval(float4 axis, float4 dir)
 {
@@ -125,6 +130,17 @@ void SG_Accumulate(
     float4* pim_noalias amplitudes, // sg amplitudes to fit
     i32 length);                    // number of spherical gaussians
 
+// SG_Accumulate over sampleLen samples in order, sample j weighted by
+// 1 / (sampleCount + j), with the lobe basis evaluated in batches.
+void SG_AccumulateN(
+    float sampleCount,                  // samples accumulated so far, >= 1
+    const float4* pim_noalias dirs,     // sample directions
+    const float4* pim_noalias rads,     // sample radiance
+    i32 sampleLen,                      // number of samples
+    const float4* pim_noalias axii,     // sg axii
+    float4* pim_noalias amplitudes,     // sg amplitudes to fit
+    i32 length);                        // number of spherical gaussians
+
 float SG_CalcSharpness(const float4* pim_noalias axii, i32 count);
 void SG_Generate(float4* pim_noalias directions, i32 count, SGDist dist);
 
@@ -342,6 +342,16 @@ typedef struct R16G16B16A16_s
 } R16G16B16A16_t;
 SASSERT(sizeof(R16G16B16A16_t) == 8);
 
+// unsigned hdr color sharing one exponent, as E5B9G9R9_UFLOAT_PACK32
+typedef struct E5B9G9R9_s
+{
+    u32 r : 9;
+    u32 g : 9;
+    u32 b : 9;
+    u32 e : 5;
+} E5B9G9R9_t;
+SASSERT(sizeof(E5B9G9R9_t) == 4);
+
 // ----------------------------------------------------------------------------
 
 typedef struct Ray_s
@@ -191,11 +191,255 @@ static i32 wsock_recv(Socket sock, void* dst, u32 len)
     if (wsock_isopen(sock))
     {
         rval = recv((SOCKET)sock.handle, (char*)dst, len, 0x0);
-        ASSERT(rval != SOCKET_ERROR);
+        ASSERT((rval != SOCKET_ERROR) || (WSAGetLastError() == WSAETIMEDOUT));
+    }
+    return rval;
+}
+
+// https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-select
+static bool wsock_poll(Socket sock, i32 ms)
+{
+    ASSERT(wsock_isopen(sock));
+    if (wsock_isopen(sock))
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET((SOCKET)sock.handle, &readable);
+        ms = ms > 0 ? ms : 0;
+        struct timeval timeout = { 0 };
+        timeout.tv_sec = ms / 1000;
+        timeout.tv_usec = (ms % 1000) * 1000;
+        i32 rval = select(0, &readable, NULL, NULL, &timeout);
+        return rval > 0;
+    }
+    return false;
+}
+
+// https://docs.microsoft.com/en-us/windows/win32/winsock/sol-socket-socket-options
+static bool wsock_settimeout(Socket sock, i32 ms)
+{
+    ASSERT(wsock_isopen(sock));
+    if (wsock_isopen(sock))
+    {
+        DWORD timeout = (DWORD)(ms > 0 ? ms : 0);
+        i32 rval = setsockopt((SOCKET)sock.handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        return rval != SOCKET_ERROR;
+    }
+    return false;
+}
+
+#else
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <ctype.h>
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif // MSG_NOSIGNAL
+
+// handles hold fd + 1, so that a zeroed Socket is closed
+static int psock_fd(Socket sock)
+{
+    return (int)((intptr_t)sock.handle - 1);
+}
+
+static struct sockaddr_in ToSockAddr(u32 addr, u16 port)
+{
+    ASSERT(addr != INADDR_NONE);
+    ASSERT(port);
+
+    struct sockaddr_in name = { 0 };
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = addr;
+    name.sin_port = htons(port);
+
+    return name;
+}
+
+static bool psock_url2addr(const char* url, u32* addr)
+{
+    if (!url)
+    {
+        return false;
+    }
+    u32 y = INADDR_NONE;
+    if (isalpha(url[0]))
+    {
+        // https://man7.org/linux/man-pages/man3/getaddrinfo.3.html
+        struct addrinfo hints = { 0 };
+        hints.ai_family = AF_INET;
+        struct addrinfo* info = NULL;
+        if ((getaddrinfo(url, NULL, &hints, &info) == 0) && info)
+        {
+            y = ((const struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr;
+            freeaddrinfo(info);
+        }
+    }
+    else
+    {
+        y = inet_addr(url);
+    }
+    *addr = y;
+    return y != INADDR_NONE;
+}
+
+static bool psock_isopen(Socket sock)
+{
+    return psock_fd(sock) >= 0;
+}
+
+static bool psock_open(Socket* sock, SocketProto proto)
+{
+    bool tcp = proto == SocketProto_TCP;
+    int fd = socket(
+        AF_INET,
+        tcp ? SOCK_STREAM : SOCK_DGRAM,
+        tcp ? IPPROTO_TCP : IPPROTO_UDP);
+    sock->handle = (void*)((intptr_t)fd + 1);
+    sock->proto = proto;
+    if (tcp && (fd >= 0))
+    {
+        // messages are sent whole, don't wait to coalesce them
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return psock_isopen(*sock);
+}
+
+static void psock_close(Socket* sock)
+{
+    if (psock_isopen(*sock))
+    {
+        i32 rval = close(psock_fd(*sock));
+        ASSERT(rval == 0);
+    }
+    sock->handle = NULL;
+}
+
+static bool psock_bind(Socket sock, u32 addr, u16 port)
+{
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        // rebinding a recently closed port is fine
+        int one = 1;
+        setsockopt(psock_fd(sock), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in name = ToSockAddr(addr, port);
+        i32 rval = bind(psock_fd(sock), (const struct sockaddr*)&name, sizeof(name));
+        return rval == 0;
+    }
+    return false;
+}
+
+static bool psock_listen(Socket sock)
+{
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        i32 rval = listen(psock_fd(sock), SOMAXCONN);
+        return rval == 0;
+    }
+    return false;
+}
+
+static Socket psock_accept(Socket sock, u32* addr)
+{
+    ASSERT(addr);
+    Socket result;
+    result.handle = NULL;
+    result.proto = sock.proto;
+    *addr = 0;
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        struct sockaddr_in saddr = { 0 };
+        socklen_t len = sizeof(saddr);
+        int fd = accept(psock_fd(sock), (struct sockaddr*)&saddr, &len);
+        if (fd >= 0)
+        {
+            *addr = saddr.sin_addr.s_addr;
+            result.handle = (void*)((intptr_t)fd + 1);
+        }
+    }
+    return result;
+}
+
+static bool psock_connect(Socket sock, u32 addr, u16 port)
+{
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        struct sockaddr_in name = ToSockAddr(addr, port);
+        i32 rval = connect(psock_fd(sock), (const struct sockaddr*)&name, sizeof(name));
+        return rval == 0;
+    }
+    return false;
+}
+
+static i32 psock_send(Socket sock, const void* src, u32 len)
+{
+    i32 rval = -1;
+    ASSERT(src);
+    ASSERT(len);
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        // a closed peer returns an error instead of raising SIGPIPE
+        rval = (i32)send(psock_fd(sock), src, len, MSG_NOSIGNAL);
     }
     return rval;
 }
 
+static i32 psock_recv(Socket sock, void* dst, u32 len)
+{
+    i32 rval = -1;
+    ASSERT(dst);
+    ASSERT(len);
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        rval = (i32)recv(psock_fd(sock), dst, len, 0x0);
+    }
+    return rval;
+}
+
+static bool psock_poll(Socket sock, i32 ms)
+{
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        struct pollfd pfd = { 0 };
+        pfd.fd = psock_fd(sock);
+        pfd.events = POLLIN;
+        i32 rval = poll(&pfd, 1, ms > 0 ? ms : 0);
+        return rval > 0;
+    }
+    return false;
+}
+
+static bool psock_settimeout(Socket sock, i32 ms)
+{
+    ASSERT(psock_isopen(sock));
+    if (psock_isopen(sock))
+    {
+        ms = ms > 0 ? ms : 0;
+        struct timeval timeout = { 0 };
+        timeout.tv_sec = ms / 1000;
+        timeout.tv_usec = (ms % 1000) * 1000;
+        i32 rval = setsockopt(psock_fd(sock), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return rval == 0;
+    }
+    return false;
+}
+
 #endif // PLAT_WINDOWS
 
 void NetSys_Init(void)
@@ -225,7 +469,7 @@ bool Net_UrlToAddr(const char* url, u32* addrOut)
 #if PLAT_WINDOWS
     return wsock_url2addr(url, addrOut);
 #else
-    return false;
+    return psock_url2addr(url, addrOut);
 #endif // PLAT_WINDOWS
 }
 
@@ -234,7 +478,7 @@ bool Socket_Open(Socket* sock, SocketProto proto)
 #if PLAT_WINDOWS
     return wsock_open(sock, proto);
 #else
-    return false;
+    return psock_open(sock, proto);
 #endif // PLAT_WINDOWS
 }
 
@@ -242,6 +486,8 @@ void Socket_Close(Socket* sock)
 {
 #if PLAT_WINDOWS
     wsock_close(sock);
+#else
+    psock_close(sock);
 #endif // PLAT_WINDOWS
 }
 
@@ -250,7 +496,7 @@ bool Socket_IsOpen(Socket sock)
 #if PLAT_WINDOWS
     return wsock_isopen(sock);
 #else
-    return false;
+    return psock_isopen(sock);
 #endif // PLAT_WINDOWS
 }
 
@@ -259,7 +505,7 @@ bool Socket_Bind(Socket sock, u32 addr, u16 port)
 #if PLAT_WINDOWS
     return wsock_bind(sock, addr, port);
 #else
-    return false;
+    return psock_bind(sock, addr, port);
 #endif // PLAT_WINDOWS
 }
 
@@ -268,7 +514,7 @@ bool Socket_Listen(Socket sock)
 #if PLAT_WINDOWS
     return wsock_listen(sock);
 #else
-    return false;
+    return psock_listen(sock);
 #endif // PLAT_WINDOWS
 }
 
@@ -277,8 +523,7 @@ Socket Socket_Accept(Socket sock, u32* addr)
 #if PLAT_WINDOWS
     return wsock_accept(sock, addr);
 #else
-    Socket s = {};
-    return s;
+    return psock_accept(sock, addr);
 #endif // PLAT_WINDOWS
 }
 
@@ -287,7 +532,7 @@ bool Socket_Connect(Socket sock, u32 addr, u16 port)
 #if PLAT_WINDOWS
     return wsock_connect(sock, addr, port);
 #else
-    return false;
+    return psock_connect(sock, addr, port);
 #endif // PLAT_WINDOWS
 }
 
@@ -296,7 +541,7 @@ i32 Socket_Send(Socket sock, const void* src, i32 len)
 #if PLAT_WINDOWS
     return wsock_send(sock, src, len);
 #else
-    return -1;
+    return psock_send(sock, src, len);
 #endif // PLAT_WINDOWS
 }
 
@@ -305,6 +550,24 @@ i32 Socket_Recv(Socket sock, void* dst, i32 len)
 #if PLAT_WINDOWS
     return wsock_recv(sock, dst, len);
 #else
-    return -1;
+    return psock_recv(sock, dst, len);
+#endif // PLAT_WINDOWS
+}
+
+bool Socket_SetTimeout(Socket sock, i32 ms)
+{
+#if PLAT_WINDOWS
+    return wsock_settimeout(sock, ms);
+#else
+    return psock_settimeout(sock, ms);
+#endif // PLAT_WINDOWS
+}
+
+bool Socket_Poll(Socket sock, i32 ms)
+{
+#if PLAT_WINDOWS
+    return wsock_poll(sock, ms);
+#else
+    return psock_poll(sock, ms);
 #endif // PLAT_WINDOWS
 }
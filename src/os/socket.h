@@ -34,5 +34,9 @@ bool Socket_Connect(Socket sock, u32 addr, u16 port);
 
 i32 Socket_Send(Socket sock, const void* src, i32 len);
 i32 Socket_Recv(Socket sock, void* dst, i32 len);
+// receives that wait longer than ms fail, 0 waits forever
+bool Socket_SetTimeout(Socket sock, i32 ms);
+// waits up to ms for data, or for a connection to accept on a listening socket
+bool Socket_Poll(Socket sock, i32 ms);
 
 PIM_C_END
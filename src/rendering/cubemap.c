@@ -147,6 +147,8 @@ static void BakeFn(void* pBase, i32 begin, i32 end)
 
     const i32 size = cm->size;
     const i32 flen = size * size;
+    // each face spans a quarter turn
+    const float spread = (0.5f * kPi) / size;
 
     Prng* rng = Prng_Get();
     for (i32 i = begin; i < end; ++i)
@@ -156,7 +158,7 @@ static void BakeFn(void* pBase, i32 begin, i32 end)
         int2 coord = { fi % size, fi / size };
         float2 Xi = f2_tent(Prng_float2(rng));
         float4 dir = Cubemap_CalcDir(size, face, coord, Xi);
-        PtResult result = Pt_TraceRay(scene, origin, dir);
+        PtResult result = Pt_TraceRay(scene, origin, dir, spread);
         cm->color[face][fi] = f3_lerpvs(cm->color[face][fi], result.color, weight);
     }
 }
@@ -3,8 +3,19 @@
 #include "common/time.h"
 #include "common/profiler.h"
 #include "common/fnv1a.h"
+#include "common/atomics.h"
+#include "common/stringutil.h"
+#include "common/cvars.h"
+#include "math/scalar.h"
+#include "allocator/allocator.h"
+#include "threading/thread.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
+#include "threading/taskcpy.h"
+#include "threading/task.h"
 #include <OpenImageDenoise/oidn.h>
 #include <string.h>
+#include <math.h>
 
 typedef struct CacheKey_s
 {
@@ -14,12 +25,61 @@ typedef struct CacheKey_s
     const void* albedo;
     const void* normal;
     const void* output;
+    i32 maxMemoryMB;
 } CacheKey;
 
 #define kMaxCachedFilters 8
+// rough upper bound of the memory used to denoise a pixel: oidn's scratch
+// buffers plus the tile copies of the inputs and output
+#define kBytesPerPixel 512
+// pixels over which neighboring tiles are blended
+#define kTileOverlap 64
+
+// scratch copies of one tile's inputs and output
+typedef struct DenoiseTile_s
+{
+    int2 size;
+    float3* color;
+    float3* albedo;
+    float3* normal;
+    float3* output;
+} DenoiseTile;
+
+typedef enum
+{
+    AsyncState_Idle,
+    AsyncState_Queued,
+    AsyncState_Done,
+} AsyncState;
+
+// a snapshot of one image, denoised on a dedicated thread
+typedef struct DenoiseAsync_s
+{
+    Thread thread;
+    Semaphore wake;
+    i32 running;
+    i32 state;
+    bool success;
+    DenoiseType type;
+    int2 size;
+    u32 tag;
+    float3* color;
+    float3* albedo;
+    float3* normal;
+    float3* output;
+    i32 maxMemoryMB;
+    // first error raised on the thread, logged by the main thread
+    char error[PIM_PATH];
+} DenoiseAsync;
 
 static bool ms_once;
 static OIDNDevice ms_device;
+// guards the device and filter cache
+static bool ms_lockInit;
+static Mutex ms_lock;
+static DenoiseAsync ms_async;
+static DenoiseTile ms_tile;
+static pim_thread_local bool ms_deferLog;
 
 static u64 ms_cacheTicks[kMaxCachedFilters];
 static u32 ms_cacheHashes[kMaxCachedFilters];
@@ -33,7 +93,18 @@ static bool LogErrors(void)
     while (oidnGetDeviceError(ms_device, &msg) != OIDN_ERROR_NONE)
     {
         hadError = true;
-        Con_Logf(LogSev_Error, "oidn", "%s", msg);
+        if (ms_deferLog)
+        {
+            // the console is not thread safe
+            if (!ms_async.error[0])
+            {
+                StrCpy(ARGS(ms_async.error), msg);
+            }
+        }
+        else
+        {
+            Con_Logf(LogSev_Error, "oidn", "%s", msg);
+        }
     }
     return hadError;
 }
@@ -51,9 +122,11 @@ static bool EnsureInit(void)
             LogErrors();
             return false;
         }
+        // the async denoiser overlaps the task system, which already has a
+        // worker per core. take half of them rather than oversubscribing.
+        oidnSetDevice1i(ms_device, "numThreads", i1_max(1, Task_ThreadCount() / 2));
         oidnCommitDevice(ms_device);
 
-
         LogErrors();
     }
     return ms_device != NULL;
@@ -100,6 +173,7 @@ static OIDNFilter NewFilter(const CacheKey* key)
     }
 
     oidnSetFilter1b(filter, "hdr", true);
+    oidnSetFilter1i(filter, "maxMemoryMB", key->maxMemoryMB);
     SetImage(filter, "color", key->size, key->color);
     SetImage(filter, "output", key->size, key->output);
     if (key->albedo)
@@ -149,16 +223,22 @@ static i32 FindFilter(const CacheKey* key)
     return -1;
 }
 
-static i32 FindLRU(void)
+// least recently used slot, or -1 if all are empty and occupied was set
+static i32 FindLRU(bool occupied)
 {
     u64 now = Time_Now();
     u64 diff = 0;
-    i32 chosen = 0;
+    i32 chosen = occupied ? -1 : 0;
     const u64* ticks = ms_cacheTicks;
+    const OIDNFilter* values = ms_cacheValues;
     for (i32 i = 0; i < kMaxCachedFilters; ++i)
     {
+        if (occupied && !values[i])
+        {
+            continue;
+        }
         u64 iDiff = now - ticks[i];
-        if (iDiff > diff)
+        if ((iDiff > diff) || (chosen == -1))
         {
             chosen = i;
             diff = iDiff;
@@ -167,17 +247,51 @@ static i32 FindLRU(void)
     return chosen;
 }
 
+// estimated memory held by a filter, in megabytes
+static i32 FilterMB(const CacheKey* key)
+{
+    double bytes = (double)key->size.x * key->size.y * kBytesPerPixel;
+    i32 mb = (i32)(bytes / (1 << 20)) + 1;
+    return i1_min(mb, key->maxMemoryMB);
+}
+
+static void ReleaseFilter(i32 i)
+{
+    if (ms_cacheValues[i])
+    {
+        oidnReleaseFilter(ms_cacheValues[i]);
+        ms_cacheValues[i] = NULL;
+        ms_cacheHashes[i] = 0;
+        ms_cacheTicks[i] = 0;
+    }
+}
+
 static OIDNFilter GetFilter(const CacheKey* key)
 {
     i32 i = FindFilter(key);
     if (i == -1)
     {
-        i = FindLRU();
-        if (ms_cacheValues[i])
+        // every cached filter counts against the memory cap, not only the
+        // one being created, so release old ones until the new one fits.
+        i32 cachedMB = 0;
+        for (i32 j = 0; j < kMaxCachedFilters; ++j)
         {
-            oidnReleaseFilter(ms_cacheValues[i]);
-            ms_cacheValues[i] = NULL;
+            cachedMB += ms_cacheValues[j] ? FilterMB(&ms_cacheKeys[j]) : 0;
         }
+        const i32 needMB = FilterMB(key);
+        while ((cachedMB + needMB) > key->maxMemoryMB)
+        {
+            i32 lru = FindLRU(true);
+            if (lru == -1)
+            {
+                break;
+            }
+            cachedMB -= FilterMB(&ms_cacheKeys[lru]);
+            ReleaseFilter(lru);
+        }
+
+        i = FindLRU(false);
+        ReleaseFilter(i);
 
         OIDNFilter newFilter = NewFilter(key);
         if (!newFilter)
@@ -193,30 +307,24 @@ static OIDNFilter GetFilter(const CacheKey* key)
     return ms_cacheValues[i];
 }
 
-ProfileMark(pm_Denoise, Denoise)
-bool Denoise(
+static void EnsureLock(void)
+{
+    if (!ms_lockInit)
+    {
+        ms_lockInit = true;
+        Mutex_New(&ms_lock);
+    }
+}
+
+static bool Execute(
     DenoiseType type,
     int2 size,
     const float3* color,
     const float3* albedo,
     const float3* normal,
-    float3* output)
+    float3* output,
+    i32 maxMemoryMB)
 {
-    ProfileBegin(pm_Denoise);
-    bool success = true;
-
-    if (!EnsureInit())
-    {
-        success = false;
-        goto onreturn;
-    }
-
-    if (!color || !output)
-    {
-        success = false;
-        goto onreturn;
-    }
-
     const CacheKey key =
     {
         .type = type,
@@ -225,32 +333,415 @@ bool Denoise(
         .albedo = albedo,
         .normal = normal,
         .output = output,
+        .maxMemoryMB = maxMemoryMB,
     };
 
     OIDNFilter filter = GetFilter(&key);
     if (!filter)
     {
-        success = false;
-        goto onreturn;
+        return false;
     }
 
     oidnExecuteFilter(filter);
 
-    if (LogErrors())
+    return !LogErrors();
+}
+
+// edge length of the largest square tile within the memory cap
+static i32 CalcTileSize(i32 maxMemoryMB)
+{
+    double pixels = ((double)maxMemoryMB * (1 << 20)) / kBytesPerPixel;
+    i32 tileSize = (i32)sqrt(pixels);
+    return i1_max(tileSize, kTileOverlap * 4);
+}
+
+static void ResizeTile(int2 size, bool albedo, bool normal)
+{
+    DenoiseTile* tile = &ms_tile;
+    if ((tile->size.x != size.x) ||
+        (tile->size.y != size.y) ||
+        ((tile->albedo != NULL) != albedo) ||
+        ((tile->normal != NULL) != normal))
+    {
+        const i32 len = size.x * size.y;
+        Mem_Free(tile->color);
+        Mem_Free(tile->albedo);
+        Mem_Free(tile->normal);
+        Mem_Free(tile->output);
+        tile->size = size;
+        tile->color = Tex_Alloc(sizeof(float3) * len);
+        tile->albedo = albedo ? Tex_Alloc(sizeof(float3) * len) : NULL;
+        tile->normal = normal ? Tex_Alloc(sizeof(float3) * len) : NULL;
+        tile->output = Tex_Alloc(sizeof(float3) * len);
+    }
+}
+
+static void CopyToTile(float3* dst, const float3* src, int2 size, int2 tileSize, int2 origin)
+{
+    for (i32 y = 0; y < tileSize.y; ++y)
+    {
+        const float3* row = src + (origin.y + y) * size.x + origin.x;
+        memcpy(dst + y * tileSize.x, row, sizeof(float3) * tileSize.x);
+    }
+}
+
+// blend weight of a tile's pixel, ramping down towards edges shared with other tiles
+pim_inline float VEC_CALL TileWeight(i32 u, i32 origin, i32 tileLen, i32 imageLen)
+{
+    float w = 1.0f;
+    if (origin > 0)
+    {
+        w = f1_min(w, (u + 0.5f) / kTileOverlap);
+    }
+    if ((origin + tileLen) < imageLen)
+    {
+        w = f1_min(w, (tileLen - u - 0.5f) / kTileOverlap);
+    }
+    return w;
+}
+
+// number of tiles along an axis
+static i32 TileCount(i32 imageLen, i32 tileLen)
+{
+    const i32 step = tileLen - kTileOverlap;
+    return (imageLen <= tileLen) ? 1 : (1 + (imageLen - tileLen + step - 1) / step);
+}
+
+static i32 TileOrigin(i32 i, i32 imageLen, i32 tileLen)
+{
+    const i32 step = tileLen - kTileOverlap;
+    return i1_max(0, i1_min(i * step, imageLen - tileLen));
+}
+
+// denoises overlapping tiles that fit within the memory cap,
+// and blends them together so that tile edges do not seam
+static bool DenoiseTiled(
+    DenoiseType type,
+    int2 size,
+    const float3* color,
+    const float3* albedo,
+    const float3* normal,
+    float3* output,
+    i32 maxMemoryMB,
+    i32 tileEdge)
+{
+    const int2 tileSize = { i1_min(tileEdge, size.x), i1_min(tileEdge, size.y) };
+    ResizeTile(tileSize, albedo != NULL, normal != NULL);
+    const DenoiseTile* tile = &ms_tile;
+
+    // blend into the output in place, beside a buffer of summed weights
+    ASSERT(output != color);
+    const i32 len = size.x * size.y;
+    memset(output, 0, sizeof(output[0]) * len);
+    float* pim_noalias weights = Tex_Calloc(sizeof(weights[0]) * len);
+
+    bool success = true;
+    const i32 countX = TileCount(size.x, tileSize.x);
+    const i32 countY = TileCount(size.y, tileSize.y);
+    for (i32 ty = 0; success && (ty < countY); ++ty)
+    {
+        for (i32 tx = 0; success && (tx < countX); ++tx)
+        {
+            const int2 origin =
+            {
+                TileOrigin(tx, size.x, tileSize.x),
+                TileOrigin(ty, size.y, tileSize.y),
+            };
+            CopyToTile(tile->color, color, size, tileSize, origin);
+            if (albedo)
+            {
+                CopyToTile(tile->albedo, albedo, size, tileSize, origin);
+            }
+            if (normal)
+            {
+                CopyToTile(tile->normal, normal, size, tileSize, origin);
+            }
+
+            success = Execute(
+                type,
+                tileSize,
+                tile->color,
+                tile->albedo,
+                tile->normal,
+                tile->output,
+                maxMemoryMB);
+
+            for (i32 y = 0; success && (y < tileSize.y); ++y)
+            {
+                const float wy = TileWeight(y, origin.y, tileSize.y, size.y);
+                const i32 offset = (origin.y + y) * size.x + origin.x;
+                float3* pim_noalias dst = output + offset;
+                float* pim_noalias dstWeights = weights + offset;
+                const float3* pim_noalias src = tile->output + y * tileSize.x;
+                for (i32 x = 0; x < tileSize.x; ++x)
+                {
+                    const float w = wy * TileWeight(x, origin.x, tileSize.x, size.x);
+                    dst[x].x += src[x].x * w;
+                    dst[x].y += src[x].y * w;
+                    dst[x].z += src[x].z * w;
+                    dstWeights[x] += w;
+                }
+            }
+        }
+    }
+
+    if (success)
+    {
+        for (i32 i = 0; i < len; ++i)
+        {
+            const float rcpW = (weights[i] > 0.0f) ? (1.0f / weights[i]) : 0.0f;
+            output[i].x *= rcpW;
+            output[i].y *= rcpW;
+            output[i].z *= rcpW;
+        }
+    }
+
+    Mem_Free(weights);
+    return success;
+}
+
+// expects ms_lock to be held
+static bool DenoiseLocked(
+    DenoiseType type,
+    int2 size,
+    const float3* color,
+    const float3* albedo,
+    const float3* normal,
+    float3* output,
+    i32 maxMemoryMB)
+{
+    if (!EnsureInit())
     {
-        success = false;
-        goto onreturn;
+        return false;
     }
+    if (!color || !output)
+    {
+        return false;
+    }
+
+    const i32 tileEdge = CalcTileSize(maxMemoryMB);
+    if ((size.x <= tileEdge) && (size.y <= tileEdge))
+    {
+        return Execute(type, size, color, albedo, normal, output, maxMemoryMB);
+    }
+    return DenoiseTiled(type, size, color, albedo, normal, output, maxMemoryMB, tileEdge);
+}
+
+ProfileMark(pm_Denoise, Denoise)
+bool Denoise(
+    DenoiseType type,
+    int2 size,
+    const float3* color,
+    const float3* albedo,
+    const float3* normal,
+    float3* output)
+{
+    ProfileBegin(pm_Denoise);
+
+    EnsureLock();
+    Mutex_Lock(&ms_lock);
+    bool success = DenoiseLocked(
+        type, size, color, albedo, normal, output, ConVar_GetInt(&cv_r_denoise_mem));
+    Mutex_Unlock(&ms_lock);
 
-onreturn:
     ProfileEnd(pm_Denoise);
     return success;
 }
 
+static i32 DenoiseLoop(void* arg)
+{
+    // the profiler indexes by task thread id, so this thread stays unprofiled
+    ms_deferLog = true;
+    DenoiseAsync* async = &ms_async;
+    while (true)
+    {
+        Semaphore_Wait(async->wake);
+        if (!load_i32(&async->running, MO_Acquire))
+        {
+            break;
+        }
+        if (load_i32(&async->state, MO_Acquire) == AsyncState_Queued)
+        {
+            Mutex_Lock(&ms_lock);
+            async->success = DenoiseLocked(
+                async->type,
+                async->size,
+                async->color,
+                async->albedo,
+                async->normal,
+                async->output,
+                async->maxMemoryMB);
+            Mutex_Unlock(&ms_lock);
+            store_i32(&async->state, AsyncState_Done, MO_Release);
+        }
+    }
+    return 0;
+}
+
+static void ResizeImage(float3** pImage, i32 len, bool enable)
+{
+    Mem_Free(*pImage);
+    *pImage = enable ? Tex_Calloc(sizeof(float3) * len) : NULL;
+}
+
+ProfileMark(pm_DenoiseSubmit, Denoise_Submit)
+bool Denoise_Submit(
+    DenoiseType type,
+    int2 size,
+    const float3* color,
+    const float3* albedo,
+    const float3* normal,
+    u32 tag)
+{
+    DenoiseAsync* async = &ms_async;
+    if (load_i32(&async->state, MO_Acquire) != AsyncState_Idle)
+    {
+        return false;
+    }
+    if (!color || (size.x <= 0) || (size.y <= 0))
+    {
+        return false;
+    }
+
+    ProfileBegin(pm_DenoiseSubmit);
+
+    EnsureLock();
+    if (!async->running)
+    {
+        store_i32(&async->running, 1, MO_Release);
+        Semaphore_New(&async->wake, 0);
+        Thread_New(&async->thread, DenoiseLoop, NULL);
+    }
+
+    const i32 len = size.x * size.y;
+    if ((async->size.x != size.x) ||
+        (async->size.y != size.y) ||
+        ((async->albedo != NULL) != (albedo != NULL)) ||
+        ((async->normal != NULL) != (normal != NULL)))
+    {
+        ResizeImage(&async->color, len, true);
+        ResizeImage(&async->albedo, len, albedo != NULL);
+        ResizeImage(&async->normal, len, normal != NULL);
+        ResizeImage(&async->output, len, true);
+    }
+    async->type = type;
+    async->size = size;
+    async->tag = tag;
+    async->maxMemoryMB = ConVar_GetInt(&cv_r_denoise_mem);
+    async->success = false;
+    taskcpy(async->color, color, sizeof(color[0]), len);
+    if (albedo)
+    {
+        taskcpy(async->albedo, albedo, sizeof(albedo[0]), len);
+    }
+    if (normal)
+    {
+        taskcpy(async->normal, normal, sizeof(normal[0]), len);
+    }
+    store_i32(&async->state, AsyncState_Queued, MO_Release);
+    Semaphore_Signal(async->wake, 1);
+
+    ProfileEnd(pm_DenoiseSubmit);
+    return true;
+}
+
+ProfileMark(pm_DenoisePoll, Denoise_Poll)
+DenoiseStatus Denoise_Poll(int2 size, float3* output, u32* tagOut)
+{
+    DenoiseAsync* async = &ms_async;
+    switch (load_i32(&async->state, MO_Acquire))
+    {
+    default:
+    case AsyncState_Idle:
+        return DenoiseStatus_Idle;
+    case AsyncState_Queued:
+        return DenoiseStatus_Busy;
+    case AsyncState_Done:
+        break;
+    }
+
+    ProfileBegin(pm_DenoisePoll);
+
+    DenoiseStatus status = DenoiseStatus_Idle;
+    if (async->error[0])
+    {
+        Con_Logf(LogSev_Error, "oidn", "%s", async->error);
+        async->error[0] = 0;
+    }
+    if (!async->success)
+    {
+        status = DenoiseStatus_Failed;
+    }
+    else if (output && (async->size.x == size.x) && (async->size.y == size.y))
+    {
+        taskcpy(output, async->output, sizeof(output[0]), size.x * size.y);
+        if (tagOut)
+        {
+            *tagOut = async->tag;
+        }
+        status = DenoiseStatus_Complete;
+    }
+    store_i32(&async->state, AsyncState_Idle, MO_Release);
+
+    ProfileEnd(pm_DenoisePoll);
+    return status;
+}
+
+void Denoise_Shutdown(void)
+{
+    DenoiseAsync* async = &ms_async;
+    if (async->running)
+    {
+        store_i32(&async->running, 0, MO_Release);
+        Semaphore_Signal(async->wake, 1);
+        Thread_Join(&async->thread);
+        Semaphore_Del(&async->wake);
+    }
+    Mem_Free(async->color);
+    Mem_Free(async->albedo);
+    Mem_Free(async->normal);
+    Mem_Free(async->output);
+    memset(async, 0, sizeof(*async));
+
+    DenoiseTile* tile = &ms_tile;
+    Mem_Free(tile->color);
+    Mem_Free(tile->albedo);
+    Mem_Free(tile->normal);
+    Mem_Free(tile->output);
+    memset(tile, 0, sizeof(*tile));
+
+    for (i32 i = 0; i < kMaxCachedFilters; ++i)
+    {
+        if (ms_cacheValues[i])
+        {
+            oidnReleaseFilter(ms_cacheValues[i]);
+        }
+    }
+    memset(ms_cacheTicks, 0, sizeof(ms_cacheTicks));
+    memset(ms_cacheHashes, 0, sizeof(ms_cacheHashes));
+    memset(ms_cacheKeys, 0, sizeof(ms_cacheKeys));
+    memset(ms_cacheValues, 0, sizeof(ms_cacheValues));
+    if (ms_device)
+    {
+        oidnReleaseDevice(ms_device);
+        ms_device = NULL;
+    }
+    ms_once = false;
+
+    if (ms_lockInit)
+    {
+        ms_lockInit = false;
+        Mutex_Del(&ms_lock);
+    }
+}
+
 void Denoise_Evict(void)
 {
     if (!ms_device)
         return;
+    // the denoise thread is using the cache, try again next frame
+    if (!Mutex_TryLock(&ms_lock))
+        return;
 
     u64 now = Time_Now();
     for (i32 i = 0; i < kMaxCachedFilters; ++i)
@@ -267,4 +758,6 @@ void Denoise_Evict(void)
             }
         }
     }
+
+    Mutex_Unlock(&ms_lock);
 }
@@ -23,4 +23,31 @@ bool Denoise(
 
 void Denoise_Evict(void);
 
+typedef enum
+{
+    DenoiseStatus_Idle,         // no request in flight
+    DenoiseStatus_Busy,         // a request is in flight
+    DenoiseStatus_Complete,     // a request completed and its output was copied
+    DenoiseStatus_Failed,       // a request failed
+
+    DenoiseStatus_COUNT
+} DenoiseStatus;
+
+// denoises a snapshot of the inputs on a dedicated thread.
+// returns false while a previous request has not been polled.
+bool Denoise_Submit(
+    DenoiseType type,
+    int2 size,
+    const float3* color,
+    const float3* albedo,
+    const float3* normal,
+    u32 tag);
+
+// copies a completed request of matching size into output,
+// along with the tag it was submitted with.
+DenoiseStatus Denoise_Poll(int2 size, float3* output, u32* tagOut);
+
+// joins the denoise thread and releases the device
+void Denoise_Shutdown(void);
+
 PIM_C_END
@@ -11,11 +11,12 @@
 #include "math/sampling.h"
 #include "math/sh.h"
 #include "math/sphgauss.h"
+#include "math/color.h"
 #include "common/console.h"
 #include "common/sort.h"
+#include "containers/dict.h"
 #include "common/stringutil.h"
 #include "threading/task.h"
-#include "threading/mutex.h"
 #include "rendering/path_tracer.h"
 #include "rendering/sampler.h"
 #include "rendering/mesh.h"
@@ -25,24 +26,32 @@
 #include "rendering/vulkan/vkr_textable.h"
 #include "common/profiler.h"
 #include "common/cmd.h"
-#include "common/atomics.h"
+#include "common/cvars.h"
+#include "common/fnv1a.h"
 #include "assets/crate.h"
 #include "io/fstr.h"
+#include "io/dir.h"
 #include <stb/stb_image_write.h>
 #include <string.h>
 
 pim_optimize;
 
 #define CHART_SPLITS        2
-#define ROW_RESET           -(1<<20)
 #define kUnmappedMaterials  (MatFlag_Sky | MatFlag_Lava)
 #define kMaskPadding        (1.0f)
 #define kFillPadding        (2.0f)
+// samples before a texel's variance estimate is trusted
+#define kLmMinSamples       16.0f
+// samples after which a texel is considered converged regardless of error
+#define kLmMaxSamples       16384.0f
 
+// bitset of the texels a chart covers, bit (x & 63) of word (x >> 6) in each row
 typedef struct mask_s
 {
     int2 size;
-    u8* pim_noalias ptr;
+    // u64 words per row
+    i32 stride;
+    u64* pim_noalias ptr;
 } mask_t;
 
 typedef struct chartnode_s
@@ -64,11 +73,15 @@ typedef struct chart_s
     float area;
 } chart_t;
 
+// skyline of an atlas: the first free row of each column.
+// charts drop onto it by their per column extents, so irregular masks
+// nest into each other's silhouettes.
 typedef struct atlas_s
 {
-    Mutex mtx;
-    mask_t mask;
-    i32 chartCount;
+    i32* pim_noalias heights;
+    i32 size;
+    // lowest skyline height; charts taller than size - floor are skipped
+    i32 floor;
 } atlas_t;
 
 static LmPack ms_pack;
@@ -78,6 +91,37 @@ static cmdstat_t CmdPrintLm(i32 argc, const char** argv);
 
 LmPack* LmPack_Get(void) { return &ms_pack; }
 
+// bytes of a lightmap's single texel allocation, as saved to disk
+pim_inline i32 Lightmap_Bytes(i32 size)
+{
+    const Lightmap lmNull = { 0 };
+    const i32 texelcount = size * size;
+    const i32 probesBytes = sizeof(lmNull.probes[0][0]) * texelcount * kGiDirections;
+    const i32 positionBytes = sizeof(lmNull.position[0]) * texelcount;
+    const i32 normalBytes = sizeof(lmNull.normal[0]) * texelcount;
+    const i32 sampleBytes = sizeof(lmNull.sampleCounts[0]) * texelcount;
+    const i32 momentBytes = sizeof(lmNull.moments[0]) * texelcount;
+    return probesBytes + sampleBytes + positionBytes + normalBytes + momentBytes;
+}
+
+pim_inline i32 Lightmap_TilesPerRow(i32 size)
+{
+    return (size + kLmUploadTile - 1) / kLmUploadTile;
+}
+
+// bytes of a lightmap in LmFormat_Compact
+pim_inline i32 Lightmap_CompactBytes(i32 size)
+{
+    const i32 texelcount = size * size;
+    const i32 probesBytes = sizeof(E5B9G9R9_t) * texelcount * kGiDirections;
+    const i32 positionBytes = sizeof(float3) * texelcount;
+    const i32 normalBytes = sizeof(short2) * texelcount;
+    const i32 sampleBytes = sizeof(float) * texelcount;
+    const i32 momentBytes = sizeof(float2) * texelcount;
+    const i32 weightBytes = sizeof(u16) * texelcount * kGiDirections;
+    return probesBytes + positionBytes + normalBytes + sampleBytes + momentBytes + weightBytes;
+}
+
 void Lightmap_New(Lightmap* lm, i32 size)
 {
     ASSERT(lm);
@@ -91,7 +135,8 @@ void Lightmap_New(Lightmap* lm, i32 size)
     i32 positionBytes = sizeof(lm->position[0]) * texelcount;
     i32 normalBytes = sizeof(lm->normal[0]) * texelcount;
     i32 sampleBytes = sizeof(lm->sampleCounts[0]) * texelcount;
-    i32 texelBytes = probesBytes + sampleBytes + positionBytes + normalBytes;
+    i32 momentBytes = sizeof(lm->moments[0]) * texelcount;
+    i32 texelBytes = probesBytes + sampleBytes + positionBytes + normalBytes + momentBytes;
     u8* allocation = Tex_Calloc(texelBytes);
 
     for (i32 i = 0; i < kGiDirections; ++i)
@@ -109,15 +154,25 @@ void Lightmap_New(Lightmap* lm, i32 size)
     lm->sampleCounts = (float*)allocation;
     allocation += sizeof(float) * texelcount;
 
-    lm->slot = vkrTexTable_Alloc(
-        VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-        VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-        size,
-        size,
-        1,
-        kGiDirections,
-        true);
+    lm->moments = (float2*)allocation;
+    allocation += sizeof(float2) * texelcount;
+
+    const i32 tilesPerRow = Lightmap_TilesPerRow(size);
+    const i32 tileWords = (tilesPerRow * tilesPerRow + 63) / 64;
+    lm->uploadTiles = Perm_Calloc(sizeof(lm->uploadTiles[0]) * tileWords);
+
+    if (vkrSys_Active())
+    {
+        lm->slot = vkrTexTable_Alloc(
+            VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+            VK_FORMAT_R16G16B16A16_SFLOAT,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            size,
+            size,
+            1,
+            kGiDirections,
+            true);
+    }
 
     Lightmap_Upload(lm);
 }
@@ -126,21 +181,103 @@ void Lightmap_Del(Lightmap* lm)
 {
     if (lm)
     {
-        vkrTexTable_Free(lm->slot);
+        if (vkrSys_Active())
+        {
+            vkrTexTable_Free(lm->slot);
+        }
         Mem_Free(lm->probes[0]);
+        Mem_Free(lm->uploadTiles);
         memset(lm, 0, sizeof(*lm));
     }
 }
 
+typedef struct HalfTask_s
+{
+    Task task;
+    const float4* pim_noalias src;
+    u16* pim_noalias dst;
+} HalfTask;
+
+// largest finite half
+#define kHalfMax 65504.0f
+
+// saturates like the rgb9e5 disk format, f1_half would overflow to inf
+pim_inline void VEC_CALL ProbeToHalf(float4 v, u16* pim_noalias dst)
+{
+    dst[0] = f1_half(f1_clamp(v.x, -kHalfMax, kHalfMax));
+    dst[1] = f1_half(f1_clamp(v.y, -kHalfMax, kHalfMax));
+    dst[2] = f1_half(f1_clamp(v.z, -kHalfMax, kHalfMax));
+    // amplitude.w is the bake's accumulation weight, unused by shading
+    dst[3] = 0;
+}
+
+static void HalfFn(void* pbase, i32 begin, i32 end)
+{
+    HalfTask* task = pbase;
+    const float4* pim_noalias src = task->src;
+    u16* pim_noalias dst = task->dst;
+    for (i32 i = begin; i < end; ++i)
+    {
+        ProbeToHalf(src[i], dst + i * 4);
+    }
+}
+
+ProfileMark(pm_LmUpload, Lightmap_Upload)
 void Lightmap_Upload(Lightmap* lm)
 {
     ASSERT(lm);
+    if (!vkrSys_Active())
+    {
+        return;
+    }
+    ProfileBegin(pm_LmUpload);
+
+    // probes are one allocation, direction major, as the layers are
     const i32 len = lm->size * lm->size;
-    for (i32 i = 0; i < kGiDirections; ++i)
+    HalfTask* task = Temp_Calloc(sizeof(*task));
+    task->src = lm->probes[0];
+    task->dst = Tex_Alloc(sizeof(task->dst[0]) * 4 * len * kGiDirections);
+    Task_Run(task, HalfFn, len * kGiDirections);
+
+    vkrTexTable_UploadRegion(
+        lm->slot,
+        0,
+        kGiDirections,
+        i2_0,
+        i2_s(lm->size),
+        task->dst,
+        sizeof(task->dst[0]) * 4 * len * kGiDirections);
+    Mem_Free(task->dst);
+
+    const i32 tilesPerRow = Lightmap_TilesPerRow(lm->size);
+    memset(lm->uploadTiles, 0, sizeof(lm->uploadTiles[0]) * ((tilesPerRow * tilesPerRow + 63) / 64));
+
+    ProfileEnd(pm_LmUpload);
+}
+
+// value written to texIndices.w of the triangles in a lightmap.
+// without a gpu every slot is empty, so the lightmap index stands in.
+pim_inline i32 LmTexId(const Lightmap* lightmaps, i32 iLightmap)
+{
+    return vkrSys_Active() ? lightmaps[iLightmap].slot.index : iLightmap;
+}
+
+i32 LmPack_Find(const LmPack* pack, i32 texId)
+{
+    ASSERT(pack);
+    if (!vkrSys_Active())
     {
-        const float4* pim_noalias probes = lm->probes[i];
-        vkrTexTable_Upload(lm->slot, i, probes, sizeof(probes[0]) * len);
+        return ((texId >= 0) && (texId < pack->lmCount)) ? texId : -1;
+    }
+    const Lightmap* lightmaps = pack->lightmaps;
+    for (i32 i = 0; i < pack->lmCount; ++i)
+    {
+        if (lightmaps[i].slot.index == texId)
+        {
+            return i;
+        }
     }
+    return -1;
 }
 
 pim_inline i32 TexelCount(const Lightmap* lightmaps, i32 lmCount)
@@ -156,10 +293,10 @@ pim_inline i32 TexelCount(const Lightmap* lightmaps, i32 lmCount)
 
 pim_inline mask_t VEC_CALL mask_new(int2 size)
 {
-    i32 len = size.x * size.y;
     mask_t mask;
     mask.size = size;
-    mask.ptr = Perm_Calloc(sizeof(u8) * len);
+    mask.stride = (size.x + 63) >> 6;
+    mask.ptr = Perm_Calloc(sizeof(mask.ptr[0]) * mask.stride * size.y);
     return mask;
 }
 
@@ -169,64 +306,7 @@ pim_inline void VEC_CALL mask_del(mask_t* mask)
     mask->ptr = NULL;
     mask->size.x = 0;
     mask->size.y = 0;
-}
-
-pim_inline bool VEC_CALL mask_fits(mask_t a, mask_t b, int2 b_tr)
-{
-    const int2 lo = b_tr;
-    const int2 hi = i2_add(b.size, b_tr);
-    if ((lo.x < 0) || (lo.y < 0))
-    {
-        return false;
-    }
-    if ((hi.x > a.size.x) || (hi.y > a.size.y))
-    {
-        return false;
-    }
-    const i32 astride = a.size.x;
-    const i32 bstride = b.size.x;
-    for (i32 ay = lo.y; ay < hi.y; ++ay)
-    {
-        i32 by = ay - lo.y;
-        for (i32 ax = lo.x; ax < hi.x; ++ax)
-        {
-            i32 bx = ax - lo.x;
-            i32 bi = bx + by * bstride;
-            i32 ai = ax + ay * astride;
-            ASSERT(bx >= 0);
-            ASSERT(bx < b.size.x);
-            ASSERT(by >= 0);
-            ASSERT(by < b.size.y);
-            if ((b.ptr[bi] & a.ptr[ai]) != 0)
-            {
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-pim_inline void VEC_CALL mask_write(mask_t a, mask_t b, int2 tr)
-{
-    for (i32 by = 0; by < b.size.y; ++by)
-    {
-        for (i32 bx = 0; bx < b.size.x; ++bx)
-        {
-            i32 bi = bx + by * b.size.x;
-            if (b.ptr[bi])
-            {
-                i32 ax = bx + tr.x;
-                i32 ay = by + tr.y;
-                i32 ai = ax + ay * a.size.x;
-                ASSERT(ax >= 0);
-                ASSERT(ay >= 0);
-                ASSERT(ax < a.size.x);
-                ASSERT(ay < a.size.y);
-                ASSERT(!a.ptr[ai]);
-                a.ptr[ai] = b.ptr[bi];
-            }
-        }
-    }
+    mask->stride = 0;
 }
 
 pim_inline int2 VEC_CALL tri_size(Tri2D tri)
@@ -241,44 +321,32 @@ pim_inline bool VEC_CALL TriTest(Tri2D tri, float2 pt)
     return sdTriangle2D(tri.a, tri.b, tri.c, pt) <= kMaskPadding;
 }
 
-pim_inline void VEC_CALL mask_tri(mask_t mask, Tri2D tri)
+// index of the lowest set bit
+pim_inline i32 VEC_CALL u64_lsb(u64 x)
 {
-    const int2 size = mask.size;
-    for (i32 y = 0; y < size.y; ++y)
-    {
-        for (i32 x = 0; x < size.x; ++x)
-        {
-            const i32 i = x + y * size.x;
-            float2 texelCenter = { x + 0.5f, y + 0.5f };
-            if (TriTest(tri, texelCenter))
-            {
-                mask.ptr[i] = 0xff;
-            }
-        }
-    }
+    return u64_log2(x & (~x + 1ull));
 }
 
-pim_inline bool VEC_CALL mask_find(mask_t atlas, mask_t item, int2* trOut, i32 prevRow)
+pim_inline void VEC_CALL mask_tri(mask_t mask, Tri2D tri)
 {
-    const int2 range = i2_sub(atlas.size, item.size);
-    i32 y = 0;
-    if (prevRow != ROW_RESET)
+    // only the texels within padding of the triangle's bounds can pass
+    const float2 tlo = f2_subvs(f2_min(f2_min(tri.a, tri.b), tri.c), kMaskPadding);
+    const float2 thi = f2_addvs(f2_max(f2_max(tri.a, tri.b), tri.c), kMaskPadding);
+    const int2 lo = i2_max(f2_i2(f2_floor(tlo)), i2_0);
+    const int2 hi = i2_min(f2_i2(f2_ceil(thi)), mask.size);
+    const i32 stride = mask.stride;
+    for (i32 y = lo.y; y < hi.y; ++y)
     {
-        y = prevRow;
-    }
-    for (; y < range.y; ++y)
-    {
-        for (i32 x = 0; x < range.x; ++x)
+        u64 *const pim_noalias row = mask.ptr + y * stride;
+        for (i32 x = lo.x; x < hi.x; ++x)
         {
-            int2 tr = { x, y };
-            if (mask_fits(atlas, item, tr))
+            float2 texelCenter = { x + 0.5f, y + 0.5f };
+            if (TriTest(tri, texelCenter))
             {
-                *trOut = tr;
-                return true;
+                row[x >> 6] |= 1ull << (x & 63);
             }
         }
     }
-    return false;
 }
 
 pim_inline float2 VEC_CALL ProjUv(float3x3 TBN, float4 pt)
@@ -338,22 +406,104 @@ pim_inline bool VEC_CALL plane_equal(
     return (dist < distThresh) && (cosTheta >= minCosTheta);
 }
 
-pim_inline i32 plane_find(
+// plane equations quantized to cells twice the match thresholds,
+// so every plane within threshold lies in the same cell or in the
+// neighbouring cell on the nearer side, along each axis.
+typedef struct planekey_s
+{
+    i32 x;
+    i32 y;
+    i32 z;
+    i32 d;
+} planekey_t;
+
+typedef struct planehash_s
+{
+    Dict cells;     // planekey_t -> first chart in the cell
+    i32* next;      // next chart in the same cell, or -1
+    float4 rcpCell; // xyz: normal cell, w: distance cell
+    float minCosTheta;
+    float distThresh;
+} planehash_t;
+
+static void planehash_new(planehash_t* hash, float distThresh, float degreeThresh)
+{
+    memset(hash, 0, sizeof(*hash));
+    Dict_New(&hash->cells, sizeof(planekey_t), sizeof(i32), EAlloc_Perm);
+    hash->minCosTheta = cosf(degreeThresh * kRadiansPerDegree);
+    hash->distThresh = distThresh;
+    // chord between unit normals degreeThresh apart
+    float chord = 2.0f * sinf(0.5f * degreeThresh * kRadiansPerDegree);
+    float normalCell = 2.0f * f1_max(chord, kMilli);
+    float distCell = 2.0f * f1_max(distThresh, kMilli);
+    hash->rcpCell = f4_v(1.0f / normalCell, 1.0f / normalCell, 1.0f / normalCell, 1.0f / distCell);
+}
+
+static void planehash_del(planehash_t* hash)
+{
+    Dict_Del(&hash->cells);
+    Mem_Free(hash->next);
+    memset(hash, 0, sizeof(*hash));
+}
+
+pim_inline planekey_t VEC_CALL planehash_key(float4 q)
+{
+    planekey_t key;
+    key.x = (i32)floorf(q.x);
+    key.y = (i32)floorf(q.y);
+    key.z = (i32)floorf(q.z);
+    key.d = (i32)floorf(q.w);
+    return key;
+}
+
+static void planehash_add(
+    planehash_t* hash,
     const Plane3D* planes,
-    i32 planeCount,
-    Plane3D plane,
-    float distThresh,
-    float degreeThresh)
+    i32 iChart)
+{
+    Perm_Grow(hash->next, iChart + 1);
+    planekey_t key = planehash_key(f4_mul(planes[iChart].value, hash->rcpCell));
+    i32 head = -1;
+    Dict_Get(&hash->cells, &key, &head);
+    hash->next[iChart] = head;
+    Dict_SetAdd(&hash->cells, &key, &iChart);
+}
+
+// first chart whose plane matches, as a linear scan of planes would find
+static i32 planehash_find(
+    const planehash_t* hash,
+    const Plane3D* planes,
+    Plane3D plane)
 {
-    const float minCosTheta = cosf(degreeThresh * kRadiansPerDegree);
-    for (i32 i = 0; i < planeCount; ++i)
+    const float4 q = f4_mul(plane.value, hash->rcpCell);
+    const planekey_t base = planehash_key(q);
+    const planekey_t side =
+    {
+        ((q.x - base.x) < 0.5f) ? -1 : 1,
+        ((q.y - base.y) < 0.5f) ? -1 : 1,
+        ((q.z - base.z) < 0.5f) ? -1 : 1,
+        ((q.w - base.d) < 0.5f) ? -1 : 1,
+    };
+    i32 chosen = -1;
+    for (i32 i = 0; i < 16; ++i)
     {
-        if (plane_equal(planes[i], plane, distThresh, minCosTheta))
+        planekey_t key = base;
+        key.x += (i & 1) ? side.x : 0;
+        key.y += (i & 2) ? side.y : 0;
+        key.z += (i & 4) ? side.z : 0;
+        key.d += (i & 8) ? side.d : 0;
+        i32 iChart = -1;
+        Dict_Get(&hash->cells, &key, &iChart);
+        for (; iChart >= 0; iChart = hash->next[iChart])
         {
-            return i;
+            if (((chosen < 0) || (iChart < chosen)) &&
+                plane_equal(planes[iChart], plane, hash->distThresh, hash->minCosTheta))
+            {
+                chosen = iChart;
+            }
         }
     }
-    return -1;
+    return chosen;
 }
 
 pim_inline void VEC_CALL chart_minmax(chart_t chart, float2* loOut, float2* hiOut)
@@ -448,7 +598,7 @@ pim_inline i32 cluster_nearest(const float2* means, i32 k, Tri2D tri)
     return chosen;
 }
 
-static void chart_split(chart_t chart, chart_t* split)
+static void chart_split(chart_t chart, chart_t* split, u32 seed)
 {
     const i32 nodeCount = chart.nodeCount;
     const chartnode_t* nodes = chart.nodes;
@@ -460,11 +610,11 @@ static void chart_split(chart_t chart, chart_t* split)
     i32* nodeLists[CHART_SPLITS] = { 0 };
     const i32 k = CHART_SPLITS;
 
-    // create k initial means
-    Prng* rng = Prng_Get();
+    // create k initial means, seeded by the chart so packing is reproducible
+    Prng rng = Prng_Seeded(seed);
     for (i32 i = 0; i < k; ++i)
     {
-        i32 j = Prng_i32(rng) % nodeCount;
+        i32 j = Prng_i32(&rng) % nodeCount;
         Tri2D tri = nodes[j].triCoord;
         means[i] = tri_center(tri);
         triLists[i] = Temp_Alloc(sizeof(Tri2D) * nodeCount);
@@ -517,6 +667,124 @@ static void chart_split(chart_t chart, chart_t* split)
     }
 }
 
+pim_inline bool VEC_CALL chart_needs_split(chart_t chart, float maxWidth)
+{
+    if (chart.nodeCount > 1)
+    {
+        float width = chart_width(chart);
+        float density = chart_density(chart);
+        return (width >= maxWidth) || (density < 0.1f);
+    }
+    return false;
+}
+
+typedef struct chartsplit_s
+{
+    Task task;
+    const chart_t* charts;
+    const i32* pim_noalias todo;
+    // [todoCount * CHART_SPLITS], all empty when the chart is kept
+    chart_t* pim_noalias splits;
+    float maxWidth;
+} chartsplit_t;
+
+static void ChartSplitFn(void* pbase, i32 begin, i32 end)
+{
+    chartsplit_t* task = pbase;
+    const chart_t* charts = task->charts;
+    const i32* pim_noalias todo = task->todo;
+    chart_t* pim_noalias splits = task->splits;
+    const float maxWidth = task->maxWidth;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        const chart_t chart = charts[todo[i]];
+        if (chart_needs_split(chart, maxWidth))
+        {
+            chart_split(chart, splits + i * CHART_SPLITS, (u32)todo[i]);
+        }
+    }
+}
+
+// splits big or sparse charts until none remain, in rounds of parallel splits.
+// each round only rechecks the charts the previous round produced.
+ProfileMark(pm_chart_splits, chart_splits)
+static void chart_splits(chart_t** pCharts, i32* pCount, float maxWidth)
+{
+    ProfileBegin(pm_chart_splits);
+
+    chart_t* charts = *pCharts;
+    i32 chartCount = *pCount;
+    i32 todoCount = chartCount;
+    i32* todo = Perm_Alloc(sizeof(todo[0]) * i1_max(1, todoCount));
+    for (i32 i = 0; i < todoCount; ++i)
+    {
+        todo[i] = i;
+    }
+
+    while (todoCount > 0)
+    {
+        chartsplit_t* task = Temp_Calloc(sizeof(*task));
+        task->charts = charts;
+        task->todo = todo;
+        task->splits = Perm_Calloc(sizeof(task->splits[0]) * todoCount * CHART_SPLITS);
+        task->maxWidth = maxWidth;
+        Task_Run(&task->task, ChartSplitFn, todoCount);
+
+        i32 nextCount = 0;
+        i32* next = NULL;
+        for (i32 i = 0; i < todoCount; ++i)
+        {
+            chart_t* pim_noalias split = task->splits + i * CHART_SPLITS;
+            i32 nonEmpty = 0;
+            for (i32 j = 0; j < CHART_SPLITS; ++j)
+            {
+                nonEmpty += (split[j].nodeCount > 0) ? 1 : 0;
+            }
+            if (nonEmpty < 2)
+            {
+                // kept, or a degenerate split that would recur forever
+                for (i32 j = 0; j < CHART_SPLITS; ++j)
+                {
+                    chart_del(&split[j]);
+                }
+                continue;
+            }
+
+            const i32 iChart = todo[i];
+            chart_del(&charts[iChart]);
+            i32 slot = iChart;
+            for (i32 j = 0; j < CHART_SPLITS; ++j)
+            {
+                if (split[j].nodeCount > 0)
+                {
+                    if (slot < 0)
+                    {
+                        slot = chartCount++;
+                        Perm_Reserve(charts, chartCount);
+                    }
+                    charts[slot] = split[j];
+                    ++nextCount;
+                    Perm_Reserve(next, nextCount);
+                    next[nextCount - 1] = slot;
+                    slot = -1;
+                }
+            }
+        }
+
+        Mem_Free(task->splits);
+        Mem_Free(todo);
+        todo = next;
+        todoCount = nextCount;
+    }
+    Mem_Free(todo);
+
+    *pCharts = charts;
+    *pCount = chartCount;
+
+    ProfileEnd(pm_chart_splits);
+}
+
 typedef struct chartmask_s
 {
     Task task;
@@ -576,16 +844,14 @@ static chart_t* chart_group(
     chart_t* pim_noalias charts = NULL;
     Plane3D* pim_noalias planes = NULL;
 
+    planehash_t hash;
+    planehash_new(&hash, distThresh, degreeThresh);
+
     // assign nodes to charts by triangle plane
     for (i32 iNode = 0; iNode < nodeCount; ++iNode)
     {
         chartnode_t node = nodes[iNode];
-        i32 iChart = plane_find(
-            planes,
-            chartCount,
-            node.plane,
-            distThresh,
-            degreeThresh);
+        i32 iChart = planehash_find(&hash, planes, node.plane);
         if (iChart == -1)
         {
             iChart = chartCount;
@@ -593,6 +859,7 @@ static chart_t* chart_group(
             Perm_Grow(charts, chartCount);
             Perm_Grow(planes, chartCount);
             planes[iChart] = node.plane;
+            planehash_add(&hash, planes, iChart);
         }
 
         chart_t chart = charts[iChart];
@@ -602,38 +869,11 @@ static chart_t* chart_group(
         charts[iChart] = chart;
     }
 
+    planehash_del(&hash);
     Mem_Free(planes);
     planes = NULL;
 
-    // split big charts
-    for (i32 iChart = 0; iChart < chartCount; ++iChart)
-    {
-        chart_t chart = charts[iChart];
-        if (chart.nodeCount > 1)
-        {
-            float width = chart_width(chart);
-            float density = chart_density(chart);
-            if ((width >= maxWidth) || (density < 0.1f))
-            {
-                chart_t split[CHART_SPLITS] = { 0 };
-                chart_split(chart, split);
-                for (i32 j = 0; j < NELEM(split); ++j)
-                {
-                    if (split[j].nodeCount > 0)
-                    {
-                        ++chartCount;
-                        Perm_Reserve(charts, chartCount);
-                        charts[chartCount - 1] = split[j];
-                    }
-                }
-                chart_del(&chart);
-
-                charts[iChart] = charts[chartCount - 1];
-                --chartCount;
-                --iChart;
-            }
-        }
-    }
+    chart_splits(&charts, &chartCount, maxWidth);
 
     // move chart to origin and create mask
     chartmask_t* task = Temp_Calloc(sizeof(*task));
@@ -645,25 +885,11 @@ static chart_t* chart_group(
     return charts;
 }
 
-pim_inline i32 chart_cmp(const void* plhs, const void* prhs, void* usr)
-{
-    const chart_t* lhs = plhs;
-    const chart_t* rhs = prhs;
-    float a = lhs->area;
-    float b = rhs->area;
-    return ((a > b) ? 1 : 0) - ((b > a) ? 1 : 0);
-}
-
-pim_inline void chart_sort(chart_t* charts, i32 chartCount)
-{
-    QuickSort(charts, chartCount, sizeof(charts[0]), chart_cmp, NULL);
-}
-
 pim_inline atlas_t atlas_new(i32 size)
 {
     atlas_t atlas = { 0 };
-    Mutex_New(&atlas.mtx);
-    atlas.mask = mask_new(i2_s(size));
+    atlas.heights = Perm_Calloc(sizeof(atlas.heights[0]) * size);
+    atlas.size = size;
     return atlas;
 }
 
@@ -671,206 +897,333 @@ pim_inline void atlas_del(atlas_t* atlas)
 {
     if (atlas)
     {
-        Mutex_Del(&atlas->mtx);
-        mask_del(&atlas->mask);
+        Mem_Free(atlas->heights);
         memset(atlas, 0, sizeof(*atlas));
     }
 }
 
-static bool atlas_search(
-    atlas_t* pim_noalias atlases,
-    i32 atlasCount,
-    chart_t* pim_noalias chart,
-    i32* pim_noalias prevAtlas,
-    i32* pim_noalias prevRow)
+// per column extents of a chart mask, [lo, hi) rows, lo > hi when empty.
+// each column is visited once from the top and once from the bottom,
+// empty words are skipped whole. seen is scratch of mask.stride words.
+// returns the highest hi, and the lowest lo in bottomOut.
+static i32 mask_profile(
+    mask_t mask,
+    i32* pim_noalias lo,
+    i32* pim_noalias hi,
+    u64* pim_noalias seen,
+    i32* pim_noalias bottomOut)
 {
-    int2 tr;
-    for (i32 i = *prevAtlas; i < atlasCount; ++i)
+    const int2 size = mask.size;
+    const i32 stride = mask.stride;
+    u64 const *const pim_noalias ptr = mask.ptr;
+    for (i32 x = 0; x < size.x; ++x)
+    {
+        lo[x] = size.y;
+        hi[x] = 0;
+    }
+
+    i32 bottom = size.y;
+    memset(seen, 0, sizeof(seen[0]) * stride);
+    for (i32 y = 0; y < size.y; ++y)
     {
-        atlas_t* pim_noalias atlas = &atlases[i];
-    retry:
-        if (mask_find(atlas->mask, chart->mask, &tr, *prevRow))
+        u64 const *const pim_noalias row = ptr + y * stride;
+        for (i32 w = 0; w < stride; ++w)
         {
-            *prevAtlas = i;
-            *prevRow = tr.y;
-            Mutex_Lock(&atlas->mtx);
-            bool fits = mask_fits(atlas->mask, chart->mask, tr);
-            if (fits)
+            u64 fresh = row[w] & ~seen[w];
+            seen[w] |= fresh;
+            if (fresh)
             {
-                mask_write(atlas->mask, chart->mask, tr);
-                chart->translation = tr;
-                chart->atlasIndex = i;
-                atlas->chartCount++;
+                bottom = i1_min(bottom, y);
             }
-            Mutex_Unlock(&atlas->mtx);
-            if (fits)
+            while (fresh)
             {
-                return true;
-            }
-            else
-            {
-                goto retry;
+                lo[(w << 6) + u64_lsb(fresh)] = y;
+                fresh &= fresh - 1ull;
             }
         }
-        else
+    }
+
+    i32 top = 0;
+    memset(seen, 0, sizeof(seen[0]) * stride);
+    for (i32 y = size.y - 1; y >= 0; --y)
+    {
+        u64 const *const pim_noalias row = ptr + y * stride;
+        for (i32 w = 0; w < stride; ++w)
         {
-            *prevRow = ROW_RESET;
+            u64 fresh = row[w] & ~seen[w];
+            seen[w] |= fresh;
+            if (fresh)
+            {
+                top = i1_max(top, y + 1);
+            }
+            while (fresh)
+            {
+                hi[(w << 6) + u64_lsb(fresh)] = y + 1;
+                fresh &= fresh - 1ull;
+            }
         }
     }
-    return false;
+
+    *bottomOut = bottom;
+    return top;
 }
 
-static chartnode_t* chartnodes_create(float texelsPerUnit, i32* countOut)
+// lowest position where the profile rests on the skyline, leftmost on ties
+static bool atlas_find(
+    const atlas_t* pim_noalias atlas,
+    const i32* pim_noalias lo,
+    const i32* pim_noalias hi,
+    i32 width,
+    i32 top,
+    int2* pim_noalias trOut)
 {
-    const Entities* drawables = Entities_Get();
-    const i32 numDrawables = drawables->count;
-    const Material* pim_noalias materials = drawables->materials;
-    const MeshId* pim_noalias meshids = drawables->meshes;
-    const float4x4* pim_noalias matrices = drawables->matrices;
-
-    chartnode_t* nodes = NULL;
-    i32 nodeCount = 0;
-
-    for (i32 d = 0; d < numDrawables; ++d)
+    const i32 size = atlas->size;
+    i32 const *const pim_noalias heights = atlas->heights;
+    i32 bestY = size - top + 1;
+    i32 bestX = -1;
+    for (i32 x = 0; (x + width) <= size; ++x)
     {
-        if (materials[d].flags & kUnmappedMaterials)
+        i32 y = 0;
+        for (i32 c = 0; c < width; ++c)
         {
-            continue;
+            if (lo[c] < hi[c])
+            {
+                y = i1_max(y, heights[x + c] - lo[c]);
+                if (y >= bestY)
+                {
+                    break;
+                }
+            }
         }
-
-        Mesh const *const mesh = Mesh_Get(meshids[d]);
-        if (!mesh)
+        if (y < bestY)
         {
-            continue;
+            bestY = y;
+            bestX = x;
+            if (y == 0)
+            {
+                break;
+            }
         }
+    }
+    trOut->x = bestX;
+    trOut->y = bestY;
+    return bestX >= 0;
+}
 
-        const float4x4 M = matrices[d];
-        const i32 vertCount = mesh->length;
-        const float4* pim_noalias positions = mesh->positions;
-
-        i32 nodeBack = nodeCount;
-        nodeCount += vertCount / 3;
-        Perm_Reserve(nodes, nodeCount);
-
-        for (i32 v = 0; (v + 3) <= vertCount; v += 3)
+static void atlas_write(
+    atlas_t* pim_noalias atlas,
+    const i32* pim_noalias lo,
+    const i32* pim_noalias hi,
+    i32 width,
+    int2 tr)
+{
+    i32 *const pim_noalias heights = atlas->heights;
+    for (i32 c = 0; c < width; ++c)
+    {
+        if (lo[c] < hi[c])
         {
-            float4 A = f4x4_mul_pt(M, positions[v + 0]);
-            float4 B = f4x4_mul_pt(M, positions[v + 1]);
-            float4 C = f4x4_mul_pt(M, positions[v + 2]);
-
-            nodes[nodeBack++] = chartnode_new(A, B, C, texelsPerUnit, d, v);
+            ASSERT((tr.y + lo[c]) >= heights[tr.x + c]);
+            heights[tr.x + c] = tr.y + hi[c];
         }
     }
 
-    *countOut = nodeCount;
-    return nodes;
+    i32 floor = atlas->size;
+    for (i32 x = 0; x < atlas->size; ++x)
+    {
+        floor = i1_min(floor, heights[x]);
+    }
+    atlas->floor = floor;
 }
 
-typedef struct atlastask_s
+typedef struct chartnodetask_s
 {
     Task task;
-    i32 nodeHead;
-    i32 chartCount;
-    i32 atlasCount;
-    chart_t* charts;
-    atlas_t* atlases;
-} atlastask_t;
+    // first node of each drawable, [drawableCount + 1]
+    const i32* pim_noalias offsets;
+    i32 drawableCount;
+    chartnode_t* pim_noalias nodes;
+    float texelsPerUnit;
+} chartnodetask_t;
 
-static void AtlasFn(void* pbase, i32 begin, i32 end)
+static void ChartNodeFn(void* pbase, i32 begin, i32 end)
 {
-    atlastask_t* task = (atlastask_t*)pbase;
-    chart_t* pim_noalias charts = task->charts;
-    const i32 atlasCount = task->atlasCount;
-    const i32 chartCount = task->chartCount;
-    i32* pim_noalias pHead = &task->nodeHead;
-    atlas_t* pim_noalias atlases = task->atlases;
+    chartnodetask_t* task = pbase;
+    const i32* pim_noalias offsets = task->offsets;
+    chartnode_t* pim_noalias nodes = task->nodes;
+    const float texelsPerUnit = task->texelsPerUnit;
 
-    i32 prevAtlas = 0;
-    i32 prevRow = ROW_RESET;
-    float prevArea = 1 << 23;
-    for (i32 i = begin; i < end; ++i)
+    const Entities* drawables = Entities_Get();
+    const MeshId* pim_noalias meshids = drawables->meshes;
+    const float4x4* pim_noalias matrices = drawables->matrices;
+
+    // drawable owning the first node: last d with offsets[d] <= begin
+    i32 lo = 0;
+    i32 hi = task->drawableCount;
+    while ((hi - lo) > 1)
     {
-        i32 iChart = inc_i32(pHead, MO_Relaxed);
-        if (iChart >= chartCount)
+        i32 mid = (lo + hi) >> 1;
+        if (offsets[mid] <= begin)
         {
-            break;
+            lo = mid;
         }
-        chart_t chart = charts[iChart];
-        chart.atlasIndex = -1;
-
-        if (chart.area < (prevArea * 0.9f))
+        else
         {
-            prevArea = chart.area;
-            prevAtlas = 0;
-            prevRow = ROW_RESET;
+            hi = mid;
         }
+    }
 
-        while (!atlas_search(
-            atlases,
-            atlasCount,
-            &chart,
-            &prevAtlas,
-            &prevRow))
+    i32 d = lo;
+    for (i32 iNode = begin; iNode < end; ++iNode)
+    {
+        while (offsets[d + 1] <= iNode)
         {
-            prevArea = chart.area;
-            prevAtlas = 0;
-            prevRow = ROW_RESET;
+            ++d;
         }
-
-        mask_del(&chart.mask);
-        charts[iChart] = chart;
+        Mesh const *const mesh = Mesh_Get(meshids[d]);
+        ASSERT(mesh);
+        const float4x4 M = matrices[d];
+        const float4* pim_noalias positions = mesh->positions;
+        const i32 v = (iNode - offsets[d]) * 3;
+        float4 A = f4x4_mul_pt(M, positions[v + 0]);
+        float4 B = f4x4_mul_pt(M, positions[v + 1]);
+        float4 C = f4x4_mul_pt(M, positions[v + 2]);
+        nodes[iNode] = chartnode_new(A, B, C, texelsPerUnit, d, v);
     }
 }
 
-pim_inline i32 atlas_estimate(i32 atlasSize, const chart_t* charts, i32 chartCount)
+// one node per lightmapped triangle, written in parallel at each drawable's
+// prefix sum of triangle counts.
+ProfileMark(pm_chartnodes_create, chartnodes_create)
+static chartnode_t* chartnodes_create(float texelsPerUnit, i32* countOut)
 {
-    i32 areaRequired = 0;
-    for (i32 i = 0; i < chartCount; ++i)
+    ProfileBegin(pm_chartnodes_create);
+
+    const Entities* drawables = Entities_Get();
+    const i32 numDrawables = drawables->count;
+    const Material* pim_noalias materials = drawables->materials;
+    const MeshId* pim_noalias meshids = drawables->meshes;
+
+    i32* pim_noalias offsets = Perm_Alloc(sizeof(offsets[0]) * (numDrawables + 1));
+    i32 nodeCount = 0;
+    for (i32 d = 0; d < numDrawables; ++d)
     {
-        i32 area = (i32)ceilf(chart_area(charts[i]));
-        areaRequired += area;
+        offsets[d] = nodeCount;
+        if (materials[d].flags & kUnmappedMaterials)
+        {
+            continue;
+        }
+        Mesh const *const mesh = Mesh_Get(meshids[d]);
+        if (mesh)
+        {
+            nodeCount += mesh->length / 3;
+        }
     }
-    ASSERT(areaRequired >= 0);
+    offsets[numDrawables] = nodeCount;
 
-    const i32 areaPerAtlas = atlasSize * atlasSize;
-    i32 atlasCount = 0;
-    while ((atlasCount * areaPerAtlas) < areaRequired)
+    chartnode_t* nodes = NULL;
+    if (nodeCount > 0)
     {
-        ++atlasCount;
+        nodes = Perm_Alloc(sizeof(nodes[0]) * nodeCount);
+        chartnodetask_t* task = Temp_Calloc(sizeof(*task));
+        task->offsets = offsets;
+        task->drawableCount = numDrawables;
+        task->nodes = nodes;
+        task->texelsPerUnit = texelsPerUnit;
+        Task_Run(&task->task, ChartNodeFn, nodeCount);
     }
+    Mem_Free(offsets);
 
-    return i1_max(1, atlasCount);
+    *countOut = nodeCount;
+    ProfileEnd(pm_chartnodes_create);
+    return nodes;
 }
 
-static i32 atlases_create(i32 atlasSize, chart_t* charts, i32 chartCount)
+pim_inline i32 chart_height_cmp(const void* plhs, const void* prhs, void* usr)
 {
-    i32 atlasCount = atlas_estimate(atlasSize, charts, chartCount);
-    atlas_t* atlases = Perm_Calloc(sizeof(atlases[0]) * atlasCount);
-    for (i32 i = 0; i < atlasCount; ++i)
+    const chart_t* lhs = plhs;
+    const chart_t* rhs = prhs;
+    i32 a = lhs->mask.size.y;
+    i32 b = rhs->mask.size.y;
+    if (a == b)
     {
-        atlases[i] = atlas_new(atlasSize);
+        a = lhs->mask.size.x;
+        b = rhs->mask.size.x;
     }
+    return ((a < b) ? 1 : 0) - ((b < a) ? 1 : 0);
+}
 
-    atlastask_t* task = Temp_Calloc(sizeof(*task));
-    task->atlasCount = atlasCount;
-    task->atlases = atlases;
-    task->charts = charts;
-    task->chartCount = chartCount;
-    task->nodeHead = 0;
-    Task_Run(&task->task, AtlasFn, chartCount);
+// skyline packing, tallest charts first.
+// each chart goes to the first atlas it fits in, new atlases are opened on demand.
+ProfileMark(pm_atlases_create, atlases_create)
+static i32 atlases_create(i32 atlasSize, chart_t* charts, i32 chartCount)
+{
+    ProfileBegin(pm_atlases_create);
 
-    i32 usedAtlases = 0;
-    for (i32 i = 0; i < atlasCount; ++i)
+    QuickSort(charts, chartCount, sizeof(charts[0]), chart_height_cmp, NULL);
+
+    i32 atlasCount = 0;
+    atlas_t* atlases = NULL;
+    i32* lo = Perm_Alloc(sizeof(lo[0]) * atlasSize);
+    i32* hi = Perm_Alloc(sizeof(hi[0]) * atlasSize);
+    u64* seen = Perm_Alloc(sizeof(seen[0]) * ((atlasSize + 63) >> 6));
+
+    for (i32 iChart = 0; iChart < chartCount; ++iChart)
     {
-        if (atlases[i].chartCount > 0)
+        chart_t chart = charts[iChart];
+        chart.atlasIndex = -1;
+        const i32 width = chart.mask.size.x;
+        if ((width > atlasSize) || (chart.mask.size.y > atlasSize))
+        {
+            Con_Logf(LogSev_Error, "lm", "Chart of %dx%d texels does not fit in a %d texel atlas",
+                chart.mask.size.x, chart.mask.size.y, atlasSize);
+            mask_del(&chart.mask);
+            charts[iChart] = chart;
+            continue;
+        }
+
+        i32 bottom = 0;
+        const i32 top = mask_profile(chart.mask, lo, hi, seen, &bottom);
+        int2 tr = { 0 };
+        for (i32 i = 0; i < atlasCount; ++i)
         {
-            ++usedAtlases;
+            // every column rests at or above the floor
+            if ((atlases[i].floor - bottom + top) > atlasSize)
+            {
+                continue;
+            }
+            if (atlas_find(&atlases[i], lo, hi, width, top, &tr))
+            {
+                chart.atlasIndex = i;
+                break;
+            }
         }
+        if (chart.atlasIndex < 0)
+        {
+            ++atlasCount;
+            Perm_Grow(atlases, atlasCount);
+            atlases[atlasCount - 1] = atlas_new(atlasSize);
+            chart.atlasIndex = atlasCount - 1;
+            bool found = atlas_find(&atlases[atlasCount - 1], lo, hi, width, top, &tr);
+            ASSERT(found);
+        }
+
+        atlas_write(&atlases[chart.atlasIndex], lo, hi, width, tr);
+        chart.translation = tr;
+        mask_del(&chart.mask);
+        charts[iChart] = chart;
+    }
+
+    for (i32 i = 0; i < atlasCount; ++i)
+    {
         atlas_del(atlases + i);
     }
     Mem_Free(atlases);
+    Mem_Free(lo);
+    Mem_Free(hi);
+    Mem_Free(seen);
 
-    return usedAtlases;
+    ProfileEnd(pm_atlases_create);
+    return atlasCount;
 }
 
 static void chartnodes_assign(
@@ -886,10 +1239,14 @@ static void chartnodes_assign(
     for (i32 iChart = 0; iChart < chartCount; ++iChart)
     {
         const chart_t chart = charts[iChart];
+        if (chart.atlasIndex < 0)
+        {
+            continue;
+        }
         chartnode_t *const pim_noalias nodes = chart.nodes;
         const i32 nodeCount = chart.nodeCount;
         Lightmap *const pim_noalias lightmap = &lightmaps[chart.atlasIndex];
-        const i32 lmTexId = lightmap->slot.index;
+        const i32 lmTexId = LmTexId(lightmaps, chart.atlasIndex);
         const float scale = 1.0f / lightmap->size;
         const float2 tr = i2_f2(chart.translation);
 
@@ -965,7 +1322,7 @@ static void EmbedTaskFn(void* pbase, i32 begin, i32 end)
         const i32 y = iTexel / lmSize;
         const float2 pxCenter = { x + 0.5f, y + 0.5f };
         Lightmap *const lightmap = &lightmaps[iLightmap];
-        const i32 lmTxId = lightmap->slot.index;
+        const i32 lmTxId = LmTexId(lightmaps, iLightmap);
 
         float4 lmPos = f4_0;
         float4 lmNor = f4_0;
@@ -1071,14 +1428,13 @@ LmPack LmPack_Pack(
     chart_t* charts = chart_group(
         nodes, nodeCount, &chartCount, distThresh, degThresh, maxWidth);
 
-    chart_sort(charts, chartCount);
-
     i32 atlasCount = atlases_create(atlasSize, charts, chartCount);
 
     LmPack pack = { 0 };
     pack.lmCount = atlasCount;
     pack.lmSize = atlasSize;
     pack.lightmaps = Perm_Calloc(sizeof(pack.lightmaps[0]) * atlasCount);
+    pack.dirty = Perm_Calloc(sizeof(pack.dirty[0]) * atlasCount);
     SG_Generate(pack.axii, kGiDirections, SGDist_Hemi);
     pack.texelsPerMeter = texelsPerUnit;
 
@@ -1105,159 +1461,670 @@ void LmPack_Del(LmPack* pack)
 {
     if (pack)
     {
+        // lands the last checkpoint before its path can be reopened
+        LmPack_AwaitCheckpoint();
         for (i32 i = 0; i < pack->lmCount; ++i)
         {
             Lightmap_Del(pack->lightmaps + i);
         }
         Mem_Free(pack->lightmaps);
+        Mem_Free(pack->schedule);
+        Mem_Free(pack->dirty);
         memset(pack, 0, sizeof(*pack));
     }
 }
 
+// relative standard error of the texel's mean luminance.
+// means below errorFloor are treated as errorFloor, so dark texels are not
+// resampled forever over noise that is invisible in absolute terms.
+// sampleCount starts at 1 for texels covered by a chart.
+pim_inline float VEC_CALL TexelError(float sampleCount, float2 moments, float errorFloor)
+{
+    const float n = sampleCount - 1.0f;
+    if (n < kLmMinSamples)
+    {
+        return 1 << 20;
+    }
+    if (n >= kLmMaxSamples)
+    {
+        return 0.0f;
+    }
+    const float variance = f1_max(0.0f, moments.y - moments.x * moments.x);
+    return sqrtf(variance / n) / f1_max(moments.x, f1_max(errorFloor, kEpsilon));
+}
+
 typedef struct bake_s
 {
     Task task;
     PtScene* scene;
-    float timeSlice;
+    const i32* pim_noalias schedule;
     i32 spp;
 } bake_t;
 
+// fit state of one texel while its samples are in flight
+typedef struct BakeTexel_s
+{
+    float4 probes[kGiDirections];
+    float4 axii[kGiDirections];
+    float3x3 TBN;
+    float4 P;
+    float2 moments;
+    float sampleCount;
+    i32 iLightmap;
+    i32 iTexel;
+} BakeTexel;
+
+pim_inline void VEC_CALL BakeTexel_Load(
+    BakeTexel* pim_noalias texel,
+    const LmPack* pack,
+    i32 iGlobal)
+{
+    const i32 lmLen = pack->lmSize * pack->lmSize;
+    const i32 iLightmap = iGlobal / lmLen;
+    const i32 iTexel = iGlobal % lmLen;
+    const Lightmap lightmap = pack->lightmaps[iLightmap];
+
+    texel->iLightmap = iLightmap;
+    texel->iTexel = iTexel;
+    texel->sampleCount = lightmap.sampleCounts[iTexel];
+    ASSERT(texel->sampleCount > 0.0f);
+    texel->moments = lightmap.moments[iTexel];
+
+    const float4 N = f4_normalize3(
+        f3_f4(lightmap.normal[iTexel], 0.0f));
+    texel->P = f4_add(
+        f3_f4(lightmap.position[iTexel], 1.0f),
+        f4_mulvs(N, kMilli));
+    const float3x3 TBN = NormalToTBN(N);
+    texel->TBN = TBN;
+
+    for (i32 i = 0; i < kGiDirections; ++i)
+    {
+        texel->probes[i] = lightmap.probes[i][iTexel];
+        float4 ax = kGiAxii[i];
+        float sharpness = ax.w;
+        ax = TbnToWorld(TBN, ax);
+        ax.w = sharpness;
+        texel->axii[i] = ax;
+    }
+}
+
+pim_inline void VEC_CALL BakeTexel_Store(
+    const BakeTexel* pim_noalias texel,
+    const LmPack* pack)
+{
+    const Lightmap lightmap = pack->lightmaps[texel->iLightmap];
+    const i32 iTexel = texel->iTexel;
+    for (i32 i = 0; i < kGiDirections; ++i)
+    {
+        lightmap.probes[i][iTexel] = texel->probes[i];
+    }
+    lightmap.sampleCounts[iTexel] = texel->sampleCount;
+    lightmap.moments[iTexel] = texel->moments;
+}
+
+// fits a run of consecutive samples of one texel
+pim_inline void VEC_CALL BakeTexel_Accumulate(
+    BakeTexel* pim_noalias texel,
+    const float4* pim_noalias dirs,
+    const PtResult* pim_noalias results,
+    i32 count)
+{
+    float4 colors[kPtPacket];
+    float sampleCount = texel->sampleCount;
+    float2 moments = texel->moments;
+    for (i32 i = 0; i < count; ++i)
+    {
+        float4 color = f3_f4(results[i].color, 0.0f);
+        colors[i] = color;
+        float lum = f4_avglum(color);
+        float weight = 1.0f / sampleCount;
+        sampleCount += 1.0f;
+        moments = f2_lerpvs(moments, f2_v(lum, lum * lum), weight);
+    }
+    SG_AccumulateN(
+        texel->sampleCount,
+        dirs,
+        colors,
+        count,
+        texel->axii,
+        texel->probes,
+        kGiDirections);
+    texel->sampleCount = sampleCount;
+    texel->moments = moments;
+}
+
+// bakes the scheduled texels kPtPacket at a time.
+// samples are laid out texel major, so each packet holds the rays of
+// neighbouring texels; the schedule slice is sorted by texel index.
 static void BakeFn(void* pbase, i32 begin, i32 end)
 {
     bake_t *const task = pbase;
     PtScene *const scene = task->scene;
-    const float timeSlice = task->timeSlice;
+    i32 const *const pim_noalias schedule = task->schedule;
     const i32 spp = task->spp;
 
     LmPack *const pack = LmPack_Get();
-    const i32 lmSize = pack->lmSize;
-    const i32 lmLen = lmSize * lmSize;
     const float metersPerTexel = 1.0f / pack->texelsPerMeter;
 
     Prng* rng = Prng_Get();
-    for (i32 iWork = begin; iWork < end; ++iWork)
+    BakeTexel texels[kPtPacket];
+    float4 ros[kPtPacket];
+    float4 rds[kPtPacket];
+    PtResult results[kPtPacket];
+    for (i32 iBlock = begin; iBlock < end; iBlock += kPtPacket)
     {
-        i32 iLightmap = iWork / lmLen;
-        i32 iTexel = iWork % lmLen;
-        Lightmap lightmap = pack->lightmaps[iLightmap];
-
-        float sampleCount = lightmap.sampleCounts[iTexel];
-        if (sampleCount == 0.0f)
+        const i32 texelCount = i1_min(kPtPacket, end - iBlock);
+        for (i32 i = 0; i < texelCount; ++i)
         {
-            continue;
+            BakeTexel_Load(&texels[i], pack, schedule[iBlock + i]);
         }
 
-        if (Prng_f32(rng) > timeSlice)
+        const i32 sampleLen = texelCount * spp;
+        for (i32 iPacket = 0; iPacket < sampleLen; iPacket += kPtPacket)
         {
-            continue;
-        }
+            const i32 count = i1_min(kPtPacket, sampleLen - iPacket);
+
+            // hemisphere solid angle divided among every sample the texel
+            // will have averaged after this pass, not only this pass's.
+            // packets share one spread, so take the sharpest of their texels.
+            float maxSamples = 1.0f;
+            for (i32 i = iPacket / spp; i <= (iPacket + count - 1) / spp; ++i)
+            {
+                maxSamples = f1_max(maxSamples, texels[i].sampleCount - 1.0f + spp);
+            }
+            const float spread = sqrtf((2.0f * kPi) / maxSamples);
 
-        const float4 N = f4_normalize3(
-            f3_f4(lightmap.normal[iTexel], 0.0f));
-        const float4 P = f4_add(
-            f3_f4(lightmap.position[iTexel], 1.0f),
-            f4_mulvs(N, kMilli));
-        const float3x3 TBN = NormalToTBN(N);
+            for (i32 i = 0; i < count; ++i)
+            {
+                const BakeTexel* texel = &texels[(iPacket + i) / spp];
+                const float3x3 TBN = texel->TBN;
+                float4 Lts = SampleUnitHemisphere(Prng_float2(rng));
+                float dt = (Prng_f32(rng) - 0.5f) * metersPerTexel;
+                float db = (Prng_f32(rng) - 0.5f) * metersPerTexel;
+                float4 ro = texel->P;
+                ro = f4_add(ro, f4_mulvs(TBN.c0, dt));
+                ro = f4_add(ro, f4_mulvs(TBN.c1, db));
+                ros[i] = ro;
+                rds[i] = TbnToWorld(TBN, Lts);
+            }
 
-        float4 probes[kGiDirections];
-        float4 axii[kGiDirections];
-        for (i32 i = 0; i < kGiDirections; ++i)
+            Pt_TracePacket(scene, ros, rds, count, spread, results);
+
+            for (i32 i = 0; i < count; )
+            {
+                const i32 iTexel = (iPacket + i) / spp;
+                i32 runEnd = i + 1;
+                while ((runEnd < count) && (((iPacket + runEnd) / spp) == iTexel))
+                {
+                    ++runEnd;
+                }
+                BakeTexel_Accumulate(&texels[iTexel], rds + i, results + i, runEnd - i);
+                i = runEnd;
+            }
+        }
+
+        for (i32 i = 0; i < texelCount; ++i)
         {
-            probes[i] = lightmap.probes[i][iTexel];
-            float4 ax = kGiAxii[i];
-            float sharpness = ax.w;
-            ax = TbnToWorld(TBN, ax);
-            ax.w = sharpness;
-            axii[i] = ax;
+            BakeTexel_Store(&texels[i], pack);
         }
+    }
+}
 
-        for (i32 i = 0; i < spp; ++i)
+typedef struct ErrorTask_s
+{
+    Task task;
+    float* pim_noalias errors;
+    float errorFloor;
+} ErrorTask;
+
+// error of every texel, or -1 for texels no chart covers
+static void ErrorFn(void* pbase, i32 begin, i32 end)
+{
+    ErrorTask *const task = pbase;
+    float *const pim_noalias errors = task->errors;
+    const float errorFloor = task->errorFloor;
+
+    LmPack const *const pack = LmPack_Get();
+    const i32 lmSize = pack->lmSize;
+    const i32 lmLen = lmSize * lmSize;
+    for (i32 i = begin; i < end; ++i)
+    {
+        const Lightmap* lightmap = &pack->lightmaps[i / lmLen];
+        const i32 iTexel = i % lmLen;
+        const float sampleCount = lightmap->sampleCounts[iTexel];
+        errors[i] = (sampleCount > 0.0f) ?
+            TexelError(sampleCount, lightmap->moments[iTexel], errorFloor) :
+            -1.0f;
+    }
+}
+
+static i32 ErrorCmp(i32 lhs, i32 rhs, void* usr)
+{
+    const float* pim_noalias errors = usr;
+    float a = errors[lhs];
+    float b = errors[rhs];
+    return ((a < b) ? 1 : 0) - ((b < a) ? 1 : 0);
+}
+
+static i32 IndexCmp(i32 lhs, i32 rhs, void* usr)
+{
+    return ((lhs > rhs) ? 1 : 0) - ((rhs > lhs) ? 1 : 0);
+}
+
+// gathers the texels above maxError into a work list, highest error first.
+ProfileMark(pm_Schedule, LmPack_Schedule)
+static void LmPack_Schedule(LmPack* pack, float maxError)
+{
+    ProfileBegin(pm_Schedule);
+
+    const i32 texelCount = TexelCount(pack->lightmaps, pack->lmCount);
+    ErrorTask *const task = Temp_Calloc(sizeof(*task));
+    task->errors = Tex_Alloc(sizeof(task->errors[0]) * texelCount);
+    task->errorFloor = ConVar_GetFloat(&cv_lm_error_floor);
+    Task_Run(task, ErrorFn, texelCount);
+
+    float const *const pim_noalias errors = task->errors;
+    i32* pim_noalias schedule = Tex_Realloc(pack->schedule, sizeof(schedule[0]) * texelCount);
+    i32 len = 0;
+    i32 mapped = 0;
+    for (i32 i = 0; i < texelCount; ++i)
+    {
+        const float error = errors[i];
+        if (error >= 0.0f)
         {
-            float4 Lts = SampleUnitHemisphere(Prng_float2(rng));
-            float4 rd = TbnToWorld(TBN, Lts);
-            float dt = (Prng_f32(rng) - 0.5f) * metersPerTexel;
-            float db = (Prng_f32(rng) - 0.5f) * metersPerTexel;
-            float4 ro = P;
-            ro = f4_add(ro, f4_mulvs(TBN.c0, dt));
-            ro = f4_add(ro, f4_mulvs(TBN.c1, db));
-            PtResult result = Pt_TraceRay(scene, ro, rd);
-            float weight = 1.0f / sampleCount;
-            sampleCount += 1.0f;
-            SG_Accumulate(
-                weight,
-                rd,
-                f3_f4(result.color, 0.0f),
-                axii,
-                probes,
-                kGiDirections);
+            ++mapped;
+            if (error > maxError)
+            {
+                schedule[len++] = i;
+            }
         }
+    }
+    QuickSort_Int(schedule, len, ErrorCmp, task->errors);
+
+    pack->schedule = schedule;
+    pack->scheduleLen = len;
+    pack->scheduleCursor = 0;
+    pack->scheduleError = maxError;
+    pack->progress = (mapped > 0) ? (1.0f - (float)len / (float)mapped) : 1.0f;
 
-        for (i32 i = 0; i < kGiDirections; ++i)
+    Mem_Free(task->errors);
+    ProfileEnd(pm_Schedule);
+}
+
+// marks the baked texels for the next checkpoint and upload
+static void LmPack_MarkTexels(LmPack* pack, const i32* texels, i32 count)
+{
+    const i32 lmSize = pack->lmSize;
+    const i32 texelCount = lmSize * lmSize;
+    const i32 tilesPerRow = Lightmap_TilesPerRow(lmSize);
+    for (i32 i = 0; i < count; ++i)
+    {
+        const i32 iLightmap = texels[i] / texelCount;
+        const i32 iTexel = texels[i] - iLightmap * texelCount;
+        const i32 tx = (iTexel % lmSize) / kLmUploadTile;
+        const i32 ty = (iTexel / lmSize) / kLmUploadTile;
+        const i32 iTile = ty * tilesPerRow + tx;
+        pack->dirty[iLightmap] = 1;
+        pack->lightmaps[iLightmap].uploadTiles[iTile >> 6] |= 1ull << (iTile & 63);
+    }
+}
+
+i32 LmPack_NextSlice(LmPack* pack, float timeSlice, float maxError, i32** sliceOut)
+{
+    ASSERT(pack);
+    ASSERT(sliceOut);
+    *sliceOut = NULL;
+    if (pack->lmCount <= 0)
+    {
+        pack->progress = 0.0f;
+        return 0;
+    }
+
+    if (pack->scheduleCursor >= pack->scheduleLen)
+    {
+        // a converged pack stays converged until the target changes
+        const bool converged =
+            (pack->schedule != NULL) &&
+            (pack->scheduleLen == 0) &&
+            (pack->scheduleError == maxError);
+        if (!converged)
         {
-            lightmap.probes[i][iTexel] = probes[i];
+            LmPack_Schedule(pack, maxError);
         }
-        lightmap.sampleCounts[iTexel] = sampleCount;
+    }
+
+    const i32 remaining = pack->scheduleLen - pack->scheduleCursor;
+    const i32 workLen = i1_min(remaining, (i32)ceilf(pack->scheduleLen * f1_sat(timeSlice)));
+    if (workLen > 0)
+    {
+        // bake the noisiest texels in memory order, for coherent packets
+        i32* slice = pack->schedule + pack->scheduleCursor;
+        QuickSort_Int(slice, workLen, IndexCmp, NULL);
+        pack->scheduleCursor += workLen;
+        *sliceOut = slice;
+    }
+    return i1_max(0, workLen);
+}
+
+void LmPack_BakeTexels(PtScene* scene, const i32* texels, i32 count, i32 spp)
+{
+    ASSERT(scene);
+    if (count > 0)
+    {
+        bake_t *const task = Temp_Calloc(sizeof(*task));
+        task->scene = scene;
+        task->schedule = texels;
+        task->spp = i1_max(1, spp);
+        Task_Run(task, BakeFn, count);
+        LmPack_MarkTexels(LmPack_Get(), texels, count);
     }
 }
 
 ProfileMark(pm_Bake, LmPack_Bake)
-void LmPack_Bake(PtScene* scene, float timeSlice, i32 spp)
+float LmPack_Bake(PtScene* scene, float timeSlice, i32 spp, float maxError)
 {
     ProfileBegin(pm_Bake);
     ASSERT(scene);
 
     PtScene_Update(scene);
 
-    LmPack const *const pack = LmPack_Get();
-    i32 texelCount = TexelCount(pack->lightmaps, pack->lmCount);
-    if (texelCount > 0)
+    LmPack *const pack = LmPack_Get();
+    i32* slice = NULL;
+    const i32 workLen = LmPack_NextSlice(pack, timeSlice, maxError, &slice);
+    LmPack_BakeTexels(scene, slice, workLen, spp);
+    ProfileCounter("lm bake progress", pack->progress);
+
+    ProfileEnd(pm_Bake);
+    return pack->progress;
+}
+
+typedef struct TexelTask_s
+{
+    Task task;
+    const i32* pim_noalias texels;
+    LmTexelState* pim_noalias states;
+} TexelTask;
+
+static void TakeFn(void* pbase, i32 begin, i32 end)
+{
+    TexelTask* task = pbase;
+    const i32* pim_noalias texels = task->texels;
+    LmTexelState* pim_noalias states = task->states;
+    const LmPack* pack = LmPack_Get();
+    const i32 lmLen = pack->lmSize * pack->lmSize;
+    for (i32 i = begin; i < end; ++i)
     {
-        bake_t *const task = Perm_Calloc(sizeof(*task));
-        task->scene = scene;
-        task->timeSlice = timeSlice;
-        task->spp = i1_max(1, spp);
-        Task_Run(task, BakeFn, texelCount);
+        const Lightmap lm = pack->lightmaps[texels[i] / lmLen];
+        const i32 iTexel = texels[i] % lmLen;
+        LmTexelState state = { 0 };
+        const float sampleCount = lm.sampleCounts[iTexel];
+        if (sampleCount > 0.0f)
+        {
+            for (i32 j = 0; j < kGiDirections; ++j)
+            {
+                state.probes[j] = lm.probes[j][iTexel];
+                lm.probes[j][iTexel] = f4_0;
+            }
+            state.moments = lm.moments[iTexel];
+            state.samples = sampleCount - 1.0f;
+            lm.moments[iTexel] = f2_0;
+            lm.sampleCounts[iTexel] = 1.0f;
+        }
+        states[i] = state;
     }
+}
 
-    ProfileEnd(pm_Bake);
+static void MergeFn(void* pbase, i32 begin, i32 end)
+{
+    TexelTask* task = pbase;
+    const i32* pim_noalias texels = task->texels;
+    const LmTexelState* pim_noalias states = task->states;
+    const LmPack* pack = LmPack_Get();
+    const i32 lmLen = pack->lmSize * pack->lmSize;
+    for (i32 i = begin; i < end; ++i)
+    {
+        const Lightmap lm = pack->lightmaps[texels[i] / lmLen];
+        const i32 iTexel = texels[i] % lmLen;
+        const LmTexelState state = states[i];
+        const float sampleCount = lm.sampleCounts[iTexel];
+        if ((sampleCount > 0.0f) && (state.samples > 0.0f))
+        {
+            // both fits are running means, weighted by their sample counts
+            const float n = sampleCount - 1.0f;
+            const float t = state.samples / (n + state.samples);
+            for (i32 j = 0; j < kGiDirections; ++j)
+            {
+                lm.probes[j][iTexel] = f4_lerpvs(lm.probes[j][iTexel], state.probes[j], t);
+            }
+            lm.moments[iTexel] = f2_lerpvs(lm.moments[iTexel], state.moments, t);
+            lm.sampleCounts[iTexel] = sampleCount + state.samples;
+        }
+    }
 }
 
-bool LmPack_Save(Crate* crate, const LmPack* pack)
+void LmPack_TakeTexels(LmPack* pack, const i32* texels, i32 count, LmTexelState* dst)
 {
-    bool wrote = false;
-    ASSERT(pack);
+    ASSERT(pack == LmPack_Get());
+    if (count > 0)
+    {
+        TexelTask* task = Temp_Calloc(sizeof(*task));
+        task->texels = texels;
+        task->states = dst;
+        Task_Run(task, TakeFn, count);
+    }
+}
 
-    const i32 lmcount = pack->lmCount;
-    const i32 lmsize = pack->lmSize;
-    const i32 texelcount = lmsize * lmsize;
-    const Lightmap lmNull = { 0 };
-    const i32 probesBytes = sizeof(lmNull.probes[0][0]) * texelcount * kGiDirections;
-    const i32 positionBytes = sizeof(lmNull.position[0]) * texelcount;
-    const i32 normalBytes = sizeof(lmNull.normal[0]) * texelcount;
-    const i32 sampleBytes = sizeof(lmNull.sampleCounts[0]) * texelcount;
-    const i32 texelBytes = probesBytes + sampleBytes + positionBytes + normalBytes;
+void LmPack_MergeTexels(LmPack* pack, const i32* texels, i32 count, const LmTexelState* src)
+{
+    ASSERT(pack == LmPack_Get());
+    if (count > 0)
+    {
+        TexelTask* task = Temp_Calloc(sizeof(*task));
+        task->texels = texels;
+        task->states = (LmTexelState*)src;
+        Task_Run(task, MergeFn, count);
+        LmPack_MarkTexels(pack, texels, count);
+    }
+}
 
-    // write pack header
+static DiskLmPack DiskLmPack_New(const LmPack* pack, LmFormat format)
+{
     DiskLmPack dpack = { 0 };
     dpack.version = kLmPackVersion;
     dpack.directions = kGiDirections;
-    dpack.lmCount = lmcount;
+    dpack.format = format;
+    dpack.lmCount = pack->lmCount;
     dpack.lmSize = pack->lmSize;
-    dpack.bytesPerLightmap = texelBytes;
+    dpack.bytesPerLightmap = (format == LmFormat_Compact) ?
+        Lightmap_CompactBytes(pack->lmSize) :
+        Lightmap_Bytes(pack->lmSize);
     dpack.texelsPerMeter = pack->texelsPerMeter;
+    return dpack;
+}
+
+// converts between a lightmap and its LmFormat_Compact bytes:
+// [kGiDirections][texels] E5B9G9R9_t probes, then float3 positions,
+// short2 octahedral normals, float sample counts, float2 moments,
+// and [kGiDirections][texels] half lobe weights (amplitude.w).
+typedef struct CompactTask_s
+{
+    Task task;
+    Lightmap lm;
+    u8* pim_noalias compact;
+} CompactTask;
+
+static void CompactFn(void* pbase, i32 begin, i32 end)
+{
+    CompactTask* task = pbase;
+    const Lightmap lm = task->lm;
+    const i32 len = lm.size * lm.size;
+    E5B9G9R9_t* pim_noalias probes = (E5B9G9R9_t*)task->compact;
+    float3* pim_noalias positions = (float3*)(probes + len * kGiDirections);
+    short2* pim_noalias normals = (short2*)(positions + len);
+    float* pim_noalias sampleCounts = (float*)(normals + len);
+    float2* pim_noalias moments = (float2*)(sampleCounts + len);
+    u16* pim_noalias weights = (u16*)(moments + len);
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        for (i32 j = 0; j < kGiDirections; ++j)
+        {
+            probes[j * len + i] = f4_rgb9e5(lm.probes[j][i]);
+            weights[j * len + i] = f1_half(lm.probes[j][i].w);
+        }
+        positions[i] = lm.position[i];
+        normals[i] = NormalToOct16(f3_f4(lm.normal[i], 0.0f));
+        sampleCounts[i] = lm.sampleCounts[i];
+        moments[i] = lm.moments[i];
+    }
+}
+
+static void ExpandFn(void* pbase, i32 begin, i32 end)
+{
+    CompactTask* task = pbase;
+    const Lightmap lm = task->lm;
+    const i32 len = lm.size * lm.size;
+    const E5B9G9R9_t* pim_noalias probes = (const E5B9G9R9_t*)task->compact;
+    const float3* pim_noalias positions = (const float3*)(probes + len * kGiDirections);
+    const short2* pim_noalias normals = (const short2*)(positions + len);
+    const float* pim_noalias sampleCounts = (const float*)(normals + len);
+    const float2* pim_noalias moments = (const float2*)(sampleCounts + len);
+    const u16* pim_noalias weights = (const u16*)(moments + len);
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        const bool covered = sampleCounts[i] > 0.0f;
+        for (i32 j = 0; j < kGiDirections; ++j)
+        {
+            float4 probe = rgb9e5_f4(probes[j * len + i]);
+            probe.w = half_f1(weights[j * len + i]);
+            lm.probes[j][i] = probe;
+        }
+        lm.position[i] = positions[i];
+        lm.normal[i] = covered ? f4_f3(Oct16ToNormal(normals[i])) : f3_0;
+        lm.sampleCounts[i] = sampleCounts[i];
+        lm.moments[i] = moments[i];
+    }
+}
+
+// uploads a run of tiles in one row, all directions in one copy
+static i32 Lightmap_UploadTiles(Lightmap* lm, i32 tx, i32 ty, i32 run)
+{
+    const i32 size = lm->size;
+    const int2 lo = i2_v(tx * kLmUploadTile, ty * kLmUploadTile);
+    const int2 hi = i2_min(i2_add(lo, i2_v(run * kLmUploadTile, kLmUploadTile)), i2_s(size));
+    const int2 extent = i2_sub(hi, lo);
+    const i32 len = extent.x * extent.y;
+    const i32 bytes = sizeof(u16) * 4 * len * kGiDirections;
+
+    u16* pim_noalias dst = Temp_Alloc(bytes);
+    for (i32 i = 0; i < kGiDirections; ++i)
+    {
+        const float4* pim_noalias probes = lm->probes[i];
+        u16* pim_noalias layer = dst + i * len * 4;
+        for (i32 y = 0; y < extent.y; ++y)
+        {
+            const float4* pim_noalias src = probes + (lo.y + y) * size + lo.x;
+            u16* pim_noalias row = layer + y * extent.x * 4;
+            for (i32 x = 0; x < extent.x; ++x)
+            {
+                ProbeToHalf(src[x], row + x * 4);
+            }
+        }
+    }
+    vkrTexTable_UploadRegion(lm->slot, 0, kGiDirections, lo, extent, dst, bytes);
+    return bytes;
+}
+
+ProfileMark(pm_Upload, LmPack_Upload)
+i32 LmPack_Upload(LmPack* pack, i32 byteBudget)
+{
+    ASSERT(pack);
+    if (!vkrSys_Active() || (pack->lmCount <= 0))
+    {
+        return 0;
+    }
+    ProfileBegin(pm_Upload);
+
+    const i32 tilesPerRow = Lightmap_TilesPerRow(pack->lmSize);
+    const i32 tilesPerLm = tilesPerRow * tilesPerRow;
+    const i32 tileCount = tilesPerLm * pack->lmCount;
+    i32 cursor = pack->uploadCursor % tileCount;
+    i32 visited = 0;
+    i32 bytes = 0;
+    while ((visited < tileCount) && (bytes < byteBudget))
+    {
+        const i32 iLightmap = cursor / tilesPerLm;
+        const i32 iTile = cursor - iLightmap * tilesPerLm;
+        const i32 tx = iTile % tilesPerRow;
+        const i32 ty = iTile / tilesPerRow;
+        Lightmap* lm = &pack->lightmaps[iLightmap];
+        u64* pim_noalias tiles = lm->uploadTiles;
+
+        // merge baked neighbours along the row, within the budget
+        const i32 tileBytes = sizeof(u16) * 4 * kLmUploadTile * kLmUploadTile * kGiDirections;
+        i32 run = 0;
+        while ((tx + run) < tilesPerRow)
+        {
+            const i32 j = iTile + run;
+            const u64 bit = 1ull << (j & 63);
+            if (!(tiles[j >> 6] & bit))
+            {
+                break;
+            }
+            if ((run > 0) && ((bytes + (run + 1) * tileBytes) > byteBudget))
+            {
+                break;
+            }
+            tiles[j >> 6] &= ~bit;
+            ++run;
+        }
+        if (run > 0)
+        {
+            bytes += Lightmap_UploadTiles(lm, tx, ty, run);
+        }
+
+        const i32 step = i1_max(run, 1);
+        visited += step;
+        cursor = (cursor + step) % tileCount;
+    }
+    pack->uploadCursor = cursor;
+
+    ProfileCounter("lm upload bytes", (double)bytes);
+    ProfileEnd(pm_Upload);
+    return bytes;
+}
+
+ProfileMark(pm_LmSave, LmPack_Save)
+bool LmPack_Save(Crate* crate, const LmPack* pack)
+{
+    bool wrote = false;
+    ASSERT(pack);
+    ProfileBegin(pm_LmSave);
+
+    const i32 lmcount = pack->lmCount;
+    const DiskLmPack dpack = DiskLmPack_New(pack, LmFormat_Compact);
+    const i32 texelBytes = dpack.bytesPerLightmap;
 
     if (Crate_Set(crate, Guid_FromStr("lmpack"), &dpack, sizeof(dpack)))
     {
         wrote = true;
+        u8* compact = Tex_Alloc(texelBytes);
         for (i32 i = 0; i < lmcount; ++i)
         {
             char name[PIM_PATH] = { 0 };
             SPrintf(ARGS(name), "lightmap_%d", i);
-            const Lightmap lm = pack->lightmaps[i];
-            wrote &= Crate_Set(crate, Guid_FromStr(name), lm.probes[0], texelBytes);
+            CompactTask* task = Temp_Calloc(sizeof(*task));
+            task->lm = pack->lightmaps[i];
+            task->compact = compact;
+            Task_Run(task, CompactFn, task->lm.size * task->lm.size);
+            wrote &= Crate_Set(crate, Guid_FromStr(name), compact, texelBytes);
         }
+        Mem_Free(compact);
     }
 
+    ProfileEnd(pm_LmSave);
     return wrote;
 }
 
@@ -1271,6 +2138,8 @@ bool LmPack_Load(Crate* crate, LmPack* pack)
     {
         if ((dpack.version == kLmPackVersion) &&
             (dpack.directions == kGiDirections) &&
+            (dpack.format >= 0) &&
+            (dpack.format < LmFormat_COUNT) &&
             (dpack.lmCount > 0) &&
             (dpack.lmSize > 0))
         {
@@ -1278,15 +2147,14 @@ bool LmPack_Load(Crate* crate, LmPack* pack)
 
             const i32 lmcount = dpack.lmCount;
             const i32 lmsize = dpack.lmSize;
-            const i32 texelcount = lmsize * lmsize;
-            const Lightmap lmNull = { 0 };
-            const i32 probesBytes = sizeof(lmNull.probes[0][0]) * texelcount * kGiDirections;
-            const i32 positionBytes = sizeof(lmNull.position[0]) * texelcount;
-            const i32 normalBytes = sizeof(lmNull.normal[0]) * texelcount;
-            const i32 sampleBytes = sizeof(lmNull.sampleCounts[0]) * texelcount;
-            const i32 texelBytes = probesBytes + sampleBytes + positionBytes + normalBytes;
+            const bool compact = dpack.format == LmFormat_Compact;
+            const i32 texelBytes = compact ?
+                Lightmap_CompactBytes(lmsize) :
+                Lightmap_Bytes(lmsize);
+            u8* compactBytes = compact ? Tex_Alloc(texelBytes) : NULL;
 
             pack->lightmaps = Perm_Calloc(sizeof(pack->lightmaps[0]) * lmcount);
+            pack->dirty = Perm_Calloc(sizeof(pack->dirty[0]) * lmcount);
             pack->lmCount = lmcount;
             pack->lmSize = dpack.lmSize;
             pack->texelsPerMeter = dpack.texelsPerMeter;
@@ -1297,16 +2165,469 @@ bool LmPack_Load(Crate* crate, LmPack* pack)
                 SPrintf(ARGS(name), "lightmap_%d", i);
                 Lightmap lm = { 0 };
                 Lightmap_New(&lm, lmsize);
-                loaded &= Crate_Get(crate, Guid_FromStr(name), lm.probes[0], texelBytes);
+                if (compact)
+                {
+                    loaded &= Crate_Get(crate, Guid_FromStr(name), compactBytes, texelBytes);
+                    CompactTask* task = Temp_Calloc(sizeof(*task));
+                    task->lm = lm;
+                    task->compact = compactBytes;
+                    Task_Run(task, ExpandFn, lmsize * lmsize);
+                }
+                else
+                {
+                    loaded &= Crate_Get(crate, Guid_FromStr(name), lm.probes[0], texelBytes);
+                }
                 Lightmap_Upload(&lm);
                 pack->lightmaps[i] = lm;
             }
+            Mem_Free(compactBytes);
         }
     }
 
     return loaded;
 }
 
+// ----------------------------------------------------------------------------
+// checkpoints
+
+typedef struct LmCheckpoint_s
+{
+    Task task;
+    char path[PIM_PATH];
+    DiskLmPack header;
+    // DiskLmLayout and its verts, NULL when already on disk
+    u8* pim_noalias layout;
+    i32 layoutBytes;
+    // copies of the lightmaps to write, [count][header.bytesPerLightmap]
+    u8** pim_noalias texels;
+    // [count]
+    i32* pim_noalias indices;
+    // crate entries, named on the main thread, [count]
+    Guid* pim_noalias names;
+    Guid packName;
+    Guid layoutName;
+    i32 count;
+    bool wrote;
+} LmCheckpoint;
+
+// the checkpoint being written, NULL when idle
+static LmCheckpoint* ms_checkpoint;
+
+// copies src over dst, a missing src is an empty copy
+static bool CopyCheckpoint(const char* src, const char* dst)
+{
+    IO_Remove(dst);
+    FStream srcFile = FStream_Open(src, "rb");
+    if (!FStream_IsOpen(srcFile))
+    {
+        return true;
+    }
+    bool copied = false;
+    FStream dstFile = FStream_Open(dst, "wb");
+    if (FStream_IsOpen(dstFile))
+    {
+        const i32 kChunk = 1 << 20;
+        u8* buffer = Perm_Alloc(kChunk);
+        copied = true;
+        i32 len;
+        while ((len = FStream_Read(srcFile, buffer, kChunk)) > 0)
+        {
+            copied &= FStream_Write(dstFile, buffer, len) == len;
+        }
+        Mem_Free(buffer);
+        copied &= FStream_Close(&dstFile);
+    }
+    FStream_Close(&srcFile);
+    return copied;
+}
+
+static void CheckpointFn(void* pbase, i32 begin, i32 end)
+{
+    LmCheckpoint* task = pbase;
+    const i32 texelBytes = task->header.bytesPerLightmap;
+    // a preemption mid write must not tear the checkpoint on disk,
+    // so write a copy and rename it over the original once it is closed.
+    char tmpPath[PIM_PATH] = { 0 };
+    SPrintf(ARGS(tmpPath), "%s.tmp", task->path);
+    bool wrote = true;
+    if (task->layout)
+    {
+        // a new layout rewrites every lightmap, start from an empty crate
+        IO_Remove(tmpPath);
+    }
+    else
+    {
+        wrote &= CopyCheckpoint(task->path, tmpPath);
+    }
+    // crates are too large for the stack, and outlive the frame
+    Crate* crate = Perm_Alloc(sizeof(*crate));
+    if (wrote && Crate_Open(crate, tmpPath))
+    {
+        if (task->layout)
+        {
+            wrote &= Crate_Set(crate, task->layoutName, task->layout, task->layoutBytes);
+        }
+        for (i32 i = 0; i < task->count; ++i)
+        {
+            wrote &= Crate_Set(crate, task->names[i], task->texels[i], texelBytes);
+        }
+        wrote &= Crate_Set(crate, task->packName, &task->header, sizeof(task->header));
+        wrote &= Crate_Close(crate);
+    }
+    else
+    {
+        wrote = false;
+    }
+    Mem_Free(crate);
+    wrote = wrote && IO_Rename(tmpPath, task->path);
+    if (!wrote)
+    {
+        IO_Remove(tmpPath);
+    }
+    task->wrote = wrote;
+}
+
+// frees a finished checkpoint. failed writes are retried by the next one.
+static bool CheckpointReap(LmPack* pack, bool wait)
+{
+    LmCheckpoint* task = ms_checkpoint;
+    if (!task)
+    {
+        return true;
+    }
+    if (wait)
+    {
+        Task_Await(task);
+    }
+    if (Task_Stat(task) != TaskStatus_Complete)
+    {
+        return false;
+    }
+
+    if (task->wrote)
+    {
+        Con_Logf(LogSev_Verbose, "lm", "Checkpointed %d lightmaps to '%s'", task->count, task->path);
+    }
+    else
+    {
+        Con_Logf(LogSev_Error, "lm", "Failed to checkpoint lightmaps to '%s'", task->path);
+        if (pack && (pack->lmCount == task->header.lmCount))
+        {
+            pack->layoutSaved &= task->layout == NULL;
+            for (i32 i = 0; i < task->count; ++i)
+            {
+                pack->dirty[task->indices[i]] = 1;
+            }
+        }
+    }
+
+    Mem_Free(task->layout);
+    for (i32 i = 0; i < task->count; ++i)
+    {
+        Mem_Free(task->texels[i]);
+    }
+    Mem_Free(task->texels);
+    Mem_Free(task->indices);
+    Mem_Free(task->names);
+    Mem_Free(task);
+    ms_checkpoint = NULL;
+    return true;
+}
+
+pim_inline bool IsLightmapped(const Entities* drawables, i32 iDrawable)
+{
+    return ((drawables->materials[iDrawable].flags & kUnmappedMaterials) == 0) &&
+        (Mesh_Get(drawables->meshes[iDrawable]) != NULL);
+}
+
+static DiskLmLayout DiskLmLayout_New(void)
+{
+    const Entities* drawables = Entities_Get();
+    DiskLmLayout layout = { 0 };
+    layout.version = kLmLayoutVersion;
+    layout.drawableCount = drawables->count;
+    u64 hash = Fnv64Bias;
+    for (i32 d = 0; d < drawables->count; ++d)
+    {
+        if (IsLightmapped(drawables, d))
+        {
+            const Mesh* mesh = Mesh_Get(drawables->meshes[d]);
+            layout.vertCount += mesh->length;
+            hash = Fnv64Bytes(&drawables->matrices[d], sizeof(drawables->matrices[d]), hash);
+            hash = Fnv64Bytes(mesh->positions, sizeof(mesh->positions[0]) * mesh->length, hash);
+        }
+    }
+    layout.sceneHash = hash;
+    return layout;
+}
+
+static u8* LmLayout_Save(const LmPack* pack, i32* bytesOut)
+{
+    const Entities* drawables = Entities_Get();
+    const DiskLmLayout layout = DiskLmLayout_New();
+    const i32 bytes = sizeof(layout) + sizeof(DiskLmVert) * layout.vertCount;
+    u8* pim_noalias dst = Perm_Alloc(bytes);
+    memcpy(dst, &layout, sizeof(layout));
+    DiskLmVert* pim_noalias verts = (DiskLmVert*)(dst + sizeof(layout));
+    for (i32 d = 0; d < drawables->count; ++d)
+    {
+        if (IsLightmapped(drawables, d))
+        {
+            const Mesh* mesh = Mesh_Get(drawables->meshes[d]);
+            for (i32 v = 0; v < mesh->length; ++v)
+            {
+                verts->uv = f2_v(mesh->uvs[v].z, mesh->uvs[v].w);
+                verts->lightmap = LmPack_Find(pack, mesh->texIndices[v].w);
+                ++verts;
+            }
+        }
+    }
+    *bytesOut = bytes;
+    return dst;
+}
+
+// points the lightmapped meshes at a saved layout of the same scene
+static bool LmLayout_Apply(const LmPack* pack, const u8* src, i32 bytes)
+{
+    const DiskLmLayout expected = DiskLmLayout_New();
+    if (bytes < (i32)(sizeof(expected) + sizeof(DiskLmVert) * expected.vertCount))
+    {
+        return false;
+    }
+    DiskLmLayout layout = { 0 };
+    memcpy(&layout, src, sizeof(layout));
+    if (memcmp(&layout, &expected, sizeof(layout)) != 0)
+    {
+        return false;
+    }
+
+    const Entities* drawables = Entities_Get();
+    const DiskLmVert* verts = (const DiskLmVert*)(src + sizeof(layout));
+    for (i32 d = 0; d < drawables->count; ++d)
+    {
+        if (IsLightmapped(drawables, d))
+        {
+            Mesh* mesh = Mesh_Get(drawables->meshes[d]);
+            for (i32 v = 0; v < mesh->length; ++v)
+            {
+                const DiskLmVert vert = *verts++;
+                if ((vert.lightmap >= 0) && (vert.lightmap < pack->lmCount))
+                {
+                    mesh->uvs[v].z = vert.uv.x;
+                    mesh->uvs[v].w = vert.uv.y;
+                    mesh->texIndices[v].w = LmTexId(pack->lightmaps, vert.lightmap);
+                }
+            }
+            Mesh_Upload(drawables->meshes[d]);
+        }
+    }
+    return true;
+}
+
+static bool LmLayout_Load(Crate* crate, const LmPack* pack)
+{
+    i32 offset = 0;
+    i32 bytes = 0;
+    if (!Crate_Stat(crate, Guid_FromStr("lmlayout"), &offset, &bytes))
+    {
+        return false;
+    }
+    u8* src = Perm_Alloc(bytes);
+    bool loaded =
+        Crate_Get(crate, Guid_FromStr("lmlayout"), src, bytes) &&
+        LmLayout_Apply(pack, src, bytes);
+    Mem_Free(src);
+    return loaded;
+}
+
+u8* LmPack_SaveLayout(const LmPack* pack, i32* bytesOut)
+{
+    ASSERT(pack);
+    ASSERT(bytesOut);
+    const DiskLmPack dpack = DiskLmPack_New(pack, LmFormat_Float);
+    i32 layoutBytes = 0;
+    u8* layout = LmLayout_Save(pack, &layoutBytes);
+    const i32 bytes = sizeof(dpack) + layoutBytes;
+    u8* dst = Perm_Alloc(bytes);
+    memcpy(dst, &dpack, sizeof(dpack));
+    memcpy(dst + sizeof(dpack), layout, layoutBytes);
+    Mem_Free(layout);
+    *bytesOut = bytes;
+    return dst;
+}
+
+i32 LmPack_LayoutBytes(void)
+{
+    // DiskLmLayout_New's vertCount, without hashing the positions
+    const Entities* drawables = Entities_Get();
+    i32 vertCount = 0;
+    for (i32 d = 0; d < drawables->count; ++d)
+    {
+        if (IsLightmapped(drawables, d))
+        {
+            vertCount += Mesh_Get(drawables->meshes[d])->length;
+        }
+    }
+    return sizeof(DiskLmPack) + sizeof(DiskLmLayout) + sizeof(DiskLmVert) * vertCount;
+}
+
+ProfileMark(pm_LoadLayout, LmPack_LoadLayout)
+bool LmPack_LoadLayout(LmPack* pack, const u8* src, i32 bytes)
+{
+    ASSERT(pack);
+    LmPack_Del(pack);
+
+    DiskLmPack dpack = { 0 };
+    if (!src || (bytes < (i32)sizeof(dpack)))
+    {
+        return false;
+    }
+    memcpy(&dpack, src, sizeof(dpack));
+    if ((dpack.version != kLmPackVersion) ||
+        (dpack.directions != kGiDirections) ||
+        (dpack.lmCount <= 0) ||
+        (dpack.lmSize <= 0))
+    {
+        return false;
+    }
+    ProfileBegin(pm_LoadLayout);
+
+    const i32 lmcount = dpack.lmCount;
+    pack->lightmaps = Perm_Calloc(sizeof(pack->lightmaps[0]) * lmcount);
+    pack->dirty = Perm_Calloc(sizeof(pack->dirty[0]) * lmcount);
+    pack->lmCount = lmcount;
+    pack->lmSize = dpack.lmSize;
+    pack->texelsPerMeter = dpack.texelsPerMeter;
+    SG_Generate(pack->axii, kGiDirections, SGDist_Hemi);
+    for (i32 i = 0; i < lmcount; ++i)
+    {
+        Lightmap_New(pack->lightmaps + i, dpack.lmSize);
+    }
+
+    bool loaded = LmLayout_Apply(pack, src + sizeof(dpack), bytes - (i32)sizeof(dpack));
+    if (loaded)
+    {
+        EmbedAttributes(pack->lightmaps, lmcount, pack->texelsPerMeter);
+    }
+    else
+    {
+        LmPack_Del(pack);
+    }
+
+    ProfileEnd(pm_LoadLayout);
+    return loaded;
+}
+
+ProfileMark(pm_Checkpoint, LmPack_Checkpoint)
+bool LmPack_Checkpoint(LmPack* pack, const char* path)
+{
+    ASSERT(pack);
+    ASSERT(path);
+    if (!CheckpointReap(pack, false))
+    {
+        return false;
+    }
+    bool dirty = !pack->layoutSaved;
+    for (i32 i = 0; i < pack->lmCount; ++i)
+    {
+        dirty |= pack->dirty[i] != 0;
+    }
+    if ((pack->lmCount <= 0) || !dirty)
+    {
+        return true;
+    }
+    ProfileBegin(pm_Checkpoint);
+
+    LmCheckpoint* task = Perm_Calloc(sizeof(*task));
+    StrCpy(ARGS(task->path), path);
+    task->header = DiskLmPack_New(pack, LmFormat_Float);
+    task->packName = Guid_FromStr("lmpack");
+    task->layoutName = Guid_FromStr("lmlayout");
+    if (!pack->layoutSaved)
+    {
+        // a new layout invalidates every lightmap on disk
+        task->layout = LmLayout_Save(pack, &task->layoutBytes);
+        memset(pack->dirty, 1, sizeof(pack->dirty[0]) * pack->lmCount);
+        pack->layoutSaved = true;
+    }
+
+    // snapshot the dirty lightmaps, so baking continues during the write
+    const i32 texelBytes = task->header.bytesPerLightmap;
+    for (i32 i = 0; i < pack->lmCount; ++i)
+    {
+        task->count += pack->dirty[i] ? 1 : 0;
+    }
+    task->indices = Perm_Alloc(sizeof(task->indices[0]) * task->count);
+    task->names = Perm_Alloc(sizeof(task->names[0]) * task->count);
+    task->texels = Perm_Alloc(sizeof(task->texels[0]) * task->count);
+    for (i32 i = 0, j = 0; i < pack->lmCount; ++i)
+    {
+        if (pack->dirty[i])
+        {
+            pack->dirty[i] = 0;
+            char name[PIM_PATH] = { 0 };
+            SPrintf(ARGS(name), "lightmap_%d", i);
+            task->indices[j] = i;
+            task->names[j] = Guid_FromStr(name);
+            task->texels[j] = Tex_Alloc(texelBytes);
+            memcpy(task->texels[j], pack->lightmaps[i].probes[0], texelBytes);
+            ++j;
+        }
+    }
+
+    ms_checkpoint = task;
+    // keep the write off the main thread's queue
+    Task_SubmitBackground(task, CheckpointFn, 1);
+    TaskSys_Schedule();
+
+    ProfileEnd(pm_Checkpoint);
+    return true;
+}
+
+void LmPack_AwaitCheckpoint(void)
+{
+    CheckpointReap(NULL, true);
+}
+
+ProfileMark(pm_Resume, LmPack_Resume)
+bool LmPack_Resume(LmPack* pack, const char* path)
+{
+    ASSERT(pack);
+    ASSERT(path);
+    LmPack_Del(pack);
+
+    // crates open for writing when missing
+    FStream file = FStream_Open(path, "rb");
+    if (!FStream_IsOpen(file))
+    {
+        return false;
+    }
+    FStream_Close(&file);
+
+    ProfileBegin(pm_Resume);
+    bool resumed = false;
+    Crate* crate = Perm_Alloc(sizeof(*crate));
+    if (Crate_Open(crate, path))
+    {
+        resumed = LmPack_Load(crate, pack) && LmLayout_Load(crate, pack);
+        Crate_Close(crate);
+    }
+    Mem_Free(crate);
+
+    if (resumed)
+    {
+        pack->layoutSaved = true;
+        Con_Logf(LogSev_Info, "lm", "Resumed %d lightmaps from '%s'", pack->lmCount, path);
+    }
+    else
+    {
+        LmPack_Del(pack);
+        Con_Logf(LogSev_Warning, "lm", "Checkpoint '%s' does not match the scene", path);
+    }
+    ProfileEnd(pm_Resume);
+    return resumed;
+}
+
 static cmdstat_t CmdPrintLm(i32 argc, const char** argv)
 {
     cmdstat_t status = cmdstat_ok;
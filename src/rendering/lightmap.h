@@ -8,8 +8,10 @@
 
 PIM_C_BEGIN
 
-#define kLmPackVersion      2
+#define kLmPackVersion      5
 #define kGiDirections       5
+// texels per side of the squares that lightmap uploads track
+#define kLmUploadTile       64
 
 static const float4 kGiAxii[kGiDirections] =
 {
@@ -30,6 +32,10 @@ typedef struct Lightmap_s
     float3* pim_noalias position;
     float3* pim_noalias normal;
     float* pim_noalias sampleCounts;
+    // x: mean luminance, y: mean squared luminance, of the bake samples
+    float2* pim_noalias moments;
+    // one bit per upload tile, row major, set when baked since its last upload
+    u64* pim_noalias uploadTiles;
     i32 size;
     vkrTextureId slot;
 } Lightmap;
@@ -41,21 +47,81 @@ typedef struct LmPack_s
     i32 lmCount;
     i32 lmSize;
     float texelsPerMeter;
+    // texels above the error target, highest error first.
+    // iLightmap * lmSize * lmSize + iTexel
+    i32* pim_noalias schedule;
+    i32 scheduleLen;
+    // next schedule entry to bake
+    i32 scheduleCursor;
+    // error target the schedule was built for
+    float scheduleError;
+    // fraction of lightmapped texels at the error target
+    float progress;
+    // lightmaps baked since the last checkpoint, [lmCount]
+    u8* pim_noalias dirty;
+    // whether the checkpoint holds this pack's chart layout
+    bool layoutSaved;
+    // next upload tile to visit, over every lightmap's tiles in order
+    i32 uploadCursor;
 } LmPack;
 
+typedef enum
+{
+    // full bake state, for resuming accumulation
+    LmFormat_Float = 0,
+    // shared exponent probes, octahedral normals, half precision fit weights.
+    // baking a loaded compact pack continues from its texels.
+    LmFormat_Compact,
+
+    LmFormat_COUNT
+} LmFormat;
+
 typedef struct DiskLmPack_s
 {
     i32 version;
     i32 directions;
+    // LmFormat of the lightmaps
+    i32 format;
     i32 lmCount;
     i32 lmSize;
     i32 bytesPerLightmap;
     float texelsPerMeter;
 } DiskLmPack;
 
+#define kLmLayoutVersion    1
+
+// lightmap uvs of every lightmapped vertex, in drawable order,
+// followed by vertCount DiskLmVerts.
+typedef struct DiskLmLayout_s
+{
+    i32 version;
+    i32 drawableCount;
+    i32 vertCount;
+    i32 pad;
+    // of the lightmapped meshes' positions and transforms
+    u64 sceneHash;
+} DiskLmLayout;
+
+typedef struct DiskLmVert_s
+{
+    float2 uv;
+    // index into LmPack.lightmaps, or -1
+    i32 lightmap;
+} DiskLmVert;
+
+// one texel's bake accumulation, as exchanged between bake processes
+typedef struct LmTexelState_s
+{
+    float4 probes[kGiDirections];
+    float2 moments;
+    // samples behind probes and moments, 0 when none
+    float samples;
+    float pad;
+} LmTexelState;
+
 void Lightmap_New(Lightmap* lm, i32 size);
 void Lightmap_Del(Lightmap* lm);
-// upload changes to the GPU copy
+// upload the whole lightmap to the GPU copy
 void Lightmap_Upload(Lightmap* lm);
 
 LmPack* LmPack_Get(void);
@@ -65,10 +131,47 @@ LmPack LmPack_Pack(
     float distThresh,
     float degThresh);
 void LmPack_Del(LmPack* pack);
+// index of the lightmap a mesh's texIndices.w refers to, or -1
+i32 LmPack_Find(const LmPack* pack, i32 texId);
 
-void LmPack_Bake(PtScene* scene, float timeSlice, i32 spp);
+// bakes the next timeSlice fraction of the scheduled texels.
+// maxError is the target relative standard error of a texel's luminance.
+// returns the bake progress, reaching 1 once every texel is at the target.
+float LmPack_Bake(PtScene* scene, float timeSlice, i32 spp, float maxError);
+// advances the schedule by the next timeSlice fraction, as LmPack_Bake does,
+// pointing sliceOut at the texels in memory order. returns their count.
+i32 LmPack_NextSlice(LmPack* pack, float timeSlice, float maxError, i32** sliceOut);
+// accumulates spp samples into each of the texels. scene must be up to date.
+void LmPack_BakeTexels(PtScene* scene, const i32* texels, i32 count, i32 spp);
+// copies the texels' accumulations to dst, then restarts them from zero
+// samples, so the next take holds only the samples baked in between.
+void LmPack_TakeTexels(LmPack* pack, const i32* texels, i32 count, LmTexelState* dst);
+// folds taken accumulations into the texels, weighted by sample count
+void LmPack_MergeTexels(LmPack* pack, const i32* texels, i32 count, const LmTexelState* src);
+// uploads the tiles baked since their last upload, resuming where the last
+// call stopped, until about byteBudget bytes are sent. returns the bytes sent.
+i32 LmPack_Upload(LmPack* pack, i32 byteBudget);
 
 bool LmPack_Save(Crate* crate, const LmPack* src);
 bool LmPack_Load(Crate* crate, LmPack* dst);
 
+// the pack's header and chart layout, without texels, in a Perm allocation.
+// another process with the same scene loaded can rebuild the pack from it.
+u8* LmPack_SaveLayout(const LmPack* pack, i32* bytesOut);
+// size of LmPack_SaveLayout's bytes for the loaded scene
+i32 LmPack_LayoutBytes(void);
+// rebuilds an unbaked pack from LmPack_SaveLayout's bytes.
+// fails if the lightmapped meshes differ from the saving process's.
+bool LmPack_LoadLayout(LmPack* pack, const u8* src, i32 bytes);
+
+// writes the lightmaps baked since the last checkpoint to the crate at path,
+// from a background task. the first checkpoint of a pack writes all of it.
+// returns false while the previous checkpoint is still being written.
+bool LmPack_Checkpoint(LmPack* pack, const char* path);
+// blocks until the pending checkpoint, if any, is on disk
+void LmPack_AwaitCheckpoint(void);
+// continues a checkpointed bake over the current scene, from the saved
+// sample counts. fails if the lightmapped meshes changed since.
+bool LmPack_Resume(LmPack* pack, const char* path);
+
 PIM_C_END
@@ -0,0 +1,472 @@
+#include "rendering/lightmap_dist.h"
+
+#include "allocator/allocator.h"
+#include "rendering/lightmap.h"
+#include "rendering/path_tracer.h"
+#include "math/scalar.h"
+#include "common/time.h"
+#include "common/console.h"
+#include "common/profiler.h"
+#include "common/stringutil.h"
+#include "os/socket.h"
+#include <string.h>
+
+// 'LMDS'
+#define kLmDistMagic        0x53444d4cu
+// weight of the latest measurement in a peer's throughput estimate
+#define kLmRateBlend        0.5f
+// workers that take longer than this to join, or to return a slice, are dropped
+#define kLmPeerTimeoutMs    120000
+
+typedef enum
+{
+    // coordinator: DiskLmPack and layout, from LmPack_SaveLayout
+    LmMsg_Layout = 0,
+    // worker: arg is 1 when the layout matched its scene
+    LmMsg_Ready,
+    // coordinator: arg is spp, followed by the texel indices
+    LmMsg_Bake,
+    // worker: arg is bake microseconds, followed by an LmTexelState per texel
+    LmMsg_Texels,
+    // coordinator: the bake is over
+    LmMsg_Bye,
+
+    LmMsg_COUNT
+} LmMsg;
+
+typedef struct LmMsgHeader_s
+{
+    u32 magic;
+    i32 type;
+    i32 bytes;
+    i32 arg;
+} LmMsgHeader;
+
+typedef struct LmPeer_s
+{
+    Socket sock;
+    u32 addr;
+    // texel samples per second
+    float rate;
+    // run of the current slice it was sent
+    i32 begin;
+    i32 count;
+} LmPeer;
+
+static Socket ms_listen;
+static LmPeer ms_peers[kLmDistMaxWorkers];
+static i32 ms_peerCount;
+static float ms_localRate;
+static Socket ms_coordinator;
+
+// ----------------------------------------------------------------------------
+// messages
+
+static bool SendAll(Socket sock, const void* src, i32 bytes)
+{
+    const u8* ptr = src;
+    while (bytes > 0)
+    {
+        const i32 sent = Socket_Send(sock, ptr, bytes);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        ptr += sent;
+        bytes -= sent;
+    }
+    return true;
+}
+
+// milliseconds left of a budget that began at start
+static i32 MsLeft(u64 start, i32 budgetMs)
+{
+    return budgetMs - (i32)Time_Milli(Time_Now() - start);
+}
+
+// waits until budgetMs have passed since start, or forever when budgetMs is 0.
+// past the deadline, only data that has already arrived is taken.
+static bool RecvAll(Socket sock, void* dst, i32 bytes, u64 start, i32 budgetMs)
+{
+    u8* ptr = dst;
+    while (bytes > 0)
+    {
+        if (budgetMs > 0)
+        {
+            if (!Socket_SetTimeout(sock, i1_max(MsLeft(start, budgetMs), 1)))
+            {
+                return false;
+            }
+        }
+        const i32 got = Socket_Recv(sock, ptr, bytes);
+        if (got <= 0)
+        {
+            return false;
+        }
+        ptr += got;
+        bytes -= got;
+    }
+    return true;
+}
+
+static bool SendMsg(Socket sock, LmMsg type, i32 arg, const void* src, i32 bytes)
+{
+    const LmMsgHeader hdr = { kLmDistMagic, type, bytes, arg };
+    return SendAll(sock, &hdr, sizeof(hdr)) && SendAll(sock, src, bytes);
+}
+
+// receives a message, and its payload into a Tex allocation when present.
+// payloads larger than maxBytes[type] are refused before allocating.
+// the whole message must arrive within budgetMs of start, see RecvAll.
+static bool RecvMsg(
+    Socket sock,
+    LmMsgHeader* hdr,
+    u8** payloadOut,
+    const i32* maxBytes,
+    u64 start,
+    i32 budgetMs)
+{
+    *payloadOut = NULL;
+    if (!RecvAll(sock, hdr, sizeof(*hdr), start, budgetMs) ||
+        (hdr->magic != kLmDistMagic) ||
+        (hdr->type < 0) ||
+        (hdr->type >= LmMsg_COUNT) ||
+        (hdr->bytes < 0) ||
+        (hdr->bytes > maxBytes[hdr->type]))
+    {
+        return false;
+    }
+    if (hdr->bytes > 0)
+    {
+        u8* payload = Tex_Alloc(hdr->bytes);
+        if (!RecvAll(sock, payload, hdr->bytes, start, budgetMs))
+        {
+            Mem_Free(payload);
+            return false;
+        }
+        *payloadOut = payload;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// coordinator
+
+static void DropPeer(LmPeer* peer)
+{
+    if (Socket_IsOpen(peer->sock))
+    {
+        Con_Logf(LogSev_Warning, "lm", "Lost lightmap worker %08x", peer->addr);
+        Socket_Close(&peer->sock);
+    }
+    peer->count = 0;
+}
+
+// sends the layout and waits for the worker to rebuild the pack from it
+static bool Handshake(LmPeer* peer, const u8* layout, i32 layoutBytes)
+{
+    const i32 maxBytes[LmMsg_COUNT] = { 0 };
+    LmMsgHeader hdr = { 0 };
+    u8* payload = NULL;
+    bool ready =
+        SendMsg(peer->sock, LmMsg_Layout, 0, layout, layoutBytes) &&
+        RecvMsg(peer->sock, &hdr, &payload, maxBytes, Time_Now(), kLmPeerTimeoutMs) &&
+        (hdr.type == LmMsg_Ready) &&
+        (hdr.arg != 0);
+    Mem_Free(payload);
+    return ready;
+}
+
+ProfileMark(pm_Serve, LmDist_Serve)
+i32 LmDist_Serve(u16 port, i32 workerCount)
+{
+    LmDist_Shutdown();
+    workerCount = i1_clamp(workerCount, 0, kLmDistMaxWorkers);
+    if ((workerCount <= 0) || (port == 0))
+    {
+        return 0;
+    }
+    ProfileBegin(pm_Serve);
+
+    if (!Socket_Open(&ms_listen, SocketProto_TCP) ||
+        !Socket_Bind(ms_listen, 0, port) ||
+        !Socket_Listen(ms_listen))
+    {
+        Con_Logf(LogSev_Error, "lm", "Failed to listen for lightmap workers on port %u", port);
+        Socket_Close(&ms_listen);
+        ProfileEnd(pm_Serve);
+        return 0;
+    }
+
+    Con_Logf(LogSev_Info, "lm", "Waiting for %d lightmap workers on port %u", workerCount, port);
+    i32 layoutBytes = 0;
+    u8* layout = LmPack_SaveLayout(LmPack_Get(), &layoutBytes);
+    // workers that never start must not stall the bake, it continues
+    // with those that joined in time, or alone
+    const u64 start = Time_Now();
+    for (i32 i = 0; i < workerCount; ++i)
+    {
+        if (!Socket_Poll(ms_listen, MsLeft(start, kLmPeerTimeoutMs)))
+        {
+            Con_Logf(LogSev_Warning, "lm", "Stopped waiting for lightmap workers, %d of %d joined", ms_peerCount, workerCount);
+            break;
+        }
+        LmPeer peer = { 0 };
+        peer.sock = Socket_Accept(ms_listen, &peer.addr);
+        if (!Socket_IsOpen(peer.sock))
+        {
+            break;
+        }
+        if (Handshake(&peer, layout, layoutBytes))
+        {
+            peer.rate = 1.0f;
+            ms_peers[ms_peerCount++] = peer;
+            Con_Logf(LogSev_Info, "lm", "Lightmap worker %08x joined", peer.addr);
+        }
+        else
+        {
+            Con_Logf(LogSev_Warning, "lm", "Lightmap worker %08x does not have this scene", peer.addr);
+            Socket_Close(&peer.sock);
+        }
+    }
+    Mem_Free(layout);
+    ms_localRate = 1.0f;
+
+    ProfileEnd(pm_Serve);
+    return ms_peerCount;
+}
+
+pim_inline float UpdateRate(float rate, i32 samples, double seconds)
+{
+    if ((samples > 0) && (seconds > 0.0))
+    {
+        rate = f1_lerp(rate, (float)(samples / seconds), kLmRateBlend);
+    }
+    return rate;
+}
+
+ProfileMark(pm_Bake, LmDist_Bake)
+float LmDist_Bake(PtScene* scene, float timeSlice, i32 spp, float maxError)
+{
+    ProfileBegin(pm_Bake);
+    ASSERT(scene);
+
+    PtScene_Update(scene);
+
+    LmPack *const pack = LmPack_Get();
+    spp = i1_max(1, spp);
+    i32* slice = NULL;
+    const i32 count = LmPack_NextSlice(pack, timeSlice, maxError, &slice);
+    if (count > 0)
+    {
+        // contiguous runs keep each process's packets coherent
+        float totalRate = ms_localRate;
+        for (i32 i = 0; i < ms_peerCount; ++i)
+        {
+            totalRate += Socket_IsOpen(ms_peers[i].sock) ? ms_peers[i].rate : 0.0f;
+        }
+        i32 begin = 0;
+        for (i32 i = 0; i < ms_peerCount; ++i)
+        {
+            LmPeer* peer = &ms_peers[i];
+            peer->begin = begin;
+            peer->count = 0;
+            if (!Socket_IsOpen(peer->sock))
+            {
+                continue;
+            }
+            const i32 len = i1_min(count - begin, (i32)(count * (peer->rate / totalRate)));
+            if (len > 0)
+            {
+                if (SendMsg(peer->sock, LmMsg_Bake, spp, slice + begin, sizeof(slice[0]) * len))
+                {
+                    peer->count = len;
+                    begin += len;
+                }
+                else
+                {
+                    DropPeer(peer);
+                }
+            }
+        }
+
+        // the remainder is baked here while the workers run
+        const i32 localLen = count - begin;
+        const u64 start = Time_Now();
+        LmPack_BakeTexels(scene, slice + begin, localLen, spp);
+        ms_localRate = UpdateRate(ms_localRate, localLen * spp, Time_Sec(Time_Now() - start));
+
+        // one deadline for all of the slice's results,
+        // so stalled workers do not add up
+        const u64 collectStart = Time_Now();
+        for (i32 i = 0; i < ms_peerCount; ++i)
+        {
+            LmPeer* peer = &ms_peers[i];
+            if (peer->count <= 0)
+            {
+                continue;
+            }
+            i32 maxBytes[LmMsg_COUNT] = { 0 };
+            maxBytes[LmMsg_Texels] = sizeof(LmTexelState) * peer->count;
+            LmMsgHeader hdr = { 0 };
+            u8* payload = NULL;
+            const bool received =
+                RecvMsg(peer->sock, &hdr, &payload, maxBytes, collectStart, kLmPeerTimeoutMs) &&
+                (hdr.type == LmMsg_Texels) &&
+                (hdr.bytes == (i32)(sizeof(LmTexelState) * peer->count));
+            if (received)
+            {
+                LmPack_MergeTexels(pack, slice + peer->begin, peer->count, (const LmTexelState*)payload);
+                peer->rate = UpdateRate(peer->rate, peer->count * spp, hdr.arg * 1e-6);
+            }
+            else
+            {
+                // its texels are rescheduled while above the error target
+                DropPeer(peer);
+            }
+            Mem_Free(payload);
+        }
+    }
+    ProfileCounter("lm bake progress", pack->progress);
+
+    ProfileEnd(pm_Bake);
+    return pack->progress;
+}
+
+void LmDist_Shutdown(void)
+{
+    for (i32 i = 0; i < ms_peerCount; ++i)
+    {
+        LmPeer* peer = &ms_peers[i];
+        if (Socket_IsOpen(peer->sock))
+        {
+            SendMsg(peer->sock, LmMsg_Bye, 0, NULL, 0);
+            Socket_Close(&peer->sock);
+        }
+    }
+    memset(ms_peers, 0, sizeof(ms_peers));
+    ms_peerCount = 0;
+    if (Socket_IsOpen(ms_listen))
+    {
+        Socket_Close(&ms_listen);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// worker
+
+bool LmDist_Join(const char* address)
+{
+    ASSERT(address);
+    char host[PIM_PATH] = { 0 };
+    StrCpy(ARGS(host), address);
+    char* colon = strrchr(host, ':');
+    if (!colon)
+    {
+        Con_Logf(LogSev_Error, "lm", "Expected host:port, got '%s'", address);
+        return false;
+    }
+    *colon = 0;
+    const i32 port = ParseInt(colon + 1);
+
+    u32 addr = 0;
+    bool joined =
+        (port > 0) &&
+        (port <= 0xffff) &&
+        Net_UrlToAddr(host, &addr) &&
+        Socket_Open(&ms_coordinator, SocketProto_TCP) &&
+        Socket_Connect(ms_coordinator, addr, (u16)port);
+    if (joined)
+    {
+        Con_Logf(LogSev_Info, "lm", "Joined lightmap coordinator at '%s'", address);
+    }
+    else
+    {
+        Con_Logf(LogSev_Error, "lm", "Failed to join lightmap coordinator at '%s'", address);
+        Socket_Close(&ms_coordinator);
+    }
+    return joined;
+}
+
+// bakes the texels from their own first sample and sends back the result
+static bool WorkBake(PtScene* scene, i32 spp, const i32* texels, i32 count)
+{
+    LmPack *const pack = LmPack_Get();
+    const i32 texelCount = pack->lmCount * pack->lmSize * pack->lmSize;
+    for (i32 i = 0; i < count; ++i)
+    {
+        if ((texels[i] < 0) || (texels[i] >= texelCount))
+        {
+            return false;
+        }
+    }
+
+    PtScene_Update(scene);
+
+    const u64 start = Time_Now();
+    LmPack_BakeTexels(scene, texels, count, spp);
+    const double micros = Time_Micro(Time_Now() - start);
+
+    const i32 bytes = sizeof(LmTexelState) * count;
+    LmTexelState* states = Tex_Alloc(bytes);
+    LmPack_TakeTexels(pack, texels, count, states);
+    bool sent = SendMsg(ms_coordinator, LmMsg_Texels, (i32)f1_min((float)micros, 1e9f), states, bytes);
+    Mem_Free(states);
+    return sent;
+}
+
+ProfileMark(pm_Work, LmDist_Work)
+bool LmDist_Work(PtScene* scene)
+{
+    ASSERT(scene);
+    if (!Socket_IsOpen(ms_coordinator))
+    {
+        return false;
+    }
+    ProfileBegin(pm_Work);
+
+    // a bake sends each texel of the pack at most once
+    const LmPack* pack = LmPack_Get();
+    i32 maxBytes[LmMsg_COUNT] = { 0 };
+    maxBytes[LmMsg_Layout] = LmPack_LayoutBytes();
+    maxBytes[LmMsg_Bake] = sizeof(i32) * pack->lmCount * pack->lmSize * pack->lmSize;
+
+    bool working = false;
+    LmMsgHeader hdr = { 0 };
+    u8* payload = NULL;
+    if (RecvMsg(ms_coordinator, &hdr, &payload, maxBytes, 0, 0))
+    {
+        switch (hdr.type)
+        {
+        default:
+            break;
+        case LmMsg_Layout:
+        {
+            const bool loaded = LmPack_LoadLayout(LmPack_Get(), payload, hdr.bytes);
+            if (!loaded)
+            {
+                Con_Logf(LogSev_Error, "lm", "Coordinator's lightmap layout does not match the scene");
+            }
+            working = SendMsg(ms_coordinator, LmMsg_Ready, loaded ? 1 : 0, NULL, 0) && loaded;
+        }
+        break;
+        case LmMsg_Bake:
+            working =
+                (LmPack_Get()->lmCount > 0) &&
+                WorkBake(scene, i1_max(1, hdr.arg), (const i32*)payload, hdr.bytes / (i32)sizeof(i32));
+            break;
+        case LmMsg_Bye:
+            Con_Logf(LogSev_Info, "lm", "Released by the lightmap coordinator");
+            break;
+        }
+    }
+    Mem_Free(payload);
+
+    if (!working)
+    {
+        Socket_Close(&ms_coordinator);
+    }
+
+    ProfileEnd(pm_Work);
+    return working;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common/macro.h"
+
+PIM_C_BEGIN
+
+// distributed lightmap baking over tcp.
+// the coordinator packs the lightmaps and hands each worker a contiguous
+// run of every bake slice, sized by the worker's measured throughput.
+// workers load the same map, rebuild the pack from the coordinator's layout,
+// and return their texels' accumulations, which the coordinator merges.
+
+#define kLmDistMaxWorkers   64
+
+typedef struct PtScene_s PtScene;
+
+// listens on port and blocks until workerCount workers have joined, then
+// sends each the current pack's layout. returns the number of workers ready.
+i32 LmDist_Serve(u16 port, i32 workerCount);
+// LmPack_Bake, with the slice shared among the joined workers.
+// workers that disconnect are dropped, and their texels rescheduled.
+float LmDist_Bake(PtScene* scene, float timeSlice, i32 spp, float maxError);
+// releases the workers and stops listening
+void LmDist_Shutdown(void);
+
+// connects to a coordinator at "host:port"
+bool LmDist_Join(const char* address);
+// serves one request from the coordinator.
+// returns false once released or disconnected.
+bool LmDist_Work(PtScene* scene);
+
+PIM_C_END
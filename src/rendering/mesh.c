@@ -44,7 +44,10 @@ static bool IsCurrent(MeshId id)
 
 static void FreeMesh(Mesh *const mesh)
 {
-    vkrMesh_Del(mesh->id);
+    if (vkrSys_Active())
+    {
+        vkrMesh_Del(mesh->id);
+    }
     Mem_Free(mesh->positions);
     Mem_Free(mesh->normals);
     Mem_Free(mesh->uvs);
@@ -91,7 +94,7 @@ bool Mesh_New(Mesh *const mesh, Guid name, MeshId *const idOut)
     if (mesh->length > 0)
     {
         added = Table_Add(&ms_table, name, mesh, &id);
-        if (added)
+        if (added && vkrSys_Active())
         {
             vkrMeshId vkId = vkrMesh_New(mesh->length, mesh->positions, mesh->normals, mesh->uvs, mesh->texIndices);
             Mesh* pim_noalias meshes = ms_table.values;
@@ -169,7 +172,7 @@ Box3D Mesh_CalcBounds(MeshId id)
 bool Mesh_Upload(MeshId id)
 {
     Mesh* mesh = Mesh_Get(id);
-    if (mesh)
+    if (mesh && vkrSys_Active())
     {
         return vkrMesh_Upload(mesh->id, mesh->length, mesh->positions, mesh->normals, mesh->uvs, mesh->texIndices);
     }
@@ -5,7 +5,10 @@
 #include "rendering/drawable.h"
 #include "rendering/material.h"
 #include "rendering/cubemap.h"
+#include "rendering/lightmap.h"
 #include "rendering/librtc.h"
+#include "rendering/texture.h"
+#include "rendering/vulkan/vkr_texture.h"
 
 #include "math/float2_funcs.h"
 #include "math/float4_funcs.h"
@@ -20,11 +23,14 @@
 #include "math/frustum.h"
 #include "math/color.h"
 #include "math/lighting.h"
+#include "math/sphgauss.h"
 #include "math/atmosphere.h"
 #include "math/box.h"
 #include "math/markov_sampler.h"
+#include "math/atomic_float.h"
 
 #include "allocator/allocator.h"
+#include "containers/dict.h"
 #include "threading/task.h"
 #include "common/profiler.h"
 #include "common/console.h"
@@ -33,6 +39,8 @@
 #include "common/serialize.h"
 #include "common/atomics.h"
 #include "common/time.h"
+#include "common/fnv1a.h"
+#include "assets/crate.h"
 #include "ui/cimgui_ext.h"
 
 #include "stb/stb_perlin_fork.h"
@@ -117,8 +125,42 @@ typedef struct PtMedia_s
     float g0, g1, gBlend;
 } PtMedia;
 
+// walks a ray through the media grid, yielding segments of constant majorant
+typedef struct PtMediaWalk_s
+{
+    const float* pim_noalias majorants;
+    int3 size;
+    int3 cell;
+    int3 step;
+    float4 tNext;
+    float4 tDelta;
+    // start of the next segment
+    float t;
+    // [tEnter, tExit) lies within the grid
+    float tEnter;
+    float tExit;
+    float rayLen;
+    // majorant outside of the grid
+    float majorant;
+} PtMediaWalk;
+
 typedef struct RTCSceneTy* RTCScene;
 
+// per triangle shading data, two records per cache line
+typedef struct PtTriangle_s
+{
+    // octahedral vertex normals
+    short2 normals[3];
+    // half float texture coordinates,
+    // offset by an integer to stay near the origin (textures wrap)
+    ushort2 uvs[3];
+    // material index
+    i32 matId;
+    // emissive index, or -1
+    i32 emitId;
+} PtTriangle;
+SASSERT(sizeof(PtTriangle) == 32);
+
 typedef struct PtScene_s
 {
     RTCScene rtcScene;
@@ -128,18 +170,9 @@ typedef struct PtScene_s
     //   w: 1
     // [vertCount]
     float4* pim_noalias positions;
-    // xyz: vertex normal
-    // [vertCount]
-    float4* pim_noalias normals;
-    //  xy: texture coordinate
-    // [vertCount]
-    float2* pim_noalias uvs;
-    // material indices
-    // [vertCount]
-    i32* pim_noalias matIds;
-    // emissive index
-    // [vertCount]
-    i32* pim_noalias vertToEmit;
+    // shading data
+    // [vertCount / 3]
+    PtTriangle* pim_noalias triangles;
 
     // emissive triangle indices
     // [emissiveCount]
@@ -149,12 +182,25 @@ typedef struct PtScene_s
     Grid lightGrid;
     // [lightGrid.size]
     Dist1D* pim_noalias lightDists;
+    // nonzero once the matching lightDists entry has been published
+    // [lightGrid.size]
+    i32* pim_noalias lightReady;
+    // uniform over emitters, used by cells that are not yet published
+    Dist1D lightUniform;
+    // asynchronous light grid build, NULL once complete
+    struct task_SetupLightGrid_s* lightTask;
 
-    // surface description, indexed by matIds
+    // surface description, indexed by PtTriangle.matId
     // [matCount]
     Material* pim_noalias materials;
 
     Cubemap* pim_noalias sky;
+    // sky luminance over a [skySize, skySize] grid on each cube face
+    // [Cubeface_COUNT * skySize * skySize]
+    Dist1D skyDist;
+    i32 skySize;
+    // ms_skyVersion that skyDist was built from
+    u32 skyVersion;
 
     // array lengths
     i32 vertCount;
@@ -162,41 +208,193 @@ typedef struct PtScene_s
     i32 emissiveCount;
     // parameters
     PtMediaDesc mediaDesc;
+    // coarse upper bounds of media extinction over the scene bounds
+    Grid mediaGrid;
+    // [mediaGrid.size]
+    float* pim_noalias mediaMajorants;
+    // hash of the mediaDesc that mediaMajorants was built from
+    u64 mediaHash;
+
+    // baked lighting that paths may terminate on, see cv_pt_cache_bounce
+    // lightmap coordinates
+    // [vertCount]
+    float2* pim_noalias lmUvs;
+    // lightmap index, or -1
+    // [vertCount / 3]
+    i32* pim_noalias lmIndices;
+    // LmPack lightmaps that lmIndices refers to
+    const Lightmap* lmSource;
+    i32 lmCount;
     u64 modtime;
 } PtScene;
 
+// emissive classification is cached per mesh and rome texture,
+// since it only depends on the mesh's uvs and the texture's emission channel.
+// edits to either are caught by the entry's content hash.
+typedef struct PtEmitKey_s
+{
+    MeshId mesh;
+    TextureId rome;
+} PtEmitKey;
+
+typedef struct PtEmitEntry_s
+{
+    // fraction of each triangle's texels that emit
+    // [triCount]
+    float* pim_noalias pdfs;
+    i32 triCount;
+    // EmitContentHash of the mesh and texture the pdfs were computed from
+    u64 content;
+} PtEmitEntry;
+
+typedef struct PtEmitJob_s
+{
+    const Mesh* pim_noalias mesh;
+    const Texture* pim_noalias rome;
+    float* pim_noalias pdfs;
+    i32 workBegin;
+} PtEmitJob;
+
+// texel budget when rasterizing one triangle's uv footprint
+#define kEmitMaxTexels          (1 << 18)
+// light grid cells per cluster axis
+#define kLightClusterCells      4
+// shadow rays per visibility estimate
+#define kLightRays              16
+// least visibility of an emitter whose estimate missed with every ray
+#define kLightVisFloor          (0.25f / kLightRays)
+// media grid cells along the longest axis of the scene bounds
+#define kMediaGridCells         32
+// paths ending on the cache read the convolved cubemap below this roughness,
+// and the lightmap's spherical gaussians above it
+#define kCacheGlossRoughness    0.5f
+
+#define kCacheLine 64
+
+// one per thread, each on its own cache lines so the stats counters
+// of neighbouring threads do not false share
 typedef struct PtContext_s
 {
+    pim_alignas(kCacheLine)
     Prng rng;
+    // when set, primary samples are drawn from this chain's mutated state
+    MarkovSampler* markov;
+    // bounce at which paths terminate on baked lighting, 0 when disabled.
+    // only camera paths set this; the bakers must not read their own output.
+    i32 cacheBounce;
+    PtStats stats;
 } PtContext;
+SASSERT((sizeof(PtContext) % kCacheLine) == 0);
+
+// primary sample space metropolis light transport
+// http://www.cs.jhu.edu/~misha/ReadingSeminar/Papers/Kelemen02.pdf
+typedef struct PtMltChain_s
+{
+    MarkovSampler sampler;
+    PtResult current;
+    float currentLum;
+    i32 iPixel;
+    float bootstrapSum;
+} PtMltChain;
+
+typedef struct PtMlt_s
+{
+    PtMltChain* pim_noalias chains;
+    float3* pim_noalias splatColor;
+    float3* pim_noalias splatAlbedo;
+    float3* pim_noalias splatNormal;
+    float* pim_noalias splatWeight;
+    // rays and bounces traced for proposals at each pixel
+    float2* pim_noalias splatHeat;
+    i32 chainCount;
+    i32 texelCount;
+    // mean luminance of the bootstrap paths, the normalization constant
+    float bootstrap;
+} PtMlt;
+
+// primary sample dimensions tracked per chain; deeper paths fall back to prng
+#define kMltSampleCount         256
+#define kMltChainsPerThread     64
+#define kMltBootstrapPerChain   64
+#define kMltLargeStepProb       0.3f
+#define kMltSigma               (1.0f / 64.0f)
+
+#define kPtSceneVersion 2
+// crate blob sizes are i32
+#define kMaxLitPdfBytes 0x7fffffffll
+typedef struct DiskPtScene_s
+{
+    i32 version;
+    i32 vertCount;
+    i32 emissiveCount;
+    // number of light grid cells with a distribution
+    i32 litCount;
+    // PtScene_Hash of the entities the data was derived from
+    u64 hash;
+    Grid lightGrid;
+} DiskPtScene;
+
+typedef struct PtSceneStaged_s
+{
+    u64 hash;
+    float4* pim_noalias positions;
+    PtTriangle* pim_noalias triangles;
+    i32* pim_noalias emitToVert;
+    Grid lightGrid;
+    // [litCount]
+    i32* pim_noalias litCells;
+    // [litCount * emissiveCount]
+    float* pim_noalias litPdfs;
+    i32 vertCount;
+    i32 emissiveCount;
+    i32 litCount;
+} PtSceneStaged;
 
 // ----------------------------------------------------------------------------
 
 static RTCDevice ms_device;
 static PtContext ms_contexts[kMaxThreads];
+static PtStats ms_prevStats;
+static PtStats ms_frameStats;
+// bumped whenever the sky cubemap is rebaked
+static u32 ms_skyVersion = 1;
+// per triangle emissive fractions, keyed by PtEmitKey
+static Dict ms_emitCache;
+// derived scene data loaded from a crate, waiting for a matching build
+static PtSceneStaged ms_staged;
 
 // ----------------------------------------------------------------------------
 
 static void PtScene_Init(PtScene* scene);
 static void PtScene_Clear(PtScene* scene);
+static bool PtScene_AdoptStaged(PtScene* pim_noalias scene);
+static void PtSceneStaged_Del(PtSceneStaged* staged);
 static void OnRtcError(void* user, RTCError error, const char* msg);
 static bool InitRTC(void);
 static RTCScene RtcNewScene(const PtScene* pim_noalias scene);
+static void RtcCommitScene(RTCScene rtcScene);
 static void FlattenDrawables(PtScene* pim_noalias scene);
 static float EmissionPdf(
-    const PtScene* pim_noalias scene,
-    i32 iVert,
-    i32 attempts);
+    const Texture* pim_noalias romeMap,
+    float2 UA,
+    float2 UB,
+    float2 UC);
 static void CalcEmissionPdfFn(void* pbase, i32 begin, i32 end);
 static void SetupEmissives(PtScene* pim_noalias scene);
 static void SetupLightGridFn(void* pbase, i32 begin, i32 end);
 static void SetupLightGrid(PtScene* pim_noalias scene);
+static void LightGridTask_Del(struct task_SetupLightGrid_s* task);
 
 static void media_desc_new(PtMediaDesc* desc);
 static void media_desc_update(PtMediaDesc* desc);
 static void media_desc_gui(PtMediaDesc* desc);
 static void media_desc_load(PtMediaDesc* desc, const char* name);
 static void media_desc_save(const PtMediaDesc* desc, const char* name);
+static u64 media_desc_hash(const PtMediaDesc* desc);
+static u64 HashTexture(const Texture* tex, u64 hash);
+static void SetupMediaGridFn(void* pbase, i32 begin, i32 end);
+static void SetupMediaGrid(PtScene* pim_noalias scene);
+static void SetupLmCache(PtScene* pim_noalias scene);
 
 // ----------------------------------------------------------------------------
 
@@ -213,6 +411,9 @@ pim_inline float4 VEC_CALL GetPosition(
 pim_inline float4 VEC_CALL GetNormal(
     const PtScene* pim_noalias scene,
     PtRayHit hit);
+pim_inline float2 VEC_CALL GetTriUV(
+    const PtTriangle* pim_noalias tri,
+    i32 i);
 pim_inline float2 VEC_CALL GetUV(
     const PtScene* pim_noalias scene,
     PtRayHit hit);
@@ -226,6 +427,12 @@ pim_inline float4 VEC_CALL GetSky(
     const PtScene* pim_noalias scene,
     float4 ro,
     float4 rd);
+pim_inline float VEC_CALL SkyPdf(
+    const PtScene* pim_noalias scene,
+    float4 rd);
+pim_inline float4 VEC_CALL SampleSkyDir(
+    PtContext* pim_noalias ctx,
+    const PtScene* pim_noalias scene);
 pim_inline float4 VEC_CALL GetEmission(
     const PtScene* pim_noalias scene,
     float4 ro,
@@ -236,7 +443,8 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     const PtScene* pim_noalias scene,
     float4 ro,
     float4 rd,
-    PtRayHit hit);
+    PtRayHit hit,
+    float coneWidth);
 pim_inline PtRayHit VEC_CALL pt_intersect_local(
     const PtScene* pim_noalias scene,
     float4 ro,
@@ -292,10 +500,13 @@ pim_inline PtScatter VEC_CALL Scatter_Principled(
 
 // ----------------------------------------------------------------------------
 
+pim_inline const Dist1D* VEC_CALL GetLightDist(
+    const PtScene* pim_noalias scene,
+    float4 position);
 pim_inline bool VEC_CALL LightSelect(
     PtContext* pim_noalias ctx,
     PtScene* pim_noalias scene,
-    float4 position,
+    const Dist1D* pim_noalias lights,
     i32* iVertOut,
     float* pdfOut);
 pim_inline PtLightSample VEC_CALL SampleLight(
@@ -306,8 +517,8 @@ pim_inline PtLightSample VEC_CALL SampleLight(
     i32 bounce);
 pim_inline float VEC_CALL LightSelectPdf(
     PtScene* pim_noalias scene,
-    i32 iVert,
-    float4 ro);
+    const Dist1D* pim_noalias lights,
+    i32 iVert);
 pim_inline float VEC_CALL LightEvalPdf(
     PtScene* pim_noalias scene,
     float4 ro,
@@ -334,8 +545,20 @@ pim_inline bool VEC_CALL EvaluateLight(
 // ----------------------------------------------------------------------------
 
 pim_inline float4 VEC_CALL MeanFreePathToMu(float4 albedo);
+pim_inline float VEC_CALL Media_Density(const PtMediaDesc* pim_noalias desc, float4 P);
 pim_inline PtMedia VEC_CALL Media_Sample(const PtMediaDesc* pim_noalias desc, float4 P);
 pim_inline float4 VEC_CALL CalcMajorant(const PtMediaDesc* pim_noalias desc);
+pim_inline void VEC_CALL MediaWalk_New(
+    PtMediaWalk* pim_noalias walk,
+    const PtScene* pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float rayLen);
+pim_inline bool VEC_CALL MediaWalk_Next(
+    PtMediaWalk* pim_noalias walk,
+    float* pim_noalias tBegin,
+    float* pim_noalias tEnd,
+    float* pim_noalias majorant);
 pim_inline float VEC_CALL CalcPhase(
     PtMedia media,
     float cosTheta);
@@ -360,12 +583,24 @@ pim_inline PtScatter VEC_CALL ScatterRay(
 
 // ----------------------------------------------------------------------------
 
+pim_inline bool VEC_CALL CacheLookup(
+    const PtScene* pim_noalias scene,
+    const PtSurfHit* pim_noalias surf,
+    PtRayHit hit,
+    float4 rd,
+    float4* pim_noalias lumOut);
 pim_inline void VEC_CALL LightOnHit(
     PtScene* pim_noalias scene,
     float4 ro,
     float4 lum,
     i32 iVert);
 static void UpdateDists(PtScene* pim_noalias scene);
+static void PtMlt_Del(PtMlt* mlt);
+static void Pt_TraceMlt(
+    PtTrace* pim_noalias trace,
+    PtDofInfo* pim_noalias dof,
+    PtScene* pim_noalias scene,
+    const Camera* pim_noalias camera);
 
 // ----------------------------------------------------------------------------
 
@@ -376,11 +611,23 @@ pim_inline PtContext* VEC_CALL PtContext_Get(void)
 
 pim_inline float VEC_CALL Sample1D(PtContext* pim_noalias ctx)
 {
+    MarkovSampler* pim_noalias markov = ctx->markov;
+    if (markov && (markov->iSample < markov->sampleCount))
+    {
+        return MarkovSampler_Sample1D(markov, kMltSigma);
+    }
     return Prng_f32(&ctx->rng);
 }
 
 pim_inline float2 VEC_CALL Sample2D(PtContext* pim_noalias ctx)
 {
+    if (ctx->markov)
+    {
+        float2 Xi;
+        Xi.x = Sample1D(ctx);
+        Xi.y = Sample1D(ctx);
+        return Xi;
+    }
     return Prng_float2(&ctx->rng);
 }
 
@@ -397,7 +644,12 @@ static void OnRtcError(void* user, RTCError error, const char* msg)
 
 static bool InitRTC(void)
 {
-    ms_device = rtcNewDevice(NULL);
+    // builds run on the task system's threads, which join the commit.
+    // they are not pinned, so neither are embree's.
+    const i32 threadCount = Task_ThreadCount();
+    char config[PIM_PATH];
+    SPrintf(ARGS(config), "threads=%d,user_threads=%d,set_affinity=0", threadCount, threadCount);
+    ms_device = rtcNewDevice(config);
     if (!ms_device)
     {
         OnRtcError(NULL, rtcGetDeviceError(NULL), "Failed to create device");
@@ -421,6 +673,7 @@ static void PtContext_Del(PtContext* ctx)
 void PtSys_Init(void)
 {
     InitRTC();
+    Dict_New(&ms_emitCache, sizeof(PtEmitKey), sizeof(PtEmitEntry), EAlloc_Perm);
     for (i32 i = 0; i < NELEM(ms_contexts); ++i)
     {
         PtContext_New(&ms_contexts[i]);
@@ -429,7 +682,94 @@ void PtSys_Init(void)
 
 void PtSys_Update(void)
 {
+    PtStats stats;
+    PtSys_GetStats(&stats);
+    u64* pim_noalias frame = (u64*)&ms_frameStats;
+    u64 const *const pim_noalias cur = (u64*)&stats;
+    u64 const *const pim_noalias prev = (u64*)&ms_prevStats;
+    for (i32 i = 0; i < sizeof(PtStats) / sizeof(u64); ++i)
+    {
+        frame[i] = cur[i] - prev[i];
+    }
+    ms_prevStats = stats;
+
+    const PtStats* fs = &ms_frameStats;
+    const double rcpPaths = 1.0 / (fs->paths ? fs->paths : 1);
+    ProfileCounter("pt rays", (double)fs->rays);
+    ProfileCounter("pt rays per path", fs->rays * rcpPaths);
+    ProfileCounter("pt bounces per path", fs->bounces * rcpPaths);
+    ProfileCounter("pt light sample hit rate",
+        fs->lightHits / (double)(fs->lightSamples ? fs->lightSamples : 1));
+    ProfileCounter("pt cache hits per path", fs->cacheHits * rcpPaths);
+}
+
+void PtSys_Seed(u32 seed)
+{
+    for (i32 i = 0; i < NELEM(ms_contexts); ++i)
+    {
+        Prng* rng = &ms_contexts[i].rng;
+        rng->state.x = seed;
+        rng->state.y = (u32)i;
+        rng->state.z = 0x9E3779B9u;
+        rng->state.w = seed ^ 0x85EBCA6Bu;
+        Prng_Next4(rng);
+    }
+}
+
+u64 PtSys_RayCount(void)
+{
+    u64 sum = 0;
+    for (i32 i = 0; i < NELEM(ms_contexts); ++i)
+    {
+        sum += ms_contexts[i].stats.rays;
+    }
+    return sum;
+}
+
+void PtSys_GetStats(PtStats* dst)
+{
+    ASSERT(dst);
+    memset(dst, 0, sizeof(*dst));
+    u64* pim_noalias sum = (u64*)dst;
+    for (i32 t = 0; t < NELEM(ms_contexts); ++t)
+    {
+        u64 const *const pim_noalias src = (u64*)&ms_contexts[t].stats;
+        for (i32 i = 0; i < sizeof(PtStats) / sizeof(u64); ++i)
+        {
+            sum[i] += src[i];
+        }
+    }
+}
+
+void PtSys_GetFrameStats(PtStats* dst)
+{
+    ASSERT(dst);
+    *dst = ms_frameStats;
+}
+
+void PtSys_MarkSkyDirty(void)
+{
+    ++ms_skyVersion;
+}
+
+static void ClearEmitCache(void)
+{
+    const u32 width = Dict_GetWidth(&ms_emitCache);
+    for (u32 i = 0; i < width; ++i)
+    {
+        PtEmitEntry entry;
+        if (Dict_GetValueAt(&ms_emitCache, i, &entry))
+        {
+            Mem_Free(entry.pdfs);
+        }
+    }
+    Dict_Clear(&ms_emitCache);
+}
 
+void PtSys_ClearCaches(void)
+{
+    ClearEmitCache();
+    PtSceneStaged_Del(&ms_staged);
 }
 
 void PtSys_Shutdown(void)
@@ -438,6 +778,9 @@ void PtSys_Shutdown(void)
     {
         PtContext_Del(&ms_contexts[i]);
     }
+    ClearEmitCache();
+    Dict_Del(&ms_emitCache);
+    PtSceneStaged_Del(&ms_staged);
     if (ms_device)
     {
         rtcReleaseDevice(ms_device);
@@ -615,6 +958,31 @@ pim_inline PointQueryUserData VEC_CALL RtcPointQuery(
     return usr;
 }
 
+typedef struct task_CommitScene_s
+{
+    Task task;
+    RTCScene rtcScene;
+} task_CommitScene;
+
+static void CommitSceneFn(void* pbase, i32 begin, i32 end)
+{
+    task_CommitScene* task = pbase;
+    // returns immediately once the build has completed
+    rtcJoinCommitScene(task->rtcScene);
+}
+
+ProfileMark(pm_commitscene, RtcCommitScene)
+static void RtcCommitScene(RTCScene rtcScene)
+{
+    ProfileBegin(pm_commitscene);
+
+    task_CommitScene* task = Temp_Calloc(sizeof(*task));
+    task->rtcScene = rtcScene;
+    Task_Run(&task->task, CommitSceneFn, Task_ThreadCount());
+
+    ProfileEnd(pm_commitscene);
+}
+
 static RTCScene RtcNewScene(const PtScene* pim_noalias scene)
 {
     RTCScene rtcScene = rtcNewScene(ms_device);
@@ -684,7 +1052,7 @@ static RTCScene RtcNewScene(const PtScene* pim_noalias scene)
     rtcReleaseGeometry(geom);
     geom = NULL;
 
-    rtcCommitScene(rtcScene);
+    RtcCommitScene(rtcScene);
 
     return rtcScene;
 }
@@ -713,9 +1081,7 @@ static void FlattenDrawables(
 
     i32 vertCount = 0;
     float4* positions = Perm_Calloc(sizeof(positions[0]) * vertCap);
-    float4* normals = Perm_Calloc(sizeof(normals[0]) * vertCap);
-    float2* uvs = Perm_Calloc(sizeof(uvs[0]) * vertCap);
-    i32* matIds = Perm_Calloc(sizeof(matIds[0]) * vertCap);
+    PtTriangle* triangles = Perm_Calloc(sizeof(triangles[0]) * (vertCap / 3));
 
     i32 matCount = 0;
     Material* sceneMats = Perm_Calloc(sizeof(sceneMats[0]) * matCap);
@@ -747,147 +1113,410 @@ static void FlattenDrawables(
             positions[vertBack + j] = f4x4_mul_pt(M, meshPositions[j]);
         }
 
-        for (i32 j = 0; j < meshLen; ++j)
-        {
-            normals[vertBack + j] = f4_normalize3(f3x3_mul_col(IM, meshNormals[j]));
-        }
-
         for (i32 j = 0; (j + 3) <= meshLen; j += 3)
         {
-            float4 uva = meshUvs[j + 0];
-            float4 uvb = meshUvs[j + 1];
-            float4 uvc = meshUvs[j + 2];
-            float2 UA = f2_v(uva.x, uva.y);
-            float2 UB = f2_v(uvb.x, uvb.y);
-            float2 UC = f2_v(uvc.x, uvc.y);
-            uvs[vertBack + j + 0] = UA;
-            uvs[vertBack + j + 1] = UB;
-            uvs[vertBack + j + 2] = UC;
-        }
-
-        for (i32 j = 0; j < meshLen; ++j)
-        {
-            matIds[vertBack + j] = matBack;
+            PtTriangle* pim_noalias tri = &triangles[(vertBack + j) / 3];
+            tri->matId = matBack;
+            tri->emitId = -1;
+            const float2 origin = f2_floor(f4_f2(meshUvs[j]));
+            for (i32 k = 0; k < 3; ++k)
+            {
+                float4 N = f4_normalize3(f3x3_mul_col(IM, meshNormals[j + k]));
+                tri->normals[k] = NormalToOct16(N);
+                float2 uv = f2_sub(f4_f2(meshUvs[j + k]), origin);
+                tri->uvs[k].x = f1_half(uv.x);
+                tri->uvs[k].y = f1_half(uv.y);
+            }
         }
     }
 
     scene->vertCount = vertCount;
     scene->positions = positions;
-    scene->normals = normals;
-    scene->uvs = uvs;
-    scene->matIds = matIds;
+    scene->triangles = triangles;
 
     scene->matCount = matCount;
     scene->materials = sceneMats;
 }
 
-static float EmissionPdf(
-    const PtScene* pim_noalias scene,
-    i32 iVert,
-    i32 attempts)
+pim_inline i32 VEC_CALL WrapTexel(i32 x, i32 size)
+{
+    x %= size;
+    return (x < 0) ? (x + size) : x;
+}
+
+pim_inline float VEC_CALL EdgeFn(float2 a, float2 b, float2 p)
 {
-    const i32 iMat = scene->matIds[iVert];
-    const Material* mat = scene->materials + iMat;
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
 
-    if (mat->flags & MatFlag_Sky)
+// rasterizes the triangle's uv footprint over the texel centers of the
+// rome texture, returning the fraction of covered texels that emit.
+static float EmissionPdf(
+    const Texture* pim_noalias romeMap,
+    float2 UA,
+    float2 UB,
+    float2 UC)
+{
+    u32 const *const pim_noalias texels = romeMap->texels;
+    const int2 size = romeMap->size;
+    const float2 fsize = i2_f2(size);
+    const float2 A = f2_mul(UA, fsize);
+    const float2 B = f2_mul(UB, fsize);
+    const float2 C = f2_mul(UC, fsize);
+    const float2 lo = f2_min(A, f2_min(B, C));
+    const float2 hi = f2_max(A, f2_max(B, C));
+    const i32 x0 = (i32)f1_floor(lo.x);
+    const i32 y0 = (i32)f1_floor(lo.y);
+    const i32 x1 = (i32)f1_ceil(hi.x);
+    const i32 y1 = (i32)f1_ceil(hi.y);
+    const float sign = (EdgeFn(A, B, C) < 0.0f) ? -1.0f : 1.0f;
+
+    // very large footprints are visited on a coarser regular grid
+    i32 stride = 1;
+    const i64 extent = (i64)(x1 - x0) * (i64)(y1 - y0);
+    while ((extent / ((i64)stride * stride)) > kEmitMaxTexels)
     {
-        return 1.0f;
+        stride *= 2;
     }
 
-    const Texture* pim_noalias romeMap = Texture_Get(mat->rome);
-    if (!romeMap)
+    i32 hits = 0;
+    i32 count = 0;
+    for (i32 y = y0; y < y1; y += stride)
     {
-        return 0.0f;
+        const i32 iRow = WrapTexel(y, size.y) * size.x;
+        for (i32 x = x0; x < x1; x += stride)
+        {
+            const float2 P = { x + 0.5f, y + 0.5f };
+            bool inside =
+                (sign * EdgeFn(A, B, P) >= 0.0f) &&
+                (sign * EdgeFn(B, C, P) >= 0.0f) &&
+                (sign * EdgeFn(C, A, P) >= 0.0f);
+            if (inside)
+            {
+                u32 e = texels[iRow + WrapTexel(x, size.x)] >> 24;
+                hits += e ? 1 : 0;
+                ++count;
+            }
+        }
     }
-    u32 const *const pim_noalias texels = romeMap->texels;
-    const int2 texSize = romeMap->size;
-
-    const float2* pim_noalias uvs = scene->uvs;
-    const float2 UA = uvs[iVert + 0];
-    const float2 UB = uvs[iVert + 1];
-    const float2 UC = uvs[iVert + 2];
 
-    Prng* pim_noalias rng = Prng_Get();
-    i32 hits = 0;
-    for (i32 i = 0; i < attempts; ++i)
+    if (count == 0)
     {
-        float4 wuv = SampleBaryCoord(Prng_float2(rng));
-        float2 uv = f2_blend(UA, UB, UC, wuv);
-        int2 coord = PointWrap2D(texSize, uv);
-        i32 iTexel = DecodeCoord2(texSize, coord);
-        u32 sample = texels[iTexel] >> 24;
-        hits += sample ? 1 : 0;
+        // smaller than a texel, point sample the centroid
+        float2 P = f2_mulvs(f2_add(A, f2_add(B, C)), 1.0f / 3.0f);
+        i32 x = WrapTexel((i32)f1_floor(P.x), size.x);
+        i32 y = WrapTexel((i32)f1_floor(P.y), size.y);
+        return (texels[y * size.x + x] >> 24) ? 1.0f : 0.0f;
     }
-    return (float)hits / (float)attempts;
+    return (float)hits / (float)count;
 }
 
 typedef struct task_CalcEmissionPdf
 {
     Task task;
-    const PtScene* scene;
-    float* pdfs;
-    i32 attempts;
+    const PtEmitJob* pim_noalias jobs;
+    i32 jobCount;
 } task_CalcEmissionPdf;
 
 static void CalcEmissionPdfFn(void* pbase, i32 begin, i32 end)
 {
     task_CalcEmissionPdf* task = (task_CalcEmissionPdf*)pbase;
-    const PtScene*const pim_noalias scene = task->scene;
-    const i32 attempts = task->attempts;
-    float* pim_noalias pdfs = task->pdfs;
+    const PtEmitJob* pim_noalias jobs = task->jobs;
+    const i32 jobCount = task->jobCount;
 
+    i32 iJob = 0;
+    while (((iJob + 1) < jobCount) && (jobs[iJob + 1].workBegin <= begin))
+    {
+        ++iJob;
+    }
     for (i32 i = begin; i < end; ++i)
     {
-        pdfs[i] = EmissionPdf(scene, i * 3, attempts);
+        while (((iJob + 1) < jobCount) && (jobs[iJob + 1].workBegin <= i))
+        {
+            ++iJob;
+        }
+        const PtEmitJob job = jobs[iJob];
+        const i32 iTri = i - job.workBegin;
+        const float4* pim_noalias uvs = job.mesh->uvs + iTri * 3;
+        job.pdfs[iTri] = EmissionPdf(
+            job.rome,
+            f4_f2(uvs[0]),
+            f4_f2(uvs[1]),
+            f4_f2(uvs[2]));
+    }
+}
+
+// hashes only what EmissionPdf reads: the first uv set and the texels
+static u64 EmitContentHash(const Mesh* mesh, const Texture* rome)
+{
+    u64 hash = Fnv64Bias;
+    const i32 len = mesh->length;
+    hash = Fnv64Dword(len, hash);
+    const float4* pim_noalias uvs = mesh->uvs;
+    for (i32 i = 0; i < len; ++i)
+    {
+        hash = Fnv64Bytes(&uvs[i], sizeof(float) * 2, hash);
+    }
+    return HashTexture(rome, hash);
+}
+
+// drops cached entries whose mesh or texture has been released
+static void EvictEmitCache(void)
+{
+    Dict* cache = &ms_emitCache;
+    const u32 width = Dict_GetWidth(cache);
+    for (u32 i = 0; i < width; ++i)
+    {
+        PtEmitKey key;
+        PtEmitEntry entry;
+        if (Dict_GetAt(cache, i, &key, &entry))
+        {
+            if (!Mesh_Exists(key.mesh) || !Texture_Exists(key.rome))
+            {
+                Mem_Free(entry.pdfs);
+                Dict_RmAt(cache, i, NULL);
+            }
+        }
     }
 }
 
+ProfileMark(pm_setupemissives, SetupEmissives)
 static void SetupEmissives(PtScene* pim_noalias scene)
 {
-    const i32 vertCount = scene->vertCount;
-    const i32 triCount = vertCount / 3;
+    ProfileBegin(pm_setupemissives);
 
-    task_CalcEmissionPdf* task = Temp_Calloc(sizeof(*task));
-    task->scene = scene;
-    task->pdfs = Temp_Alloc(sizeof(task->pdfs[0]) * triCount);
-    task->attempts = 1000;
+    // walks drawables in the same order as FlattenDrawables,
+    // each one owns a material and a contiguous range of triangles.
+    const Entities* drawTable = Entities_Get();
+    const i32 drawCount = drawTable->count;
+    const MeshId* pim_noalias meshes = drawTable->meshes;
+    const Material* pim_noalias materials = drawTable->materials;
+
+    EvictEmitCache();
+
+    i32 jobCount = 0;
+    i32 workCount = 0;
+    PtEmitJob* jobs = NULL;
+    for (i32 i = 0; i < drawCount; ++i)
+    {
+        const Mesh* pim_noalias mesh = Mesh_Get(meshes[i]);
+        const Material* pim_noalias mat = &materials[i];
+        if (!mesh || (mat->flags & MatFlag_Sky))
+        {
+            continue;
+        }
+        const Texture* pim_noalias rome = Texture_Get(mat->rome);
+        if (!rome)
+        {
+            continue;
+        }
+        const PtEmitKey key = { meshes[i], mat->rome };
+        const u64 content = EmitContentHash(mesh, rome);
+        const i32 triCount = mesh->length / 3;
+        PtEmitEntry entry = { 0 };
+        if (Dict_Get(&ms_emitCache, &key, &entry))
+        {
+            if (entry.content == content)
+            {
+                continue;
+            }
+            // edited in place since it was cached, recompute into the entry
+            if (entry.triCount != triCount)
+            {
+                Mem_Free(entry.pdfs);
+                entry.pdfs = Perm_Calloc(sizeof(entry.pdfs[0]) * i1_max(triCount, 1));
+            }
+            entry.triCount = triCount;
+            entry.content = content;
+            Dict_Set(&ms_emitCache, &key, &entry);
+        }
+        else
+        {
+            entry.triCount = triCount;
+            entry.content = content;
+            entry.pdfs = Perm_Calloc(sizeof(entry.pdfs[0]) * i1_max(triCount, 1));
+            Dict_Add(&ms_emitCache, &key, &entry);
+        }
+
+        ++jobCount;
+        Temp_Reserve(jobs, jobCount);
+        PtEmitJob* job = &jobs[jobCount - 1];
+        job->mesh = mesh;
+        job->rome = rome;
+        job->pdfs = entry.pdfs;
+        job->workBegin = workCount;
+        workCount += triCount;
+    }
 
-    Task_Run(&task->task, CalcEmissionPdfFn, triCount);
+    if (workCount > 0)
+    {
+        task_CalcEmissionPdf* task = Temp_Calloc(sizeof(*task));
+        task->jobs = jobs;
+        task->jobCount = jobCount;
+        Task_Run(&task->task, CalcEmissionPdfFn, workCount);
+    }
 
     i32 emissiveCount = 0;
     i32* emitToVert = NULL;
-    i32* pim_noalias vertToEmit = Perm_Alloc(sizeof(vertToEmit[0]) * vertCount);
+    PtTriangle* pim_noalias triangles = scene->triangles;
 
-    const float* pim_noalias taskPdfs = task->pdfs;
-    for (i32 iTri = 0; iTri < triCount; ++iTri)
+    i32 triBack = 0;
+    for (i32 i = 0; i < drawCount; ++i)
     {
-        i32 iVert = iTri * 3;
-        vertToEmit[iVert + 0] = -1;
-        vertToEmit[iVert + 1] = -1;
-        vertToEmit[iVert + 2] = -1;
-        float pdf = taskPdfs[iTri];
-        if (pdf > 0.01f)
+        const Mesh* pim_noalias mesh = Mesh_Get(meshes[i]);
+        if (!mesh)
+        {
+            continue;
+        }
+        const Material* pim_noalias mat = &materials[i];
+        const i32 triCount = mesh->length / 3;
+
+        // sky brushes are sampled through the sky cubemap, see EstimateSky
+        const float* pim_noalias pdfs = NULL;
+        if (!(mat->flags & MatFlag_Sky))
+        {
+            const PtEmitKey key = { meshes[i], mat->rome };
+            PtEmitEntry entry;
+            if (Dict_Get(&ms_emitCache, &key, &entry))
+            {
+                ASSERT(entry.triCount == triCount);
+                pdfs = entry.pdfs;
+            }
+        }
+
+        for (i32 iTri = 0; iTri < triCount; ++iTri)
         {
-            vertToEmit[iVert + 0] = emissiveCount;
-            vertToEmit[iVert + 1] = emissiveCount;
-            vertToEmit[iVert + 2] = emissiveCount;
-            ++emissiveCount;
-            Perm_Reserve(emitToVert, emissiveCount);
-            emitToVert[emissiveCount - 1] = iVert;
+            PtTriangle* pim_noalias tri = &triangles[triBack + iTri];
+            tri->emitId = -1;
+            float pdf = pdfs ? pdfs[iTri] : 0.0f;
+            if (pdf > 0.01f)
+            {
+                tri->emitId = emissiveCount;
+                ++emissiveCount;
+                Perm_Reserve(emitToVert, emissiveCount);
+                emitToVert[emissiveCount - 1] = (triBack + iTri) * 3;
+            }
         }
+        triBack += triCount;
     }
+    ASSERT((triBack * 3) == scene->vertCount);
 
-    scene->vertToEmit = vertToEmit;
     scene->emissiveCount = emissiveCount;
     scene->emitToVert = emitToVert;
+
+    ProfileEnd(pm_setupemissives);
 }
 
-typedef struct task_SetupLightGrid
+typedef struct task_SetupLightGrid_s
 {
     Task task;
     PtScene* scene;
+    // grid of clusters, each kLightClusterCells^3 light grid cells
+    int3 clusterSize;
+    // emitters grouped by the cluster they lie in
+    // [emitClusterCount + 1], offsets into emitOrder
+    i32* pim_noalias emitClusterOffsets;
+    // [emissiveCount]
+    i32* pim_noalias emitOrder;
+    i32 emitClusterCount;
 } task_SetupLightGrid;
 
+// far from a surface, the cell might be inside or outside the map.
+// toss some rays and see if they are backfaces.
+static bool LightCellInside(
+    const PtScene* pim_noalias scene,
+    float4 position,
+    float radius,
+    const float4* pim_noalias hamm,
+    i32 hammCount)
+{
+    position.w = radius + 0.01f * kMilli;
+    PointQueryUserData query = RtcPointQuery(scene, position);
+    if (query.distance > radius)
+    {
+        float hitcount = 0.0f;
+        for (i32 j = 0; j < hammCount; ++j)
+        {
+            PtRayHit hit = pt_intersect_local(scene, position, hamm[j], 0.0f, kRcpEpsilon);
+            if (hit.type == PtHit_Triangle)
+            {
+                ++hitcount;
+            }
+        }
+        float hitratio = hitcount / hammCount;
+        if (hitratio < 0.5f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// number of kLightRays rays from random points within the box
+// to random points on the given emitters that are unoccluded
+static i32 LightVisibility(
+    const PtScene* pim_noalias scene,
+    Prng* pim_noalias rng,
+    float4 center,
+    float4 extent,
+    const i32* pim_noalias emitters,
+    i32 emitterCount)
+{
+    float4 const *const pim_noalias positions = scene->positions;
+    i32 const *const pim_noalias emitToVert = scene->emitToVert;
+
+    float4 ros[kLightRays];
+    float4 rds[kLightRays];
+    bool visibles[kLightRays];
+    for (i32 k = 0; k < kLightRays; ++k)
+    {
+        float4 ro = f4_add(center, f4_mul(extent, f4_lerpsv(-1.0f, 1.0f, Prng_float4(rng))));
+        ro.w = 0.0f;
+        i32 iEmit = emitters[(emitterCount > 1) ? (Prng_u32(rng) % emitterCount) : 0];
+        i32 iVert = emitToVert[iEmit];
+        float4 at = f4_blend(
+            positions[iVert + 0],
+            positions[iVert + 1],
+            positions[iVert + 2],
+            SampleBaryCoord(Prng_float2(rng)));
+        float4 rd = f4_sub(at, ro);
+        float dist = f4_length3(rd);
+        rd = f4_divvs(rd, dist);
+        rd.w = dist - 0.01f * kMilli;
+        ros[k] = ro;
+        rds[k] = rd;
+    }
+    RtcOccluded16(scene->rtcScene, ros, rds, visibles);
+    i32 hits = 0;
+    for (i32 k = 0; k < kLightRays; ++k)
+    {
+        hits += visibles[k] ? 1 : 0;
+    }
+    return hits;
+}
+
+// a miss of every ray only bounds visibility below 1 / kLightRays.
+// keep those emitters samplable, through openings narrower than the rays' spacing.
+pim_inline float VEC_CALL LightVisFraction(i32 hits)
+{
+    return f1_max((float)hits / kLightRays, kLightVisFloor);
+}
+
+pim_inline void VEC_CALL PublishLightCell(
+    PtScene* pim_noalias scene,
+    i32 iCell,
+    Dist1D dist)
+{
+    // the whole cell, list and cdf, becomes visible with this one release
+    scene->lightDists[iCell] = dist;
+    store_i32(&scene->lightReady[iCell], 1, MO_Release);
+}
+
+// one work item per cluster of cells.
+// visibility is estimated from the cluster to each cluster of emitters,
+// then to each emitter, and only refined per cell where it is partial.
+// cells are published as they complete, until then lookups fall back
+// to a uniform distribution.
 static void SetupLightGridFn(void* pbase, i32 begin, i32 end)
 {
     task_SetupLightGrid* task = (task_SetupLightGrid*)pbase;
@@ -895,15 +1524,16 @@ static void SetupLightGridFn(void* pbase, i32 begin, i32 end)
     PtScene*const pim_noalias scene = task->scene;
 
     const Grid grid = scene->lightGrid;
-    Dist1D *const pim_noalias dists = scene->lightDists;
-
-    float4 const *const pim_noalias positions = scene->positions;
-
+    const int3 size = grid.size;
+    const int3 clusterSize = task->clusterSize;
     const i32 emissiveCount = scene->emissiveCount;
-    i32 const *const pim_noalias emitToVert = scene->emitToVert;
+    i32 const *const pim_noalias emitOrder = task->emitOrder;
+    i32 const *const pim_noalias emitClusterOffsets = task->emitClusterOffsets;
+    const i32 emitClusterCount = task->emitClusterCount;
 
-    const float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
+    const float metersPerCell = 1.0f / grid.cellsPerMeter;
     const float radius = metersPerCell * 0.666f;
+    const float4 cellExtent = f4_s(1.5f * radius);
     Prng* pim_noalias rng = Prng_Get();
 
     float4 hamm[16];
@@ -913,86 +1543,128 @@ static void SetupLightGridFn(void* pbase, i32 begin, i32 end)
         hamm[i] = SampleUnitSphere(Xi);
     }
 
-    RTCScene rtScene = scene->rtcScene;
+    i32 cells[kLightClusterCells * kLightClusterCells * kLightClusterCells];
+    float* pim_noalias clusterVis = Perm_Alloc(sizeof(clusterVis[0]) * i1_max(emissiveCount, 1));
 
-    for (i32 i = begin; i < end; ++i)
+    for (i32 c = begin; c < end; ++c)
     {
-        float4 position = Grid_Position(&grid, i);
-        position.w = radius + 0.01f * kMilli;
+        const int3 cc =
+        {
+            c % clusterSize.x,
+            (c / clusterSize.x) % clusterSize.y,
+            c / (clusterSize.x * clusterSize.y),
+        };
+        const int3 lo =
+        {
+            cc.x * kLightClusterCells,
+            cc.y * kLightClusterCells,
+            cc.z * kLightClusterCells,
+        };
+        const int3 hi =
+        {
+            i1_min(lo.x + kLightClusterCells, size.x),
+            i1_min(lo.y + kLightClusterCells, size.y),
+            i1_min(lo.z + kLightClusterCells, size.z),
+        };
+
+        i32 cellCount = 0;
+        for (i32 z = lo.z; z < hi.z; ++z)
         {
-            PointQueryUserData query = RtcPointQuery(scene, position);
-            if (query.distance > radius)
+            for (i32 y = lo.y; y < hi.y; ++y)
             {
-                // far from a surface. might be inside or outside the map
-                // toss some rays and see if they are backfaces
-                float hitcount = 0.0f;
-                for (i32 j = 0; j < NELEM(hamm); ++j)
+                for (i32 x = lo.x; x < hi.x; ++x)
                 {
-                    PtRayHit hit = pt_intersect_local(scene, position, hamm[j], 0.0f, kRcpEpsilon);
-                    if (hit.type == PtHit_Triangle)
+                    i32 iCell = x + y * size.x + z * size.x * size.y;
+                    float4 position = Grid_Position(&grid, iCell);
+                    if (LightCellInside(scene, position, radius, hamm, NELEM(hamm)))
                     {
-                        ++hitcount;
+                        cells[cellCount++] = iCell;
+                    }
+                    else
+                    {
+                        Dist1D empty = { 0 };
+                        PublishLightCell(scene, iCell, empty);
                     }
-                }
-                float hitratio = hitcount / NELEM(hamm);
-                if (hitratio < 0.5f)
-                {
-                    continue;
                 }
             }
         }
+        if (cellCount == 0)
+        {
+            continue;
+        }
 
-        Dist1D dist = { 0 };
-        Dist1D_New(&dist, emissiveCount);
+        const float4 boxLo = f4_add(grid.bounds.lo, f4_v(lo.x * metersPerCell, lo.y * metersPerCell, lo.z * metersPerCell, 0.0f));
+        const float4 boxHi = f4_add(grid.bounds.lo, f4_v(hi.x * metersPerCell, hi.y * metersPerCell, hi.z * metersPerCell, 0.0f));
+        const float4 center = f4_lerpvs(boxLo, boxHi, 0.5f);
+        const float4 extent = f4_add(f4_mulvs(f4_sub(boxHi, boxLo), 0.5f), f4_s(0.5f * metersPerCell));
 
-        for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+        for (i32 iCluster = 0; iCluster < emitClusterCount; ++iCluster)
         {
-            i32 iVert = emitToVert[iEmit];
-            float4 A = positions[iVert + 0];
-            float4 B = positions[iVert + 1];
-            float4 C = positions[iVert + 2];
-
-            i32 hits = 0;
-            float4 ros[16];
-            float4 rds[16];
-            bool visibles[16];
-            const i32 hitAttempts = 16;
-            const i32 loopIterations = hitAttempts / NELEM(ros);
-            for (i32 j = 0; j < loopIterations; ++j)
+            const i32 first = emitClusterOffsets[iCluster];
+            const i32 count = emitClusterOffsets[iCluster + 1] - first;
+            const i32* pim_noalias emitters = emitOrder + first;
+            i32 pairHits = LightVisibility(scene, rng, center, extent, emitters, count);
+            if ((count == 1) || (pairHits == 0))
             {
-                for (i32 k = 0; k < NELEM(ros); ++k)
+                float vis = LightVisFraction(pairHits);
+                for (i32 j = 0; j < count; ++j)
                 {
-                    float4 t = f4_mulvs(f4_lerpsv(-1.5f, 1.5f, Prng_float4(rng)), radius);
-                    float4 ro = f4_add(position, t);
-                    ro.w = 0.0f;
-                    float4 at = f4_blend(A, B, C, SampleBaryCoord(Prng_float2(rng)));
-                    float4 rd = f4_sub(at, ro);
-                    float dist = f4_length3(rd);
-                    rd = f4_divvs(rd, dist);
-                    rd.w = dist - 0.01f * kMilli;
-                    ros[k] = ro;
-                    rds[k] = rd;
+                    clusterVis[emitters[j]] = vis;
                 }
-                RtcOccluded16(rtScene, ros, rds, visibles);
-                for (i32 k = 0; k < NELEM(ros); ++k)
+            }
+            else
+            {
+                for (i32 j = 0; j < count; ++j)
                 {
-                    hits += visibles[k] ? 1 : 0;
+                    i32 hits = LightVisibility(scene, rng, center, extent, emitters + j, 1);
+                    clusterVis[emitters[j]] = LightVisFraction(hits);
                 }
             }
-            float hitPdf = (float)hits / (float)hitAttempts;
-
-            dist.pdf[iEmit] = hitPdf;
         }
 
-        Dist1D_Bake(&dist);
-        dists[i] = dist;
-    }
-}
-
+        for (i32 j = 0; j < cellCount; ++j)
+        {
+            const i32 iCell = cells[j];
+            const float4 position = Grid_Position(&grid, iCell);
+            Dist1D dist = { 0 };
+            Dist1D_New(&dist, emissiveCount);
+            for (i32 iEmit = 0; iEmit < emissiveCount; ++iEmit)
+            {
+                // clusters that missed entirely keep the floor without refining
+                float vis = clusterVis[iEmit];
+                if ((vis > kLightVisFloor) && (vis < 1.0f))
+                {
+                    i32 hits = LightVisibility(scene, rng, position, cellExtent, &iEmit, 1);
+                    vis = LightVisFraction(hits);
+                }
+                dist.pdf[iEmit] = vis;
+            }
+            Dist1D_Bake(&dist);
+            PublishLightCell(scene, iCell, dist);
+        }
+    }
+
+    Mem_Free(clusterVis);
+}
+
+static void LightGridTask_Del(task_SetupLightGrid* task)
+{
+    if (task)
+    {
+        Task_Await(task);
+        Mem_Free(task->emitClusterOffsets);
+        Mem_Free(task->emitOrder);
+        Mem_Free(task);
+    }
+}
+
+ProfileMark(pm_setuplightgrid, SetupLightGrid)
 static void SetupLightGrid(PtScene* pim_noalias scene)
 {
     if (scene->vertCount > 0)
     {
+        ProfileBegin(pm_setuplightgrid);
+
         Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
         float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
         Grid grid;
@@ -1000,11 +1672,76 @@ static void SetupLightGrid(PtScene* pim_noalias scene)
         const i32 len = Grid_Len(&grid);
         scene->lightGrid = grid;
         scene->lightDists = Tex_Calloc(sizeof(scene->lightDists[0]) * len);
+        scene->lightReady = Tex_Calloc(sizeof(scene->lightReady[0]) * len);
+
+        const i32 emissiveCount = scene->emissiveCount;
+        Dist1D_New(&scene->lightUniform, emissiveCount);
+        for (i32 i = 0; i < emissiveCount; ++i)
+        {
+            scene->lightUniform.pdf[i] = 1.0f;
+        }
+        Dist1D_Bake(&scene->lightUniform);
+
+        const int3 clusterSize =
+        {
+            (grid.size.x + kLightClusterCells - 1) / kLightClusterCells,
+            (grid.size.y + kLightClusterCells - 1) / kLightClusterCells,
+            (grid.size.z + kLightClusterCells - 1) / kLightClusterCells,
+        };
+        const i32 clusterLen = clusterSize.x * clusterSize.y * clusterSize.z;
+
+        // counting sort of emitters by the cluster their centroid lies in
+        float4 const *const pim_noalias positions = scene->positions;
+        i32 const *const pim_noalias emitToVert = scene->emitToVert;
+        i32* pim_noalias emitCluster = Temp_Alloc(sizeof(emitCluster[0]) * i1_max(emissiveCount, 1));
+        i32* pim_noalias clusterCounts = Temp_Calloc(sizeof(clusterCounts[0]) * clusterLen);
+        for (i32 i = 0; i < emissiveCount; ++i)
+        {
+            i32 iVert = emitToVert[i];
+            float4 centroid = f4_mulvs(f4_add(positions[iVert + 0], f4_add(positions[iVert + 1], positions[iVert + 2])), 1.0f / 3.0f);
+            i32 iCell = Grid_Index(&grid, centroid);
+            i32 x = (iCell % grid.size.x) / kLightClusterCells;
+            i32 y = ((iCell / grid.size.x) % grid.size.y) / kLightClusterCells;
+            i32 z = (iCell / (grid.size.x * grid.size.y)) / kLightClusterCells;
+            i32 iCluster = x + y * clusterSize.x + z * clusterSize.x * clusterSize.y;
+            emitCluster[i] = iCluster;
+            clusterCounts[iCluster] += 1;
+        }
+
+        i32 emitClusterCount = 0;
+        i32* pim_noalias emitClusterOffsets = Perm_Alloc(sizeof(emitClusterOffsets[0]) * (clusterLen + 1));
+        i32* pim_noalias emitOrder = Perm_Alloc(sizeof(emitOrder[0]) * i1_max(emissiveCount, 1));
+        i32* pim_noalias clusterSlot = Temp_Alloc(sizeof(clusterSlot[0]) * clusterLen);
+        {
+            i32 offset = 0;
+            for (i32 i = 0; i < clusterLen; ++i)
+            {
+                clusterSlot[i] = offset;
+                if (clusterCounts[i] > 0)
+                {
+                    emitClusterOffsets[emitClusterCount++] = offset;
+                    offset += clusterCounts[i];
+                }
+            }
+            emitClusterOffsets[emitClusterCount] = offset;
+        }
+        for (i32 i = 0; i < emissiveCount; ++i)
+        {
+            emitOrder[clusterSlot[emitCluster[i]]++] = i;
+        }
 
-        task_SetupLightGrid* task = Temp_Calloc(sizeof(*task));
+        task_SetupLightGrid* task = Perm_Calloc(sizeof(*task));
         task->scene = scene;
+        task->clusterSize = clusterSize;
+        task->emitClusterOffsets = emitClusterOffsets;
+        task->emitOrder = emitOrder;
+        task->emitClusterCount = emitClusterCount;
+        scene->lightTask = task;
+
+        Task_SubmitBackground(task, SetupLightGridFn, clusterLen);
+        TaskSys_Schedule();
 
-        Task_Run(task, SetupLightGridFn, len);
+        ProfileEnd(pm_setuplightgrid);
     }
 }
 
@@ -1020,6 +1757,139 @@ static void PtScene_FindSky(PtScene* scene)
     }
 }
 
+ProfileMark(pm_setupskydist, SetupSkyDist)
+static void SetupSkyDist(PtScene* scene)
+{
+    const Cubemap* pim_noalias sky = scene->sky;
+    const i32 size = sky ? sky->size : 0;
+    if ((scene->skyVersion == ms_skyVersion) && (scene->skySize == size))
+    {
+        return;
+    }
+    ProfileBegin(pm_setupskydist);
+
+    Dist1D_Del(&scene->skyDist);
+    scene->skySize = size;
+    scene->skyVersion = ms_skyVersion;
+    if (size > 0)
+    {
+        const i32 texelsPerFace = size * size;
+        const i32 len = Cubeface_COUNT * texelsPerFace;
+        Dist1D* dist = &scene->skyDist;
+        Dist1D_New(dist, len);
+        float* pim_noalias pdf = dist->pdf;
+
+        float sum = 0.0f;
+        for (i32 i = 0; i < len; ++i)
+        {
+            i32 face = i / texelsPerFace;
+            i32 iTexel = i % texelsPerFace;
+            float2 st =
+            {
+                ((iTexel % size) + 0.5f) / size * 2.0f - 1.0f,
+                ((iTexel / size) + 0.5f) / size * 2.0f - 1.0f,
+            };
+            float4 dir = proj_dir(
+                Cubemap_kRights[face],
+                Cubemap_kUps[face],
+                Cubemap_kForwards[face],
+                f2_1,
+                st);
+            pdf[i] = f4_avglum(f3_f4(Cubemap_ReadColor(sky, dir), 0.0f));
+            sum += pdf[i];
+        }
+
+        // floor the luminance so that dim texels remain reachable,
+        // then weight by each texel's solid angle
+        const float lumFloor = 0.01f * sum / len;
+        for (i32 i = 0; i < len; ++i)
+        {
+            i32 iTexel = i % texelsPerFace;
+            float s = ((iTexel % size) + 0.5f) / size * 2.0f - 1.0f;
+            float t = ((iTexel / size) + 0.5f) / size * 2.0f - 1.0f;
+            float d = 1.0f + s * s + t * t;
+            pdf[i] = (pdf[i] + lumFloor) / (d * sqrtf(d));
+        }
+        Dist1D_Bake(dist);
+    }
+
+    ProfileEnd(pm_setupskydist);
+}
+
+// lightmap coordinates and indices in FlattenDrawables' vertex order.
+// built apart from the flattened geometry since they change with each
+// lightmap pack, and scenes adopted from a crate skip the flatten.
+ProfileMark(pm_setuplmcache, SetupLmCache)
+static void SetupLmCache(PtScene* pim_noalias scene)
+{
+    Mem_Free(scene->lmUvs);
+    Mem_Free(scene->lmIndices);
+    scene->lmUvs = NULL;
+    scene->lmIndices = NULL;
+
+    const LmPack* pack = LmPack_Get();
+    scene->lmSource = pack->lightmaps;
+    scene->lmCount = pack->lmCount;
+    if ((pack->lmCount <= 0) || (scene->vertCount <= 0))
+    {
+        return;
+    }
+
+    ProfileBegin(pm_setuplmcache);
+
+    const Entities* drawTable = Entities_Get();
+    const i32 drawCount = drawTable->count;
+    const MeshId* pim_noalias meshes = drawTable->meshes;
+    const Material* pim_noalias materials = drawTable->materials;
+
+    const i32 vertCount = scene->vertCount;
+    float2* pim_noalias lmUvs = Perm_Calloc(sizeof(lmUvs[0]) * vertCount);
+    i32* pim_noalias lmIndices = Perm_Alloc(sizeof(lmIndices[0]) * (vertCount / 3));
+
+    i32 vertBack = 0;
+    for (i32 i = 0; i < drawCount; ++i)
+    {
+        const Mesh* pim_noalias mesh = Mesh_Get(meshes[i]);
+        if (!mesh)
+        {
+            continue;
+        }
+        const i32 meshLen = mesh->length;
+        if ((vertBack + meshLen) > vertCount)
+        {
+            break;
+        }
+        const float4* pim_noalias meshUvs = mesh->uvs;
+        const int4* pim_noalias texIndices = mesh->texIndices;
+        // skipped by the lightmap packer
+        const bool unmapped = (materials[i].flags & (MatFlag_Sky | MatFlag_Lava)) != 0;
+        for (i32 j = 0; (j + 3) <= meshLen; j += 3)
+        {
+            const i32 iVert = vertBack + j;
+            lmIndices[iVert / 3] = unmapped ? -1 : LmPack_Find(pack, texIndices[j].w);
+            for (i32 k = 0; k < 3; ++k)
+            {
+                lmUvs[iVert + k] = f2_v(meshUvs[j + k].z, meshUvs[j + k].w);
+            }
+        }
+        vertBack += meshLen;
+    }
+
+    if (vertBack == vertCount)
+    {
+        scene->lmUvs = lmUvs;
+        scene->lmIndices = lmIndices;
+    }
+    else
+    {
+        // drawables no longer match the flattened geometry
+        Mem_Free(lmUvs);
+        Mem_Free(lmIndices);
+    }
+
+    ProfileEnd(pm_setuplmcache);
+}
+
 ProfileMark(pm_scene_update, PtScene_Update)
 void PtScene_Update(PtScene* scene)
 {
@@ -1030,7 +1900,24 @@ void PtScene_Update(PtScene* scene)
         PtScene_Clear(scene);
         PtScene_Init(scene);
     }
+    if (media_desc_hash(&scene->mediaDesc) != scene->mediaHash)
+    {
+        SetupMediaGrid(scene);
+    }
+    {
+        const LmPack* pack = LmPack_Get();
+        if ((pack->lightmaps != scene->lmSource) || (pack->lmCount != scene->lmCount))
+        {
+            SetupLmCache(scene);
+        }
+    }
     PtScene_FindSky(scene);
+    SetupSkyDist(scene);
+    if (scene->lightTask && (Task_Stat(scene->lightTask) == TaskStatus_Complete))
+    {
+        LightGridTask_Del(scene->lightTask);
+        scene->lightTask = NULL;
+    }
     UpdateDists(scene);
 
     ProfileEnd(pm_scene_update);
@@ -1039,17 +1926,31 @@ void PtScene_Update(PtScene* scene)
 static void PtScene_Init(PtScene* scene)
 {
     PtScene_FindSky(scene);
-    FlattenDrawables(scene);
-    SetupEmissives(scene);
+    SetupSkyDist(scene);
+    const bool adopted = PtScene_AdoptStaged(scene);
+    if (!adopted)
+    {
+        FlattenDrawables(scene);
+        SetupEmissives(scene);
+    }
     media_desc_new(&scene->mediaDesc);
+    SetupMediaGrid(scene);
+    SetupLmCache(scene);
     scene->rtcScene = RtcNewScene(scene);
-    SetupLightGrid(scene);
+    if (!adopted)
+    {
+        SetupLightGrid(scene);
+    }
 
     scene->modtime = Entities_Get()->modtime;
 }
 
 static void PtScene_Clear(PtScene* scene)
 {
+    // the light grid build reads the scene until it completes
+    LightGridTask_Del(scene->lightTask);
+    scene->lightTask = NULL;
+
     if (scene->rtcScene)
     {
         RTCScene rtcScene = scene->rtcScene;
@@ -1058,14 +1959,15 @@ static void PtScene_Clear(PtScene* scene)
     }
 
     Mem_Free(scene->positions);
-    Mem_Free(scene->normals);
-    Mem_Free(scene->uvs);
-    Mem_Free(scene->matIds);
-    Mem_Free(scene->vertToEmit);
+    Mem_Free(scene->triangles);
 
     Mem_Free(scene->materials);
 
     Mem_Free(scene->emitToVert);
+    Mem_Free(scene->mediaMajorants);
+    Mem_Free(scene->lmUvs);
+    Mem_Free(scene->lmIndices);
+    Dist1D_Del(&scene->skyDist);
 
     {
         const i32 gridLen = Grid_Len(&scene->lightGrid);
@@ -1075,11 +1977,334 @@ static void PtScene_Clear(PtScene* scene)
             Dist1D_Del(lightDists + i);
         }
         Mem_Free(scene->lightDists);
+        Mem_Free(scene->lightReady);
+        Dist1D_Del(&scene->lightUniform);
     }
 
     memset(scene, 0, sizeof(*scene));
 }
 
+// ----------------------------------------------------------------------------
+// persistence of derived scene data
+
+static u64 HashMesh(const Mesh* mesh, u64 hash)
+{
+    const i32 len = mesh->length;
+    hash = Fnv64Dword(len, hash);
+    hash = Fnv64Bytes(mesh->positions, sizeof(mesh->positions[0]) * len, hash);
+    hash = Fnv64Bytes(mesh->normals, sizeof(mesh->normals[0]) * len, hash);
+    // uv.zw is the lightmap uv, which moves on every repack
+    const float4* pim_noalias uvs = mesh->uvs;
+    for (i32 i = 0; i < len; ++i)
+    {
+        hash = Fnv64Bytes(&uvs[i], sizeof(float) * 2, hash);
+    }
+    return hash;
+}
+
+static u64 HashTexture(const Texture* tex, u64 hash)
+{
+    const i32 bytes = (tex->size.x * tex->size.y * vkrFormatToBpp(tex->format)) / 8;
+    hash = Fnv64Bytes(&tex->size, sizeof(tex->size), hash);
+    if (tex->texels)
+    {
+        hash = Fnv64Bytes(tex->texels, bytes, hash);
+    }
+    return hash;
+}
+
+// content hash of everything the flattened geometry, emissives and
+// light grid are derived from. runtime ids are replaced by asset names.
+static u64 PtScene_Hash(void)
+{
+    const Entities* drawTable = Entities_Get();
+    const i32 drawCount = drawTable->count;
+    const MeshId* pim_noalias meshes = drawTable->meshes;
+    const float4x4* pim_noalias matrices = drawTable->matrices;
+    const Material* pim_noalias materials = drawTable->materials;
+
+    u64 hash = Fnv64Bias;
+    hash = Fnv64Dword(kPtSceneVersion, hash);
+    const float metersPerCell = ConVar_GetFloat(&cv_pt_dist_meters);
+    hash = Fnv64Bytes(&metersPerCell, sizeof(metersPerCell), hash);
+    for (i32 i = 0; i < drawCount; ++i)
+    {
+        Guid meshName = { 0 };
+        if (!Mesh_GetName(meshes[i], &meshName))
+        {
+            continue;
+        }
+        const Material* mat = &materials[i];
+        Guid romeName = { 0 };
+        Texture_GetGuid(mat->rome, &romeName);
+        hash = Fnv64Bytes(&meshName, sizeof(meshName), hash);
+        hash = Fnv64Bytes(&romeName, sizeof(romeName), hash);
+        hash = Fnv64Dword(mat->flags, hash);
+        hash = Fnv64Bytes(&mat->ior, sizeof(mat->ior), hash);
+        hash = Fnv64Bytes(&mat->meanFreePath, sizeof(mat->meanFreePath), hash);
+        hash = Fnv64Bytes(&matrices[i], sizeof(matrices[i]), hash);
+
+        // names survive edits, so hash the content too
+        const Mesh* mesh = Mesh_Get(meshes[i]);
+        if (mesh)
+        {
+            hash = HashMesh(mesh, hash);
+        }
+        const Texture* rome = Texture_Get(mat->rome);
+        if (rome)
+        {
+            hash = HashTexture(rome, hash);
+        }
+    }
+    return hash;
+}
+
+static void PtSceneStaged_Del(PtSceneStaged* staged)
+{
+    Mem_Free(staged->positions);
+    Mem_Free(staged->triangles);
+    Mem_Free(staged->emitToVert);
+    Mem_Free(staged->litCells);
+    Mem_Free(staged->litPdfs);
+    memset(staged, 0, sizeof(*staged));
+}
+
+// materials are not persisted since they hold runtime texture ids,
+// gather them in the same order as FlattenDrawables.
+static void FlattenMaterials(PtScene* pim_noalias scene)
+{
+    const Entities* drawTable = Entities_Get();
+    const i32 drawCount = drawTable->count;
+    const MeshId* pim_noalias meshes = drawTable->meshes;
+    const Material* pim_noalias materials = drawTable->materials;
+
+    i32 matCount = 0;
+    Material* sceneMats = Perm_Calloc(sizeof(sceneMats[0]) * i1_max(drawCount, 1));
+    for (i32 i = 0; i < drawCount; ++i)
+    {
+        if (Mesh_Exists(meshes[i]))
+        {
+            sceneMats[matCount++] = materials[i];
+        }
+    }
+    scene->matCount = matCount;
+    scene->materials = sceneMats;
+}
+
+// moves staged data into the scene when its hash matches the entities.
+static bool PtScene_AdoptStaged(PtScene* pim_noalias scene)
+{
+    PtSceneStaged* staged = &ms_staged;
+    if (!staged->positions)
+    {
+        return false;
+    }
+    if (staged->hash != PtScene_Hash())
+    {
+        Con_Logf(LogSev_Info, "pt", "Discarding stale scene data from crate.");
+        PtSceneStaged_Del(staged);
+        return false;
+    }
+
+    scene->vertCount = staged->vertCount;
+    scene->positions = staged->positions;
+    scene->triangles = staged->triangles;
+    scene->emissiveCount = staged->emissiveCount;
+    scene->emitToVert = staged->emitToVert;
+    FlattenMaterials(scene);
+
+    const Grid grid = staged->lightGrid;
+    const i32 len = Grid_Len(&grid);
+    const i32 emissiveCount = staged->emissiveCount;
+    scene->lightGrid = grid;
+    scene->lightDists = Tex_Calloc(sizeof(scene->lightDists[0]) * len);
+    scene->lightReady = Tex_Calloc(sizeof(scene->lightReady[0]) * len);
+    Dist1D_New(&scene->lightUniform, emissiveCount);
+    for (i32 i = 0; i < emissiveCount; ++i)
+    {
+        scene->lightUniform.pdf[i] = 1.0f;
+    }
+    Dist1D_Bake(&scene->lightUniform);
+    for (i32 i = 0; i < staged->litCount; ++i)
+    {
+        Dist1D* dist = &scene->lightDists[staged->litCells[i]];
+        Dist1D_New(dist, emissiveCount);
+        memcpy(dist->pdf, staged->litPdfs + i * emissiveCount, sizeof(dist->pdf[0]) * emissiveCount);
+        Dist1D_Bake(dist);
+    }
+    for (i32 i = 0; i < len; ++i)
+    {
+        scene->lightReady[i] = 1;
+    }
+
+    // ownership of geometry moved to the scene
+    staged->positions = NULL;
+    staged->triangles = NULL;
+    staged->emitToVert = NULL;
+    PtSceneStaged_Del(staged);
+    return true;
+}
+
+void PtScene_Finish(PtScene* scene)
+{
+    ASSERT(scene);
+    LightGridTask_Del(scene->lightTask);
+    scene->lightTask = NULL;
+}
+
+bool PtScene_Save(Crate* crate, PtScene* scene)
+{
+    ASSERT(crate);
+    ASSERT(scene);
+
+    // rebuild from the current entities, so the data matches the hash
+    // it is stamped with, then persist a complete light grid
+    PtScene_Update(scene);
+    PtScene_Finish(scene);
+
+    const i32 vertCount = scene->vertCount;
+    const i32 triCount = vertCount / 3;
+    const i32 emissiveCount = scene->emissiveCount;
+    const i32 gridLen = (scene->lightDists) ? Grid_Len(&scene->lightGrid) : 0;
+    if (vertCount <= 0)
+    {
+        // nothing to persist
+        return true;
+    }
+
+    i32 litCount = 0;
+    i32* litCells = NULL;
+    float* litPdfs = NULL;
+    if (emissiveCount > 0)
+    {
+        litCells = Perm_Alloc(sizeof(litCells[0]) * i1_max(gridLen, 1));
+        for (i32 i = 0; i < gridLen; ++i)
+        {
+            if (scene->lightDists[i].length > 0)
+            {
+                litCells[litCount++] = i;
+            }
+        }
+        // a partial light grid would load as uniform cells, so save nothing
+        const i64 pdfBytes = (i64)sizeof(litPdfs[0]) * litCount * emissiveCount;
+        if (pdfBytes > kMaxLitPdfBytes)
+        {
+            Con_Logf(LogSev_Warning, "pt", "Light grid too large to save (%lld bytes).", (long long)pdfBytes);
+            Mem_Free(litCells);
+            return false;
+        }
+        litPdfs = Perm_Alloc(sizeof(litPdfs[0]) * i1_max(litCount * emissiveCount, 1));
+        for (i32 i = 0; i < litCount; ++i)
+        {
+            const Dist1D* dist = &scene->lightDists[litCells[i]];
+            memcpy(litPdfs + i * emissiveCount, dist->pdf, sizeof(litPdfs[0]) * emissiveCount);
+        }
+    }
+
+    DiskPtScene dscene = { 0 };
+    dscene.version = kPtSceneVersion;
+    dscene.vertCount = vertCount;
+    dscene.emissiveCount = emissiveCount;
+    dscene.litCount = litCount;
+    dscene.hash = PtScene_Hash();
+    dscene.lightGrid = scene->lightGrid;
+
+    bool wrote = Crate_Set(crate, Guid_FromStr("ptscene"), &dscene, sizeof(dscene));
+    if (wrote)
+    {
+        wrote &= Crate_Set(crate, Guid_FromStr("ptscene.positions"),
+            scene->positions, sizeof(scene->positions[0]) * vertCount);
+        wrote &= Crate_Set(crate, Guid_FromStr("ptscene.triangles"),
+            scene->triangles, sizeof(scene->triangles[0]) * triCount);
+        if (emissiveCount > 0)
+        {
+            wrote &= Crate_Set(crate, Guid_FromStr("ptscene.emitToVert"),
+                scene->emitToVert, sizeof(scene->emitToVert[0]) * emissiveCount);
+        }
+        if (litCount > 0)
+        {
+            wrote &= Crate_Set(crate, Guid_FromStr("ptscene.litCells"),
+                litCells, sizeof(litCells[0]) * litCount);
+            wrote &= Crate_Set(crate, Guid_FromStr("ptscene.litPdfs"),
+                litPdfs, sizeof(litPdfs[0]) * litCount * emissiveCount);
+        }
+    }
+
+    Mem_Free(litCells);
+    Mem_Free(litPdfs);
+    return wrote;
+}
+
+bool PtScene_Load(Crate* crate)
+{
+    ASSERT(crate);
+    PtSceneStaged_Del(&ms_staged);
+
+    DiskPtScene dscene = { 0 };
+    if (!Crate_Get(crate, Guid_FromStr("ptscene"), &dscene, sizeof(dscene)))
+    {
+        return false;
+    }
+    if ((dscene.version != kPtSceneVersion) ||
+        (dscene.vertCount <= 0) ||
+        (dscene.emissiveCount < 0) ||
+        (dscene.litCount < 0))
+    {
+        return false;
+    }
+
+    PtSceneStaged staged = { 0 };
+    staged.hash = dscene.hash;
+    staged.vertCount = dscene.vertCount;
+    staged.emissiveCount = dscene.emissiveCount;
+    staged.litCount = dscene.litCount;
+    staged.lightGrid = dscene.lightGrid;
+
+    const i32 vertCount = dscene.vertCount;
+    const i32 triCount = vertCount / 3;
+    const i32 emissiveCount = dscene.emissiveCount;
+    const i32 litCount = dscene.litCount;
+    if (((i64)sizeof(staged.litPdfs[0]) * litCount * emissiveCount) > kMaxLitPdfBytes)
+    {
+        return false;
+    }
+
+    bool loaded = true;
+    staged.positions = Perm_Alloc(sizeof(staged.positions[0]) * vertCount);
+    loaded &= Crate_Get(crate, Guid_FromStr("ptscene.positions"),
+        staged.positions, sizeof(staged.positions[0]) * vertCount);
+    staged.triangles = Perm_Alloc(sizeof(staged.triangles[0]) * triCount);
+    loaded &= Crate_Get(crate, Guid_FromStr("ptscene.triangles"),
+        staged.triangles, sizeof(staged.triangles[0]) * triCount);
+    if (loaded && (emissiveCount > 0))
+    {
+        staged.emitToVert = Perm_Alloc(sizeof(staged.emitToVert[0]) * emissiveCount);
+        loaded &= Crate_Get(crate, Guid_FromStr("ptscene.emitToVert"),
+            staged.emitToVert, sizeof(staged.emitToVert[0]) * emissiveCount);
+    }
+    if (loaded && (litCount > 0))
+    {
+        staged.litCells = Perm_Alloc(sizeof(staged.litCells[0]) * litCount);
+        loaded &= Crate_Get(crate, Guid_FromStr("ptscene.litCells"),
+            staged.litCells, sizeof(staged.litCells[0]) * litCount);
+        staged.litPdfs = Perm_Alloc(sizeof(staged.litPdfs[0]) * litCount * emissiveCount);
+        loaded &= Crate_Get(crate, Guid_FromStr("ptscene.litPdfs"),
+            staged.litPdfs, sizeof(staged.litPdfs[0]) * litCount * emissiveCount);
+    }
+
+    if (loaded)
+    {
+        ms_staged = staged;
+    }
+    else
+    {
+        PtSceneStaged_Del(&staged);
+    }
+    return loaded;
+}
+
+// ----------------------------------------------------------------------------
+
 PtScene* PtScene_New(void)
 {
     ASSERT(ms_device);
@@ -1109,6 +2334,20 @@ void PtScene_Gui(PtScene* scene)
         igText("Vertex Count: %d", scene->vertCount);
         igText("Material Count: %d", scene->matCount);
         igText("Emissive Count: %d", scene->emissiveCount);
+        {
+            const PtStats* fs = &ms_frameStats;
+            const double rcpPaths = 100.0 / (fs->paths ? fs->paths : 1);
+            igText("Rays: %llu", (unsigned long long)fs->rays);
+            igText("Paths: %llu", (unsigned long long)fs->paths);
+            igText("Rays per Path: %.2f", fs->rays * rcpPaths * 0.01);
+            igText("Bounces per Path: %.2f", fs->bounces * rcpPaths * 0.01);
+            igText("Roulette Kills: %.1f%%", fs->rouletteKills * rcpPaths);
+            igText("Backface Kills: %.1f%%", fs->backfaceKills * rcpPaths);
+            igText("Escapes: %.1f%%", fs->escapes * rcpPaths);
+            igText("Media Scatters: %llu", (unsigned long long)fs->mediaScatters);
+            igText("Light Sample Hit Rate: %.1f%%",
+                (100.0 * fs->lightHits) / (fs->lightSamples ? fs->lightSamples : 1));
+        }
         media_desc_gui(&scene->mediaDesc);
         igUnindent(0.0f);
     }
@@ -1127,14 +2366,21 @@ void PtTrace_New(
     trace->albedo = Tex_Calloc(sizeof(trace->albedo[0]) * texelCount);
     trace->normal = Tex_Calloc(sizeof(trace->normal[0]) * texelCount);
     trace->denoised = Tex_Calloc(sizeof(trace->denoised[0]) * texelCount);
+    trace->heat = Tex_Calloc(sizeof(trace->heat[0]) * texelCount);
 }
 
 void PtTrace_Del(PtTrace* trace)
 {
+    if (trace->mlt)
+    {
+        PtMlt_Del(trace->mlt);
+        Mem_Free(trace->mlt);
+    }
     Mem_Free(trace->color);
     Mem_Free(trace->albedo);
     Mem_Free(trace->normal);
     Mem_Free(trace->denoised);
+    Mem_Free(trace->heat);
     memset(trace, 0, sizeof(*trace));
 }
 
@@ -1189,15 +2435,22 @@ pim_inline float4 VEC_CALL GetPosition(
         hit.wuvt);
 }
 
+pim_inline float2 VEC_CALL GetTriUV(
+    const PtTriangle* pim_noalias tri,
+    i32 i)
+{
+    return f2_v(half_f1(tri->uvs[i].x), half_f1(tri->uvs[i].y));
+}
+
 pim_inline float4 VEC_CALL GetNormal(
     const PtScene* pim_noalias scene,
     PtRayHit hit)
 {
-    float4 const *const pim_noalias normals = scene->normals;
+    const PtTriangle* pim_noalias tri = &scene->triangles[hit.iVert / 3];
     float4 N = f4_blend(
-        normals[hit.iVert + 0],
-        normals[hit.iVert + 1],
-        normals[hit.iVert + 2],
+        Oct16ToNormal(tri->normals[0]),
+        Oct16ToNormal(tri->normals[1]),
+        Oct16ToNormal(tri->normals[2]),
         hit.wuvt);
     N = (f4_dot3(hit.normal, N) > 0.0f) ? N : f4_neg(N);
     return f4_normalize3(N);
@@ -1207,11 +2460,11 @@ pim_inline float2 VEC_CALL GetUV(
     const PtScene* pim_noalias scene,
     PtRayHit hit)
 {
-    float2 const *const pim_noalias uvs = scene->uvs;
+    const PtTriangle* pim_noalias tri = &scene->triangles[hit.iVert / 3];
     return f2_blend(
-        uvs[hit.iVert + 0],
-        uvs[hit.iVert + 1],
-        uvs[hit.iVert + 2],
+        GetTriUV(tri, 0),
+        GetTriUV(tri, 1),
+        GetTriUV(tri, 2),
         hit.wuvt);
 }
 
@@ -1232,7 +2485,7 @@ pim_inline const Material* pim_noalias VEC_CALL GetMaterial(
     i32 iVert = hit.iVert;
     ASSERT(iVert >= 0);
     ASSERT(iVert < scene->vertCount);
-    i32 matIndex = scene->matIds[iVert];
+    i32 matIndex = scene->triangles[iVert / 3].matId;
     ASSERT(matIndex >= 0);
     ASSERT(matIndex < scene->matCount);
     return &scene->materials[matIndex];
@@ -1290,6 +2543,157 @@ pim_inline float4 VEC_CALL GetSky(
     return f4_0;
 }
 
+// solid angle density of sampling rd from skyDist
+pim_inline float VEC_CALL SkyPdf(
+    const PtScene* pim_noalias scene,
+    float4 rd)
+{
+    const i32 size = scene->skySize;
+    if (size <= 0)
+    {
+        return 0.0f;
+    }
+    float2 uv;
+    Cubeface face = Cubemap_CalcUv(rd, &uv);
+    i32 x = i1_clamp((i32)(uv.x * size), 0, size - 1);
+    i32 y = i1_clamp((i32)(uv.y * size), 0, size - 1);
+    float texelPdf = Dist1D_PdfD(&scene->skyDist, face * size * size + x + y * size);
+    // jacobian from the face's [-1, 1] plane to the unit sphere
+    float s = uv.x * 2.0f - 1.0f;
+    float t = uv.y * 2.0f - 1.0f;
+    float d = 1.0f + s * s + t * t;
+    float texelArea = 4.0f / (size * size);
+    return texelPdf * (d * sqrtf(d)) / texelArea;
+}
+
+// returns a direction towards the sky in xyz and its pdf in w
+pim_inline float4 VEC_CALL SampleSkyDir(
+    PtContext* pim_noalias ctx,
+    const PtScene* pim_noalias scene)
+{
+    const i32 size = scene->skySize;
+    const i32 texelsPerFace = size * size;
+    i32 i = Dist1D_SampleD(&scene->skyDist, Sample1D(ctx));
+    i32 face = i / texelsPerFace;
+    i32 iTexel = i % texelsPerFace;
+    float2 Xi = Sample2D(ctx);
+    float2 st =
+    {
+        ((iTexel % size) + Xi.x) / size * 2.0f - 1.0f,
+        ((iTexel / size) + Xi.y) / size * 2.0f - 1.0f,
+    };
+    float4 rd = proj_dir(
+        Cubemap_kRights[face],
+        Cubemap_kUps[face],
+        Cubemap_kForwards[face],
+        f2_1,
+        st);
+    rd.w = SkyPdf(scene, rd);
+    return rd;
+}
+
+// ray cone texture lod, independent of texture resolution:
+// log2 of uv area per world area, and of the cone footprint on the surface.
+// "Texture Level of Detail Strategies for Real-Time Ray Tracing", Akenine-Moller et al
+pim_inline float VEC_CALL GetTexLod(
+    const PtScene* pim_noalias scene,
+    PtRayHit hit,
+    float4 rd,
+    float4 M,
+    float coneWidth)
+{
+    float4 const *const pim_noalias positions = scene->positions;
+    const i32 iVert = hit.iVert;
+    const PtTriangle* pim_noalias tri = &scene->triangles[iVert / 3];
+    float worldArea = TriArea3D(positions[iVert + 0], positions[iVert + 1], positions[iVert + 2]);
+    Tri2D uvTri = { GetTriUV(tri, 0), GetTriUV(tri, 1), GetTriUV(tri, 2) };
+    float uvArea = TriArea2D(uvTri);
+    float density = f1_max(uvArea, kEpsilonSq) / f1_max(worldArea, kEpsilonSq);
+    float footprint = f1_max(coneWidth, kEpsilonSq) / f1_max(f1_abs(f4_dot3(M, rd)), kEpsilon);
+    return 0.5f * log2f(density) + log2f(footprint);
+}
+
+// returns level m of the tiled mip chain, clamped to the smallest level
+pim_inline void const* VEC_CALL GetTexMip(
+    const Texture* pim_noalias tex,
+    i32 m,
+    int2* pim_noalias sizeOut)
+{
+    const int2 size = tex->size;
+    m = i1_clamp(m, 0, CalcMipCount(size) - 1);
+    *sizeOut = CalcMipSize(size, m);
+    u32 const *const pim_noalias mips = tex->mips;
+    return mips + CalcTiledMipOffset(size, m);
+}
+
+pim_inline float VEC_CALL GetTexMipLevel(const Texture* pim_noalias tex, float lod)
+{
+    const int2 size = tex->size;
+    return lod + 0.5f * log2f((float)size.x * (float)size.y);
+}
+
+pim_inline float4 VEC_CALL TexSampleMip_c32(
+    const Texture* pim_noalias tex,
+    float2 uv,
+    float mip)
+{
+    if (!tex->mips)
+    {
+        return UvBilinearWrap_c32(tex->texels, tex->size, uv);
+    }
+    mip = f1_max(mip, 0.0f);
+    i32 m = (i32)mip;
+    int2 size0, size1;
+    R8G8B8A8_t const *const pim_noalias a = GetTexMip(tex, m, &size0);
+    R8G8B8A8_t const *const pim_noalias b = GetTexMip(tex, m + 1, &size1);
+    float4 va = UvBilinearWrapTiled_c32(a, size0, uv);
+    if ((a == b) || (mip == m))
+    {
+        return va;
+    }
+    float4 vb = UvBilinearWrapTiled_c32(b, size1, uv);
+    return f4_lerpvs(va, vb, mip - m);
+}
+
+pim_inline float4 VEC_CALL TexSampleMip_xy16(
+    const Texture* pim_noalias tex,
+    float2 uv,
+    float mip)
+{
+    if (!tex->mips)
+    {
+        return UvBilinearWrap_xy16(tex->texels, tex->size, uv);
+    }
+    mip = f1_max(mip, 0.0f);
+    i32 m = (i32)mip;
+    int2 size0, size1;
+    short2 const *const pim_noalias a = GetTexMip(tex, m, &size0);
+    short2 const *const pim_noalias b = GetTexMip(tex, m + 1, &size1);
+    float4 va = UvBilinearWrapTiled_xy16(a, size0, uv);
+    if ((a == b) || (mip == m))
+    {
+        return va;
+    }
+    float4 vb = UvBilinearWrapTiled_xy16(b, size1, uv);
+    return f4_normalize3(f4_lerpvs(va, vb, mip - m));
+}
+
+pim_inline float4 VEC_CALL TexSample_c32(
+    const Texture* pim_noalias tex,
+    float2 uv,
+    float lod)
+{
+    return TexSampleMip_c32(tex, uv, GetTexMipLevel(tex, lod));
+}
+
+pim_inline float4 VEC_CALL TexSample_xy16(
+    const Texture* pim_noalias tex,
+    float2 uv,
+    float lod)
+{
+    return TexSampleMip_xy16(tex, uv, GetTexMipLevel(tex, lod));
+}
+
 pim_inline float4 VEC_CALL GetEmission(
     const PtScene* pim_noalias scene,
     float4 ro,
@@ -1310,7 +2714,7 @@ pim_inline float4 VEC_CALL GetEmission(
             Texture const *const tex = Texture_Get(mat->albedo);
             if (tex)
             {
-                albedo = UvBilinearWrap_c32(tex->texels, tex->size, uv);
+                albedo = TexSampleMip_c32(tex, uv, 0.0f);
             }
         }
         float e = 0.0f;
@@ -1318,7 +2722,7 @@ pim_inline float4 VEC_CALL GetEmission(
             Texture const *const tex = Texture_Get(mat->rome);
             if (tex)
             {
-                e = UvBilinearWrap_c32(tex->texels, tex->size, uv).w;
+                e = TexSampleMip_c32(tex, uv, 0.0f).w;
             }
         }
         return UnpackEmission(albedo, e);
@@ -1327,26 +2731,28 @@ pim_inline float4 VEC_CALL GetEmission(
 
 pim_inline float4 VEC_CALL SampleAlbedo(
     const Material* pim_noalias mat,
-    float2 uv)
+    float2 uv,
+    float lod)
 {
     float4 value = f4_1;
     Texture const *const pim_noalias tex = Texture_Get(mat->albedo);
     if (tex)
     {
-        value = UvBilinearWrap_c32(tex->texels, tex->size, uv);
+        value = TexSample_c32(tex, uv, lod);
     }
     return value;
 }
 
 pim_inline float4 VEC_CALL SampleRome(
     const Material* pim_noalias mat,
-    float2 uv)
+    float2 uv,
+    float lod)
 {
     float4 value = f4_v(0.5f, 1.0f, 0.0f, 0.0f);
     Texture const *const pim_noalias tex = Texture_Get(mat->rome);
     if (tex)
     {
-        value = UvBilinearWrap_c32(tex->texels, tex->size, uv);
+        value = TexSample_c32(tex, uv, lod);
     }
     return value;
 }
@@ -1363,12 +2769,13 @@ pim_inline float4 VEC_CALL FixShadingNormal(float4 M, float4 N)
 pim_inline float4 VEC_CALL SampleNormal(
     const Material* pim_noalias mat,
     float2 uv,
+    float lod,
     float4 N)
 {
     Texture const *const pim_noalias tex = Texture_Get(mat->normal);
     if (tex)
     {
-        float4 Nts = UvBilinearWrap_xy16(tex->texels, tex->size, uv);
+        float4 Nts = TexSample_xy16(tex, uv, lod);
         N = FixShadingNormal(N, TanToWorld(N, Nts));
     }
     return N;
@@ -1378,7 +2785,8 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     const PtScene* pim_noalias scene,
     float4 ro,
     float4 rd,
-    PtRayHit hit)
+    PtRayHit hit,
+    float coneWidth)
 {
     PtSurfHit surf;
     surf.type = hit.type;
@@ -1406,9 +2814,10 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     }
     else
     {
-        surf.N = SampleNormal(mat, uv, surf.N);
-        surf.albedo = SampleAlbedo(mat, uv);
-        float4 rome = SampleRome(mat, uv);
+        float lod = GetTexLod(scene, hit, rd, surf.M, coneWidth);
+        surf.N = SampleNormal(mat, uv, lod, surf.N);
+        surf.albedo = SampleAlbedo(mat, uv, lod);
+        float4 rome = SampleRome(mat, uv, lod);
         surf.emission = UnpackEmission(surf.albedo, rome.w);
         surf.roughness = rome.x;
         surf.occlusion = rome.y;
@@ -1418,22 +2827,24 @@ pim_inline PtSurfHit VEC_CALL GetSurface(
     return surf;
 }
 
-pim_inline PtRayHit VEC_CALL pt_intersect_local(
+pim_inline PtRayHit VEC_CALL RtcToHit(
     const PtScene* pim_noalias scene,
-    float4 ro,
     float4 rd,
-    float tNear,
+    float4 Ng,
+    u32 geomID,
+    u32 primID,
+    float u,
+    float v,
     float tFar)
 {
     PtRayHit hit = { 0 };
     hit.wuvt.w = -1.0f;
     hit.iVert = -1;
 
-    RTCRayHit rtcHit = RtcIntersect(scene->rtcScene, ro, rd, tNear, tFar);
-    hit.normal = f4_v(rtcHit.hit.Ng_x, rtcHit.hit.Ng_y, rtcHit.hit.Ng_z, 0.0f);
+    hit.normal = Ng;
     bool hitNothing =
-        (rtcHit.hit.geomID == RTC_INVALID_GEOMETRY_ID) ||
-        (rtcHit.ray.tfar <= 0.0f);
+        (geomID == RTC_INVALID_GEOMETRY_ID) ||
+        (tFar <= 0.0f);
     if (hitNothing)
     {
         hit.type = PtHit_Nothing;
@@ -1447,22 +2858,41 @@ pim_inline PtRayHit VEC_CALL pt_intersect_local(
     }
     hit.normal = f4_normalize3(hit.normal);
 
-    ASSERT(rtcHit.hit.primID != RTC_INVALID_GEOMETRY_ID);
-    i32 iVert = rtcHit.hit.primID * 3;
+    ASSERT(primID != RTC_INVALID_GEOMETRY_ID);
+    i32 iVert = primID * 3;
     ASSERT(iVert >= 0);
     ASSERT(iVert < scene->vertCount);
-    float u = f1_sat(rtcHit.hit.u);
-    float v = f1_sat(rtcHit.hit.v);
+    u = f1_sat(u);
+    v = f1_sat(v);
     float w = f1_sat(1.0f - (u + v));
-    float t = rtcHit.ray.tfar;
 
     hit.iVert = iVert;
-    hit.wuvt = f4_v(w, u, v, t);
+    hit.wuvt = f4_v(w, u, v, tFar);
     hit.flags = GetMaterial(scene, hit)->flags;
 
     return hit;
 }
 
+pim_inline PtRayHit VEC_CALL pt_intersect_local(
+    const PtScene* pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float tNear,
+    float tFar)
+{
+    ++PtContext_Get()->stats.rays;
+    RTCRayHit rtcHit = RtcIntersect(scene->rtcScene, ro, rd, tNear, tFar);
+    return RtcToHit(
+        scene,
+        rd,
+        f4_v(rtcHit.hit.Ng_x, rtcHit.hit.Ng_y, rtcHit.hit.Ng_z, 0.0f),
+        rtcHit.hit.geomID,
+        rtcHit.hit.primID,
+        rtcHit.hit.u,
+        rtcHit.hit.v,
+        rtcHit.ray.tfar);
+}
+
 PtRayHit VEC_CALL Pt_Intersect(
     const PtScene* pim_noalias scene,
     float4 ro,
@@ -1706,6 +3136,118 @@ pim_inline PtScatter VEC_CALL Scatter_Principled(
     return scatter;
 }
 
+// nearest reflection probe whose bounds contain P, or NULL
+pim_inline const Cubemap* VEC_CALL CacheCubemap(
+    const PtScene* pim_noalias scene,
+    float4 P)
+{
+    const Cubemaps* maps = Cubemaps_Get();
+    const Cubemap* nearest = NULL;
+    float nearestDist = 1 << 20;
+    for (i32 i = 0; i < maps->count; ++i)
+    {
+        const Cubemap* cm = &maps->cubemaps[i];
+        if ((cm == scene->sky) || (cm->mipCount <= 0) || !cm->convolved[0])
+        {
+            continue;
+        }
+        const Box3D bounds = maps->bounds[i];
+        if (!box_contains(bounds, P))
+        {
+            continue;
+        }
+        float dist = f4_distancesq3(P, box_center(bounds));
+        if (dist < nearestDist)
+        {
+            nearestDist = dist;
+            nearest = cm;
+        }
+    }
+    return nearest;
+}
+
+// outgoing luminance toward -rd from the baked lighting at the surface.
+// the lightmap's spherical gaussians hold all incoming light,
+// direct included, so the path ends here.
+pim_inline bool VEC_CALL CacheLookup(
+    const PtScene* pim_noalias scene,
+    const PtSurfHit* pim_noalias surf,
+    PtRayHit hit,
+    float4 rd,
+    float4* pim_noalias lumOut)
+{
+    const LmPack* pack = LmPack_Get();
+    if (!scene->lmIndices || (pack->lightmaps != scene->lmSource))
+    {
+        return false;
+    }
+    const i32 iTri = hit.iVert / 3;
+    const i32 iLightmap = scene->lmIndices[iTri];
+    if ((iLightmap < 0) || (iLightmap >= pack->lmCount))
+    {
+        return false;
+    }
+    const Lightmap* lightmap = &pack->lightmaps[iLightmap];
+    const float2* pim_noalias lmUvs = scene->lmUvs;
+    const i32 iVert = iTri * 3;
+    const float2 uv = f2_blend(lmUvs[iVert + 0], lmUvs[iVert + 1], lmUvs[iVert + 2], hit.wuvt);
+
+    // nearest texel, bilinear filtering would blend in unbaked texels at chart edges
+    const i32 size = lightmap->size;
+    const i32 x = i1_clamp((i32)(uv.x * size), 0, size - 1);
+    const i32 y = i1_clamp((i32)(uv.y * size), 0, size - 1);
+    const i32 iTexel = x + y * size;
+    if (!(lightmap->sampleCounts[iTexel] > 0.0f))
+    {
+        return false;
+    }
+
+    // the lobes were fit in the texel's basis, the shading normal only
+    // picks where they are evaluated
+    const float4 N = surf->N;
+    const float3x3 TBN = NormalToTBN(f4_normalize3(f3_f4(lightmap->normal[iTexel], 0.0f)));
+    float4 axii[kGiDirections];
+    float4 probes[kGiDirections];
+    for (i32 i = 0; i < kGiDirections; ++i)
+    {
+        float4 ax = kGiAxii[i];
+        float sharpness = ax.w;
+        ax = TbnToWorld(TBN, ax);
+        ax.w = sharpness;
+        axii[i] = ax;
+        probes[i] = lightmap->probes[i][iTexel];
+    }
+
+    const float4 V = f4_neg(rd);
+    const float4 R = f4_normalize3(f4_reflect3(rd, N));
+    const float4 diffuseGI = SGv_Irradiance(kGiDirections, axii, probes, N);
+    float4 specularGI;
+    const Cubemap* cm = NULL;
+    if (surf->roughness < kCacheGlossRoughness)
+    {
+        cm = CacheCubemap(scene, surf->P);
+    }
+    if (cm)
+    {
+        specularGI = Cubemap_ReadConvolved(cm, R, RoughnessToMip(surf->roughness));
+    }
+    else
+    {
+        specularGI = SGv_Eval(kGiDirections, axii, probes, R);
+    }
+
+    *lumOut = IndirectBRDF(
+        V,
+        N,
+        diffuseGI,
+        specularGI,
+        surf->albedo,
+        surf->roughness,
+        surf->metallic,
+        surf->occlusion);
+    return true;
+}
+
 pim_inline void VEC_CALL LightOnHit(
     PtScene* pim_noalias scene,
     float4 ro,
@@ -1721,8 +3263,8 @@ pim_inline void VEC_CALL LightOnHit(
     loglum = f1_clamp(loglum, 0.0f, 46.0f);
     u32 amt = (u32)(loglum * (0xff/46.0f) + 0.5f);
     i32 iGrid = Grid_Index(&scene->lightGrid, ro);
-    i32 iEmit = scene->vertToEmit[iVert];
-    if (iEmit >= 0)
+    i32 iEmit = scene->triangles[iVert / 3].emitId;
+    if ((iEmit >= 0) && load_i32(&scene->lightReady[iGrid], MO_Acquire))
     {
         Dist1D* pim_noalias dist = &scene->lightDists[iGrid];
         if (dist->length)
@@ -1732,29 +3274,37 @@ pim_inline void VEC_CALL LightOnHit(
     }
 }
 
+// published distribution of the cell at position, or the uniform fallback.
+// a cell may be published at any time, so resolve it once per shading point
+// and pass the same snapshot to LightSelect and LightSelectPdf.
+pim_inline const Dist1D* VEC_CALL GetLightDist(
+    const PtScene* pim_noalias scene,
+    float4 position)
+{
+    i32 iCell = Grid_Index(&scene->lightGrid, position);
+    if (load_i32(&scene->lightReady[iCell], MO_Acquire))
+    {
+        return &scene->lightDists[iCell];
+    }
+    return &scene->lightUniform;
+}
+
 pim_inline bool VEC_CALL LightSelect(
     PtContext* pim_noalias ctx,
     PtScene* pim_noalias scene,
-    float4 position,
+    const Dist1D* pim_noalias lights,
     i32* iVertOut,
     float* pdfOut)
 {
-    if (scene->emissiveCount == 0)
+    if ((scene->emissiveCount == 0) || !lights->length)
     {
         *iVertOut = -1;
         *pdfOut = 0.0f;
         return false;
     }
 
-    i32 iCell = Grid_Index(&scene->lightGrid, position);
-    const Dist1D* dist = scene->lightDists + iCell;
-    if (!dist->length)
-    {
-        return false;
-    }
-
-    i32 iEmit = Dist1D_SampleD(dist, Sample1D(ctx));
-    float pdf = Dist1D_PdfD(dist, iEmit);
+    i32 iEmit = Dist1D_SampleD(lights, Sample1D(ctx));
+    float pdf = Dist1D_PdfD(lights, iEmit);
 
     i32 iVert = scene->emitToVert[iEmit];
 
@@ -1765,19 +3315,14 @@ pim_inline bool VEC_CALL LightSelect(
 
 pim_inline float VEC_CALL LightSelectPdf(
     PtScene* pim_noalias scene,
-    i32 iVert,
-    float4 ro)
+    const Dist1D* pim_noalias lights,
+    i32 iVert)
 {
     float selectPdf = 1.0f;
-    i32 iGrid = Grid_Index(&scene->lightGrid, ro);
-    i32 iEmit = scene->vertToEmit[iVert];
-    if (iEmit >= 0)
+    i32 iEmit = scene->triangles[iVert / 3].emitId;
+    if ((iEmit >= 0) && lights->length)
     {
-        const Dist1D* pim_noalias dist = &scene->lightDists[iGrid];
-        if (dist->length)
-        {
-            selectPdf = Dist1D_PdfD(dist, iEmit);
-        }
+        selectPdf = Dist1D_PdfD(lights, iEmit);
     }
     return selectPdf;
 }
@@ -1809,6 +3354,7 @@ pim_inline PtLightSample VEC_CALL SampleLight(
     sample.direction = rd;
     sample.wuvt = wuv;
 
+    ++ctx->stats.lightSamples;
     PtRayHit hit = pt_intersect_local(scene, ro, rd, 0.0f, distance + 0.01f * kMilli);
     if ((hit.type != PtHit_Nothing) && (hit.iVert == iVert))
     {
@@ -1817,6 +3363,7 @@ pim_inline PtLightSample VEC_CALL SampleLight(
         sample.luminance = GetEmission(scene, ro, rd, hit, bounce);
         if (f4_sum3(sample.luminance) > kEpsilon)
         {
+            ++ctx->stats.lightHits;
             float4 Tr = CalcTransmittance(ctx, scene, ro, rd, hit.wuvt.w);
             sample.luminance = f4_mul(sample.luminance, Tr);
         }
@@ -1835,7 +3382,7 @@ pim_inline float VEC_CALL LightEvalPdf(
     ASSERT(IsUnitLength(rd));
     PtRayHit hit = pt_intersect_local(scene, ro, rd, 0.0f, kRcpEpsilon);
     float pdf = 0.0f;
-    if (hit.type != PtHit_Nothing)
+    if ((hit.type != PtHit_Nothing) && (scene->triangles[hit.iVert / 3].emitId >= 0))
     {
         float cosTheta = f1_abs(f4_dot3(rd, hit.normal));
         float area = GetArea(scene, hit.iVert);
@@ -1846,6 +3393,42 @@ pim_inline float VEC_CALL LightEvalPdf(
     return pdf;
 }
 
+// samples the sky cubemap, weighted against the bsdf sample that
+// continues the path and escapes in Pt_TraceRay
+pim_inline float4 VEC_CALL EstimateSky(
+    PtContext* pim_noalias ctx,
+    PtScene* pim_noalias scene,
+    const PtSurfHit* pim_noalias surf,
+    float4 I)
+{
+    float4 result = f4_0;
+    if (scene->skySize <= 0)
+    {
+        return result;
+    }
+
+    float4 rd = SampleSkyDir(ctx, scene);
+    const float skyPdf = rd.w;
+    rd.w = 0.0f;
+    if (skyPdf > kEpsilon)
+    {
+        float4 brdf = Eval_Principled(scene, surf, I, rd);
+        if (f4_hmax3(brdf) > kEpsilon)
+        {
+            ++ctx->stats.lightSamples;
+            PtRayHit hit = pt_intersect_local(scene, surf->P, rd, 0.0f, kRcpEpsilon);
+            // maps close the sky with brushes, which show the sky behind them
+            if ((hit.type == PtHit_Nothing) || (hit.flags & MatFlag_Sky))
+            {
+                ++ctx->stats.lightHits;
+                float4 Li = f4_mul(GetSky(scene, surf->P, rd), brdf);
+                result = f4_mulvs(Li, PowerHeuristic(skyPdf, brdf.w) / skyPdf);
+            }
+        }
+    }
+    return result;
+}
+
 pim_inline float4 VEC_CALL EstimateDirect(
     PtContext* pim_noalias ctx,
     PtScene* pim_noalias scene,
@@ -1865,11 +3448,12 @@ pim_inline float4 VEC_CALL EstimateDirect(
     ASSERT(surf->roughness <= 1.0f);
     const float pRough = f1_lerp(0.05f, 0.95f, surf->roughness);
     const float pSmooth = 1.0f - pRough;
+    const Dist1D* lights = GetLightDist(scene, ro);
     if (Sample1D(ctx) < pRough)
     {
         i32 iVert;
         float selectPdf;
-        if (LightSelect(ctx, scene, surf->P, &iVert, &selectPdf))
+        if (LightSelect(ctx, scene, lights, &iVert, &selectPdf))
         {
             if (srcHit->iVert != iVert)
             {
@@ -1903,7 +3487,7 @@ pim_inline float4 VEC_CALL EstimateDirect(
             float lightPdf = LightEvalPdf(scene, ro, rd, &hit) * pRough;
             if (lightPdf > kEpsilon)
             {
-                lightPdf *= LightSelectPdf(scene, hit.iVert, ro);
+                lightPdf *= LightSelectPdf(scene, lights, hit.iVert);
                 float4 Li = f4_mul(GetEmission(scene, ro, rd, hit, bounce), sample.attenuation);
                 if (f4_hmax3(Li) > kEpsilon)
                 {
@@ -1915,6 +3499,8 @@ pim_inline float4 VEC_CALL EstimateDirect(
         }
     }
 
+    result = f4_add(result, EstimateSky(ctx, scene, surf, I));
+
     return result;
 }
 
@@ -1928,7 +3514,7 @@ pim_inline bool VEC_CALL EvaluateLight(
 {
     i32 iVert;
     float selectPdf;
-    if (LightSelect(ctx, scene, P, &iVert, &selectPdf))
+    if (LightSelect(ctx, scene, GetLightDist(scene, P), &iVert, &selectPdf))
     {
         PtLightSample sample = SampleLight(ctx, scene, P, iVert, bounce);
         if (sample.pdf > kEpsilon)
@@ -2143,16 +3729,95 @@ static void media_desc_gui(PtMediaDesc* desc)
     }
 }
 
-pim_inline PtMedia VEC_CALL Media_Sample(
+static u64 media_desc_hash(const PtMediaDesc* desc)
+{
+    // only the parameters that media extinction depends upon
+    u64 hash = Fnv64Bias;
+    hash = Fnv64Bytes(&desc->constantMu, sizeof(desc->constantMu), hash);
+    hash = Fnv64Bytes(&desc->noiseMu, sizeof(desc->noiseMu), hash);
+    hash = Fnv64Bytes(&desc->absorption, sizeof(desc->absorption), hash);
+    hash = Fnv64Bytes(&desc->noiseOctaves, sizeof(desc->noiseOctaves), hash);
+    hash = Fnv64Bytes(&desc->noiseGain, sizeof(desc->noiseGain), hash);
+    hash = Fnv64Bytes(&desc->noiseLacunarity, sizeof(desc->noiseLacunarity), hash);
+    hash = Fnv64Bytes(&desc->noiseFreq, sizeof(desc->noiseFreq), hash);
+    hash = Fnv64Bytes(&desc->noiseScale, sizeof(desc->noiseScale), hash);
+    hash = Fnv64Bytes(&desc->noiseHeight, sizeof(desc->noiseHeight), hash);
+    hash = Fnv64Bytes(&desc->noiseRange, sizeof(desc->noiseRange), hash);
+    return hash;
+}
+
+typedef struct task_SetupMediaGrid_s
+{
+    Task task;
+    const PtMediaDesc* pim_noalias desc;
+    float* pim_noalias majorants;
+    Grid grid;
+} task_SetupMediaGrid;
+
+static void SetupMediaGridFn(void* pbase, i32 begin, i32 end)
+{
+    task_SetupMediaGrid* task = pbase;
+    const PtMediaDesc* pim_noalias desc = task->desc;
+    float* pim_noalias majorants = task->majorants;
+    const Grid grid = task->grid;
+
+    const float metersPerCell = 1.0f / grid.cellsPerMeter;
+    const float a = 1.0f + desc->absorption;
+    const float constantMu = f4_hmax3(desc->constantMu);
+    const float noiseMu = f4_hmax3(desc->noiseMu);
+    const float noiseLo = desc->noiseHeight - desc->noiseRange;
+    const float noiseHi = desc->noiseHeight + desc->noiseRange;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        // Media_Density is in [0, 1], and zero outside of the noise band
+        const float lo = Grid_Position(&grid, i).y - 0.5f * metersPerCell;
+        const bool inBand = ((lo + metersPerCell) >= noiseLo) && (lo <= noiseHi);
+        majorants[i] = (constantMu + (inBand ? noiseMu : 0.0f)) * a;
+    }
+}
+
+ProfileMark(pm_setupmediagrid, SetupMediaGrid)
+static void SetupMediaGrid(PtScene* pim_noalias scene)
+{
+    ProfileBegin(pm_setupmediagrid);
+
+    Mem_Free(scene->mediaMajorants);
+    scene->mediaMajorants = NULL;
+    scene->mediaHash = media_desc_hash(&scene->mediaDesc);
+
+    if (scene->vertCount > 0)
+    {
+        Box3D bounds = box_from_pts(scene->positions, scene->vertCount);
+        const float extent = f4_hmax3(f4_sub(bounds.hi, bounds.lo));
+        const float cellsPerMeter = kMediaGridCells / f1_max(extent, kMilli);
+        // pad by half a cell so that flat scenes still span a cell on each axis
+        const float4 pad = f4_s(0.5f / cellsPerMeter);
+        bounds.lo = f4_sub(bounds.lo, pad);
+        bounds.hi = f4_add(bounds.hi, pad);
+
+        Grid grid;
+        Grid_New(&grid, bounds, cellsPerMeter);
+        const i32 len = Grid_Len(&grid);
+        scene->mediaGrid = grid;
+        scene->mediaMajorants = Tex_Calloc(sizeof(scene->mediaMajorants[0]) * len);
+
+        task_SetupMediaGrid* task = Temp_Calloc(sizeof(*task));
+        task->desc = &scene->mediaDesc;
+        task->majorants = scene->mediaMajorants;
+        task->grid = grid;
+        Task_Run(&task->task, SetupMediaGridFn, len);
+    }
+
+    ProfileEnd(pm_setupmediagrid);
+}
+
+// density of the noise media in [0, 1]
+pim_inline float VEC_CALL Media_Density(
     const PtMediaDesc* pim_noalias desc,
     float4 P)
 {
-    PtMedia hit;
-    hit.scattering = desc->constantMu;
-    hit.g0 = desc->phaseDirA;
-    hit.g1 = desc->phaseDirB;
-    hit.gBlend = desc->phaseBlend;
-
+    float heightDensity = 0.0f;
     if (f1_distance(P.y, desc->noiseHeight) <= desc->noiseRange)
     {
         float noiseFreq = desc->noiseFreq;
@@ -2172,7 +3837,24 @@ pim_inline PtMedia VEC_CALL Media_Sample(
         float noiseScale = desc->noiseScale;
         float height = desc->noiseHeight + noiseScale * noise;
         float dist = f1_distance(P.y, height) / noiseScale;
-        float heightDensity = f1_sat(1.0f - dist);
+        heightDensity = f1_sat(1.0f - dist);
+    }
+    return heightDensity;
+}
+
+pim_inline PtMedia VEC_CALL Media_Sample(
+    const PtMediaDesc* pim_noalias desc,
+    float4 P)
+{
+    PtMedia hit;
+    hit.scattering = desc->constantMu;
+    hit.g0 = desc->phaseDirA;
+    hit.g1 = desc->phaseDirB;
+    hit.gBlend = desc->phaseBlend;
+
+    float heightDensity = Media_Density(desc, P);
+    if (heightDensity > 0.0f)
+    {
         float4 mu = f4_mulvs(desc->noiseMu, heightDensity);
         hit.scattering = f4_add(hit.scattering, mu);
     }
@@ -2195,6 +3877,129 @@ pim_inline float4 VEC_CALL CalcMajorant(const PtMediaDesc* pim_noalias desc)
     return f4_mulvs(f4_add(ca, na), 2.0f);
 }
 
+pim_inline void VEC_CALL MediaWalk_New(
+    PtMediaWalk* pim_noalias walk,
+    const PtScene* pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float rayLen)
+{
+    memset(walk, 0, sizeof(*walk));
+    walk->majorant = 1.0f / scene->mediaDesc.rcpMajorant;
+    walk->rayLen = rayLen;
+    walk->tEnter = rayLen;
+    walk->tExit = rayLen;
+    walk->majorants = scene->mediaMajorants;
+    if (!walk->majorants)
+    {
+        return;
+    }
+
+    const Grid grid = scene->mediaGrid;
+    const float4 rcpRd = f4_rcp(rd);
+    float2 nf = isectBox3D(ro, rcpRd, grid.bounds);
+    nf.x = f1_max(nf.x, 0.0f);
+    nf.y = f1_min(nf.y, rayLen);
+    if (nf.x >= nf.y)
+    {
+        return;
+    }
+    walk->tEnter = nf.x;
+    walk->tExit = nf.y;
+
+    // 3D DDA: https://www.flipcode.com/archives/A%20faster%20voxel%20traversal%20algorithm%20for%20ray%20tracing.pdf
+    const float metersPerCell = 1.0f / grid.cellsPerMeter;
+    const float4 P = f4_add(ro, f4_mulvs(rd, nf.x));
+    const float4 offset = f4_mulvs(f4_sub(P, grid.bounds.lo), grid.cellsPerMeter);
+    const int3 size = grid.size;
+    const int3 cell =
+    {
+        i1_clamp((i32)offset.x, 0, size.x - 1),
+        i1_clamp((i32)offset.y, 0, size.y - 1),
+        i1_clamp((i32)offset.z, 0, size.z - 1),
+    };
+    const int3 step =
+    {
+        (rd.x >= 0.0f) ? 1 : -1,
+        (rd.y >= 0.0f) ? 1 : -1,
+        (rd.z >= 0.0f) ? 1 : -1,
+    };
+    // next cell boundary along each axis
+    const float4 boundary =
+    {
+        grid.bounds.lo.x + (cell.x + (step.x > 0 ? 1 : 0)) * metersPerCell,
+        grid.bounds.lo.y + (cell.y + (step.y > 0 ? 1 : 0)) * metersPerCell,
+        grid.bounds.lo.z + (cell.z + (step.z > 0 ? 1 : 0)) * metersPerCell,
+        0.0f,
+    };
+    walk->size = size;
+    walk->cell = cell;
+    walk->step = step;
+    walk->tNext = f4_mul(f4_sub(boundary, ro), rcpRd);
+    walk->tDelta = f4_abs(f4_mulvs(rcpRd, metersPerCell));
+}
+
+// yields the next segment of the ray and its majorant, false once exhausted
+pim_inline bool VEC_CALL MediaWalk_Next(
+    PtMediaWalk* pim_noalias walk,
+    float* pim_noalias tBegin,
+    float* pim_noalias tEnd,
+    float* pim_noalias majorant)
+{
+    const float t = walk->t;
+    if (t >= walk->rayLen)
+    {
+        return false;
+    }
+    *tBegin = t;
+
+    // outside of the grid, fall back to the global majorant
+    if ((t < walk->tEnter) || (t >= walk->tExit))
+    {
+        float next = (t < walk->tEnter) ? walk->tEnter : walk->rayLen;
+        *tEnd = next;
+        *majorant = walk->majorant;
+        walk->t = next;
+        return true;
+    }
+
+    const int3 size = walk->size;
+    const int3 cell = walk->cell;
+    *majorant = walk->majorants[cell.x + cell.y * size.x + cell.z * size.x * size.y];
+
+    const float4 tNext = walk->tNext;
+    float next;
+    if ((tNext.x <= tNext.y) && (tNext.x <= tNext.z))
+    {
+        next = tNext.x;
+        walk->cell.x += walk->step.x;
+        walk->tNext.x += walk->tDelta.x;
+    }
+    else if (tNext.y <= tNext.z)
+    {
+        next = tNext.y;
+        walk->cell.y += walk->step.y;
+        walk->tNext.y += walk->tDelta.y;
+    }
+    else
+    {
+        next = tNext.z;
+        walk->cell.z += walk->step.z;
+        walk->tNext.z += walk->tDelta.z;
+    }
+    next = f1_clamp(next, t, walk->tExit);
+    const int3 c = walk->cell;
+    if ((c.x < 0) || (c.x >= size.x) ||
+        (c.y < 0) || (c.y >= size.y) ||
+        (c.z < 0) || (c.z >= size.z))
+    {
+        next = walk->tExit;
+    }
+    *tEnd = next;
+    walk->t = next;
+    return true;
+}
+
 pim_inline float VEC_CALL CalcPhase(
     PtMedia media,
     float cosTheta)
@@ -2228,22 +4033,32 @@ pim_inline float4 VEC_CALL CalcTransmittance(
     float rayLen)
 {
     const PtMediaDesc* pim_noalias desc = &scene->mediaDesc;
-    const float rcpMaj = desc->rcpMajorant;
-    float t = 0.0f;
     float4 attenuation = f4_1;
-    while (true)
+    PtMediaWalk walk;
+    MediaWalk_New(&walk, scene, ro, rd, rayLen);
+    float t, tEnd, majorant;
+    // free paths are memoryless, so each segment restarts at its own majorant
+    while (MediaWalk_Next(&walk, &t, &tEnd, &majorant))
     {
-        float dt = SampleFreePath(Sample1D(ctx), rcpMaj);
-        if ((t + dt) >= rayLen)
+        if (majorant <= 0.0f)
         {
-            break;
+            continue;
+        }
+        const float rcpMaj = 1.0f / majorant;
+        while (true)
+        {
+            float dt = SampleFreePath(Sample1D(ctx), rcpMaj);
+            if ((t + dt) >= tEnd)
+            {
+                break;
+            }
+            t += dt;
+            // ratio tracking
+            // https://jannovak.info/publications/VolumeCourse/novak18monte-sig-slides-4.2-transmittance-notes.pdf#page=7
+            PtMedia media = Media_Sample(desc, f4_add(ro, f4_mulvs(rd, t)));
+            float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
+            attenuation = f4_mul(attenuation, ratio);
         }
-        // ratio tracking
-        // https://jannovak.info/publications/VolumeCourse/novak18monte-sig-slides-4.2-transmittance-notes.pdf#page=7
-        PtMedia media = Media_Sample(desc, f4_add(ro, f4_mulvs(rd, t)));
-        float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
-        attenuation = f4_mul(attenuation, ratio);
-        t += dt;
     }
     return attenuation;
 }
@@ -2260,61 +4075,91 @@ pim_inline PtScatter VEC_CALL ScatterRay(
     result.pdf = 0.0f;
 
     PtMediaDesc const *const pim_noalias desc = &scene->mediaDesc;
-    const float rcpMaj = desc->rcpMajorant;
 
-    float t = 0.0f;
     result.attenuation = f4_1;
-    while (true)
+    PtMediaWalk walk;
+    MediaWalk_New(&walk, scene, ro, rd, rayLen);
+    float t, tEnd, majorant;
+    while (MediaWalk_Next(&walk, &t, &tEnd, &majorant))
     {
-        float dt = SampleFreePath(Sample1D(ctx), rcpMaj);
-        t += dt;
-        if (t >= rayLen)
+        if (majorant <= 0.0f)
         {
-            break;
+            continue;
         }
-
-        float4 P = f4_add(ro, f4_mulvs(rd, t));
-        PtMedia media = Media_Sample(desc, P);
-        float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
-        result.attenuation = f4_mul(result.attenuation, ratio);
-
-        float scatterProb = f4_hmax3(media.scattering) * rcpMaj;
-        if (Sample1D(ctx) < scatterProb)
+        const float rcpMaj = 1.0f / majorant;
+        while (true)
         {
-            float4 lum;
-            float4 L;
-            if (EvaluateLight(ctx, scene, P, &lum, &L, bounce))
+            float dt = SampleFreePath(Sample1D(ctx), rcpMaj);
+            t += dt;
+            if (t >= tEnd)
             {
-                float ph = CalcPhase(media, f4_dot3(rd, L));
-                lum = f4_mulvs(lum, ph * dt);
-                lum = f4_mul(result.attenuation, lum);
-                result.luminance = lum;
+                break;
             }
 
-            result.pos = P;
-            result.dir = SamplePhaseDir(ctx, scene, media, rd);
-            result.pdf = result.dir.w;
-            float ph = CalcPhase(media, f4_dot3(rd, result.dir));
-            result.attenuation = f4_mulvs(result.attenuation, ph);
-            break;
+            float4 P = f4_add(ro, f4_mulvs(rd, t));
+            PtMedia media = Media_Sample(desc, P);
+            float4 ratio = f4_inv(f4_mulvs(media.extinction, rcpMaj));
+            result.attenuation = f4_mul(result.attenuation, ratio);
+
+            float scatterProb = f4_hmax3(media.scattering) * rcpMaj;
+            if (Sample1D(ctx) < scatterProb)
+            {
+                ++ctx->stats.mediaScatters;
+                float4 lum;
+                float4 L;
+                if (EvaluateLight(ctx, scene, P, &lum, &L, bounce))
+                {
+                    float ph = CalcPhase(media, f4_dot3(rd, L));
+                    lum = f4_mulvs(lum, ph * dt);
+                    lum = f4_mul(result.attenuation, lum);
+                    result.luminance = lum;
+                }
+
+                result.pos = P;
+                result.dir = SamplePhaseDir(ctx, scene, media, rd);
+                result.pdf = result.dir.w;
+                float ph = CalcPhase(media, f4_dot3(rd, result.dir));
+                result.attenuation = f4_mulvs(result.attenuation, ph);
+                return result;
+            }
         }
     }
 
     return result;
 }
 
-PtResult VEC_CALL Pt_TraceRay(
+// widening of a ray cone after scattering off a surface of the given roughness
+pim_inline float VEC_CALL ConeScatterSpread(float roughness)
+{
+    return 0.5f * kPi * BrdfAlpha(roughness);
+}
+
+// spread angle of a ray cone through one pixel
+pim_inline float VEC_CALL PixelConeSpread(float2 slope, int2 size)
+{
+    return atanf((2.0f * slope.y) / size.y);
+}
+
+// firstHit, when given, is the intersection of the ray ro, rd
+pim_inline PtResult VEC_CALL TracePath(
     PtScene* pim_noalias scene,
     float4 ro,
-    float4 rd)
+    float4 rd,
+    float spread,
+    const PtRayHit* pim_noalias firstHit)
 {
     PtResult result = { 0 };
     float resultWeight = 0.0f;
     float4 luminance = f4_0;
     float4 attenuation = f4_1;
     u32 prevFlags = 0;
+    // pdf of the bsdf sample, when the previous vertex also sampled the sky
+    float skyMisPdf = 0.0f;
+    float coneWidth = 0.0f;
+    float coneSpread = spread;
 
     PtContext* pim_noalias ctx = PtContext_Get();
+    ++ctx->stats.paths;
 
     for (i32 b = 0; b < 666; ++b)
     {
@@ -2326,19 +4171,30 @@ PtResult VEC_CALL Pt_TraceRay(
             }
             else
             {
+                ++ctx->stats.rouletteKills;
                 break;
             }
         }
 
-        PtRayHit hit = pt_intersect_local(scene, ro, rd, 0.0f, kRcpEpsilon);
+        ++ctx->stats.bounces;
+        PtRayHit hit = ((b == 0) && firstHit) ?
+            *firstHit :
+            pt_intersect_local(scene, ro, rd, 0.0f, kRcpEpsilon);
         if (hit.type == PtHit_Nothing)
         {
             // TODO: toggle this off for lightmaps, on otherwise.
-            luminance = f4_add(luminance, f4_mul(attenuation, GetSky(scene, ro, rd)));
+            ++ctx->stats.escapes;
+            float4 sky = GetSky(scene, ro, rd);
+            if (skyMisPdf > 0.0f)
+            {
+                sky = f4_mulvs(sky, PowerHeuristic(skyMisPdf, SkyPdf(scene, rd)));
+            }
+            luminance = f4_add(luminance, f4_mul(attenuation, sky));
             break;
         }
         if ((hit.type == PtHit_Backface) && !(hit.flags & MatFlag_Refractive))
         {
+            ++ctx->stats.backfaceKills;
             break;
         }
 
@@ -2346,6 +4202,8 @@ PtResult VEC_CALL Pt_TraceRay(
             PtScatter scatter = ScatterRay(ctx, scene, ro, rd, hit.wuvt.w, b);
             if (scatter.pdf > kEpsilon)
             {
+                coneWidth += coneSpread * f4_distance3(ro, scatter.pos);
+                coneSpread += ConeScatterSpread(1.0f);
                 luminance = f4_add(luminance, f4_mul(attenuation, scatter.luminance));
                 attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
                 {
@@ -2358,6 +4216,7 @@ PtResult VEC_CALL Pt_TraceRay(
                 ro = scatter.pos;
                 rd = scatter.dir;
                 prevFlags = 0;
+                skyMisPdf = 0.0f;
                 continue;
             }
             else
@@ -2366,19 +4225,40 @@ PtResult VEC_CALL Pt_TraceRay(
             }
         }
 
-        PtSurfHit surf = GetSurface(scene, ro, rd, hit);
+        coneWidth += coneSpread * hit.wuvt.w;
+        PtSurfHit surf = GetSurface(scene, ro, rd, hit, coneWidth);
         if (b > 0)
         {
             LightOnHit(scene, ro, surf.emission, hit.iVert);
         }
 
+        if (hit.flags & MatFlag_Sky)
+        {
+            // a sky brush is an escape, weighted as one against EstimateSky
+            float4 sky = surf.emission;
+            if (skyMisPdf > 0.0f)
+            {
+                sky = f4_mulvs(sky, PowerHeuristic(skyMisPdf, SkyPdf(scene, rd)));
+            }
+            luminance = f4_add(luminance, f4_mul(attenuation, sky));
+            break;
+        }
         if ((b == 0) || (prevFlags & MatFlag_Refractive))
         {
             luminance = f4_add(luminance, f4_mul(surf.emission, attenuation));
         }
-        if (hit.flags & MatFlag_Sky)
+
+        if ((ctx->cacheBounce > 0) &&
+            (b >= ctx->cacheBounce) &&
+            !(surf.flags & MatFlag_Refractive))
         {
-            break;
+            float4 Lo;
+            if (CacheLookup(scene, &surf, hit, rd, &Lo))
+            {
+                ++ctx->stats.cacheHits;
+                luminance = f4_add(luminance, f4_mul(Lo, attenuation));
+                break;
+            }
         }
 
         {
@@ -2396,6 +4276,8 @@ PtResult VEC_CALL Pt_TraceRay(
 
         attenuation = f4_mul(attenuation, f4_divvs(scatter.attenuation, scatter.pdf));
         prevFlags = surf.flags;
+        skyMisPdf = (surf.flags & MatFlag_Refractive) ? 0.0f : scatter.pdf;
+        coneSpread += ConeScatterSpread(surf.roughness);
 
         {
             float4 a = f4_mulvs(attenuation, 1.0f / kPi);
@@ -2415,6 +4297,60 @@ PtResult VEC_CALL Pt_TraceRay(
     return result;
 }
 
+PtResult VEC_CALL Pt_TraceRay(
+    PtScene* pim_noalias scene,
+    float4 ro,
+    float4 rd,
+    float spread)
+{
+    return TracePath(scene, ro, rd, spread, NULL);
+}
+
+void VEC_CALL Pt_TracePacket(
+    PtScene* pim_noalias scene,
+    const float4* pim_noalias ros,
+    const float4* pim_noalias rds,
+    i32 count,
+    float spread,
+    PtResult* pim_noalias results)
+{
+    ASSERT(count >= 0);
+    ASSERT(count <= kPtPacket);
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // unused lanes repeat the last ray
+    float4 packetRos[kPtPacket];
+    float4 packetRds[kPtPacket];
+    for (i32 i = 0; i < kPtPacket; ++i)
+    {
+        const i32 j = i1_min(i, count - 1);
+        packetRos[i] = ros[j];
+        packetRos[i].w = 0.0f;
+        packetRds[i] = rds[j];
+        packetRds[i].w = kRcpEpsilon;
+    }
+
+    PtContext* pim_noalias ctx = PtContext_Get();
+    ctx->stats.rays += count;
+    const RTCRayHit16 rtcHits = RtcIntersect16(scene->rtcScene, packetRos, packetRds);
+    for (i32 i = 0; i < count; ++i)
+    {
+        const PtRayHit hit = RtcToHit(
+            scene,
+            rds[i],
+            f4_v(rtcHits.hit.Ng_x[i], rtcHits.hit.Ng_y[i], rtcHits.hit.Ng_z[i], 0.0f),
+            rtcHits.hit.geomID[i],
+            rtcHits.hit.primID[i],
+            rtcHits.hit.u[i],
+            rtcHits.hit.v[i],
+            rtcHits.ray.tfar[i]);
+        results[i] = TracePath(scene, ros[i], rds[i], spread, &hit);
+    }
+}
+
 pim_inline Ray VEC_CALL CalculateDof(
     PtContext* pim_noalias ctx,
     const PtDofInfo* pim_noalias dof,
@@ -2462,9 +4398,13 @@ static void UpdateDistsFn(void* pbase, i32 begin, i32 end)
     TaskUpdateDists*const pim_noalias task = pbase;
     PtScene*const pim_noalias scene = task->scene;
     Dist1D*const pim_noalias dists = scene->lightDists;
+    i32 const *const pim_noalias ready = scene->lightReady;
     for (i32 i = begin; i < end; ++i)
     {
-        Dist1D_Update(&dists[i]);
+        if (load_i32(&ready[i], MO_Acquire))
+        {
+            Dist1D_Update(&dists[i]);
+        }
     }
 }
 
@@ -2509,6 +4449,7 @@ typedef struct PtTraceTask_s
     const PtDofInfo* pim_noalias dof;
     PtScene* pim_noalias scene;
     PtTrace* pim_noalias trace;
+    i32 cacheBounce;
 } PtTraceTask;
 
 static void TraceFn(void* pbase, i32 begin, i32 end)
@@ -2523,6 +4464,7 @@ static void TraceFn(void* pbase, i32 begin, i32 end)
     float3* const pim_noalias colors = trace->color;
     float3* const pim_noalias albedos = trace->albedo;
     float3* const pim_noalias normals = trace->normal;
+    float2* const pim_noalias heats = trace->heat;
 
     const int2 size = trace->imageSize;
     const float2 rcpSize = f2_rcp(i2_f2(size));
@@ -2533,9 +4475,11 @@ static void TraceFn(void* pbase, i32 begin, i32 end)
     const float4 up = quat_up(rot);
     const float4 fwd = quat_fwd(rot);
     const float2 slope = proj_slope(f1_radians(camera->fovy), (float)size.x / (float)size.y);
+    const float spread = PixelConeSpread(slope, size);
     const float sampleWeight = trace->sampleWeight;
 
     PtContext* pim_noalias ctx = PtContext_Get();
+    ctx->cacheBounce = task->cacheBounce;
     for (i32 i = begin; i < end; ++i)
     {
         const int2 coord = { i % size.x, i / size.x };
@@ -2546,11 +4490,20 @@ static void TraceFn(void* pbase, i32 begin, i32 end)
         Ray ray = { eye, proj_dir(right, up, fwd, slope, f2_snorm(rayUv)) };
         ray = CalculateDof(ctx, dof, right, up, fwd, ray);
 
-        PtResult result = Pt_TraceRay(scene, ray.ro, ray.rd);
+        const u64 raysBegin = ctx->stats.rays;
+        const u64 bouncesBegin = ctx->stats.bounces;
+        PtResult result = Pt_TraceRay(scene, ray.ro, ray.rd, spread);
         colors[i] = f3_lerpvs(colors[i], result.color, sampleWeight);
         albedos[i] = f3_lerpvs(albedos[i], result.albedo, sampleWeight);
         normals[i] = f3_lerpvs(normals[i], result.normal, sampleWeight);
+        const float2 heat =
+        {
+            (float)(ctx->stats.rays - raysBegin),
+            (float)(ctx->stats.bounces - bouncesBegin),
+        };
+        heats[i] = f2_lerpvs(heats[i], heat, sampleWeight);
     }
+    ctx->cacheBounce = 0;
 }
 
 ProfileMark(pm_trace, Pt_Trace)
@@ -2573,21 +4526,376 @@ void Pt_Trace(
     PtScene_Update(scene);
     DofUpdate(dof, scene, camera);
 
-    PtTraceTask* pim_noalias task = Temp_Calloc(sizeof(*task));
-    task->dof = dof;
-    task->scene = scene;
-    task->camera = camera;
-    task->trace = trace;
-    const i32 workSize = trace->imageSize.x * trace->imageSize.y;
-    Task_Run(task, TraceFn, workSize);
+    if (ConVar_GetBool(&cv_pt_mlt))
+    {
+        Pt_TraceMlt(trace, dof, scene, camera);
+    }
+    else
+    {
+        PtTraceTask* pim_noalias task = Temp_Calloc(sizeof(*task));
+        task->dof = dof;
+        task->scene = scene;
+        task->camera = camera;
+        task->trace = trace;
+        task->cacheBounce = ConVar_GetInt(&cv_pt_cache_bounce);
+        const i32 workSize = trace->imageSize.x * trace->imageSize.y;
+        Task_Run(task, TraceFn, workSize);
+    }
 
     ProfileEnd(pm_trace);
 }
 
+// ----------------------------------------------------------------------------
+// metropolis light transport
+
+typedef struct PtMltView_s
+{
+    float4 eye;
+    float4 right;
+    float4 up;
+    float4 fwd;
+    float2 slope;
+    int2 size;
+    float spread;
+} PtMltView;
+
+typedef struct PtMltTask_s
+{
+    Task task;
+    PtMltView view;
+    const PtDofInfo* pim_noalias dof;
+    PtScene* pim_noalias scene;
+    PtMlt* pim_noalias mlt;
+    i32 mutations;
+    i32 cacheBounce;
+} PtMltTask;
+
+typedef struct PtMltResolveTask_s
+{
+    Task task;
+    PtMlt* pim_noalias mlt;
+    PtTrace* pim_noalias trace;
+    float scale;
+} PtMltResolveTask;
+
+static void PtMlt_New(PtMlt* mlt, i32 texelCount)
+{
+    memset(mlt, 0, sizeof(*mlt));
+    const i32 chainCount = Task_ThreadCount() * kMltChainsPerThread;
+    mlt->chainCount = chainCount;
+    mlt->texelCount = texelCount;
+    mlt->chains = Perm_Calloc(sizeof(mlt->chains[0]) * chainCount);
+    for (i32 i = 0; i < chainCount; ++i)
+    {
+        MarkovSampler_New(&mlt->chains[i].sampler, kMltSampleCount);
+    }
+    mlt->splatColor = Tex_Calloc(sizeof(mlt->splatColor[0]) * texelCount);
+    mlt->splatAlbedo = Tex_Calloc(sizeof(mlt->splatAlbedo[0]) * texelCount);
+    mlt->splatNormal = Tex_Calloc(sizeof(mlt->splatNormal[0]) * texelCount);
+    mlt->splatWeight = Tex_Calloc(sizeof(mlt->splatWeight[0]) * texelCount);
+    mlt->splatHeat = Tex_Calloc(sizeof(mlt->splatHeat[0]) * texelCount);
+}
+
+static void PtMlt_Del(PtMlt* mlt)
+{
+    if (mlt->chains)
+    {
+        for (i32 i = 0; i < mlt->chainCount; ++i)
+        {
+            MarkovSampler_Del(&mlt->chains[i].sampler);
+        }
+    }
+    Mem_Free(mlt->chains);
+    Mem_Free(mlt->splatColor);
+    Mem_Free(mlt->splatAlbedo);
+    Mem_Free(mlt->splatNormal);
+    Mem_Free(mlt->splatWeight);
+    Mem_Free(mlt->splatHeat);
+    memset(mlt, 0, sizeof(*mlt));
+}
+
+static PtMltView MltView_New(const Camera* pim_noalias camera, int2 size)
+{
+    PtMltView view;
+    const quat rot = camera->rotation;
+    view.eye = camera->position;
+    view.right = quat_right(rot);
+    view.up = quat_up(rot);
+    view.fwd = quat_fwd(rot);
+    view.slope = proj_slope(f1_radians(camera->fovy), (float)size.x / (float)size.y);
+    view.size = size;
+    view.spread = PixelConeSpread(view.slope, size);
+    return view;
+}
+
+pim_inline float VEC_CALL MltLum(PtResult result)
+{
+    return f4_avglum(f3_f4(result.color, 0.0f));
+}
+
+// the first two primary samples select the film position,
+// so small mutations walk the image plane as well as the path.
+pim_inline PtResult VEC_CALL MltTracePath(
+    PtContext* pim_noalias ctx,
+    const PtMltTask* pim_noalias task,
+    i32* pim_noalias iPixelOut)
+{
+    const PtMltView* pim_noalias view = &task->view;
+    const int2 size = view->size;
+    const float2 rayUv = Sample2D(ctx);
+    const int2 coord =
+    {
+        i1_clamp((i32)(rayUv.x * size.x), 0, size.x - 1),
+        i1_clamp((i32)(rayUv.y * size.y), 0, size.y - 1),
+    };
+    *iPixelOut = coord.x + coord.y * size.x;
+
+    Ray ray = { view->eye, proj_dir(view->right, view->up, view->fwd, view->slope, f2_snorm(rayUv)) };
+    ray = CalculateDof(ctx, task->dof, view->right, view->up, view->fwd, ray);
+    return Pt_TraceRay(task->scene, ray.ro, ray.rd, view->spread);
+}
+
+pim_inline void VEC_CALL MltSplat(
+    PtMlt* pim_noalias mlt,
+    i32 iPixel,
+    PtResult result,
+    float lumWeight,
+    float guideWeight)
+{
+    if (lumWeight > 0.0f)
+    {
+        f3_add_atomic(&mlt->splatColor[iPixel], f3_mulvs(result.color, lumWeight));
+    }
+    if (guideWeight > 0.0f)
+    {
+        f3_add_atomic(&mlt->splatAlbedo[iPixel], f3_mulvs(result.albedo, guideWeight));
+        f3_add_atomic(&mlt->splatNormal[iPixel], f3_mulvs(result.normal, guideWeight));
+        f1_add_atomic(&mlt->splatWeight[iPixel], guideWeight);
+    }
+}
+
+// picks each chain's seed path from a set of large steps with
+// probability proportional to luminance, and sums their luminance
+// to estimate the integral of the image.
+static void MltBootstrapFn(void* pbase, i32 begin, i32 end)
+{
+    PtMltTask* pim_noalias task = pbase;
+    PtMltChain* pim_noalias chains = task->mlt->chains;
+    PtContext* pim_noalias ctx = PtContext_Get();
+    ctx->cacheBounce = task->cacheBounce;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        PtMltChain* pim_noalias chain = &chains[i];
+        MarkovSampler* pim_noalias sampler = &chain->sampler;
+        MarkovSampler_Reset(sampler);
+        ctx->markov = sampler;
+
+        float sum = 0.0f;
+        chain->currentLum = 0.0f;
+        chain->iPixel = 0;
+        memset(&chain->current, 0, sizeof(chain->current));
+        for (i32 j = 0; j < kMltBootstrapPerChain; ++j)
+        {
+            MarkovSampler_StartIteration(sampler, 1.0f);
+            i32 iPixel;
+            PtResult result = MltTracePath(ctx, task, &iPixel);
+            float lum = MltLum(result);
+            sum += lum;
+            if ((lum > 0.0f) && (Prng_f32(&ctx->rng) * sum < lum))
+            {
+                MarkovSampler_Accept(sampler);
+                chain->current = result;
+                chain->currentLum = lum;
+                chain->iPixel = iPixel;
+            }
+            else
+            {
+                MarkovSampler_Reject(sampler);
+            }
+        }
+        chain->bootstrapSum = sum;
+
+        ctx->markov = NULL;
+    }
+    ctx->cacheBounce = 0;
+}
+
+static void MltMutateFn(void* pbase, i32 begin, i32 end)
+{
+    PtMltTask* pim_noalias task = pbase;
+    PtMlt* pim_noalias mlt = task->mlt;
+    PtMltChain* pim_noalias chains = mlt->chains;
+    const i32 mutations = task->mutations;
+    float2* pim_noalias splatHeat = mlt->splatHeat;
+    PtContext* pim_noalias ctx = PtContext_Get();
+    ctx->cacheBounce = task->cacheBounce;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        PtMltChain* pim_noalias chain = &chains[i];
+        MarkovSampler* pim_noalias sampler = &chain->sampler;
+        ctx->markov = sampler;
+
+        for (i32 j = 0; j < mutations; ++j)
+        {
+            MarkovSampler_StartIteration(sampler, kMltLargeStepProb);
+            i32 iPixel;
+            const u64 raysBegin = ctx->stats.rays;
+            const u64 bouncesBegin = ctx->stats.bounces;
+            PtResult proposed = MltTracePath(ctx, task, &iPixel);
+            float proposedLum = MltLum(proposed);
+            const float2 heat =
+            {
+                (float)(ctx->stats.rays - raysBegin),
+                (float)(ctx->stats.bounces - bouncesBegin),
+            };
+            f2_add_atomic(&splatHeat[iPixel], heat);
+            float currentLum = chain->currentLum;
+
+            // expected value splatting of both states
+            float accept = Markov_AcceptProb(proposedLum, currentLum);
+            MltSplat(
+                mlt, chain->iPixel, chain->current,
+                Markov_CurrentWeight(accept, currentLum),
+                1.0f - accept);
+            MltSplat(
+                mlt, iPixel, proposed,
+                Markov_ProposedWeight(accept, proposedLum),
+                accept);
+
+            if (Prng_f32(&ctx->rng) < accept)
+            {
+                MarkovSampler_Accept(sampler);
+                chain->current = proposed;
+                chain->currentLum = proposedLum;
+                chain->iPixel = iPixel;
+            }
+            else
+            {
+                MarkovSampler_Reject(sampler);
+            }
+        }
+
+        ctx->markov = NULL;
+    }
+    ctx->cacheBounce = 0;
+}
+
+static void MltResolveFn(void* pbase, i32 begin, i32 end)
+{
+    PtMltResolveTask* pim_noalias task = pbase;
+    PtMlt* pim_noalias mlt = task->mlt;
+    PtTrace* pim_noalias trace = task->trace;
+    const float scale = task->scale;
+    const float sampleWeight = trace->sampleWeight;
+
+    float3* pim_noalias splatColor = mlt->splatColor;
+    float3* pim_noalias splatAlbedo = mlt->splatAlbedo;
+    float3* pim_noalias splatNormal = mlt->splatNormal;
+    float* pim_noalias splatWeight = mlt->splatWeight;
+    float2* pim_noalias splatHeat = mlt->splatHeat;
+    float3* pim_noalias colors = trace->color;
+    float3* pim_noalias albedos = trace->albedo;
+    float3* pim_noalias normals = trace->normal;
+    float2* pim_noalias heats = trace->heat;
+
+    for (i32 i = begin; i < end; ++i)
+    {
+        colors[i] = f3_lerpvs(colors[i], f3_mulvs(splatColor[i], scale), sampleWeight);
+        float weight = splatWeight[i];
+        if (weight > kEpsilon)
+        {
+            float rcpWeight = 1.0f / weight;
+            albedos[i] = f3_lerpvs(albedos[i], f3_mulvs(splatAlbedo[i], rcpWeight), sampleWeight);
+            normals[i] = f3_lerpvs(normals[i], f3_mulvs(splatNormal[i], rcpWeight), sampleWeight);
+        }
+        // work spent at the pixel this frame. with about one mutation per
+        // pixel per frame, this is comparable to the per sample heat of TraceFn.
+        heats[i] = f2_lerpvs(heats[i], splatHeat[i], sampleWeight);
+        splatColor[i] = f3_0;
+        splatAlbedo[i] = f3_0;
+        splatNormal[i] = f3_0;
+        splatWeight[i] = 0.0f;
+        splatHeat[i] = f2_0;
+    }
+}
+
+ProfileMark(pm_tracemlt, Pt_TraceMlt)
+static void Pt_TraceMlt(
+    PtTrace* pim_noalias trace,
+    PtDofInfo* pim_noalias dof,
+    PtScene* pim_noalias scene,
+    const Camera* pim_noalias camera)
+{
+    ProfileBegin(pm_tracemlt);
+
+    const int2 size = trace->imageSize;
+    const i32 texelCount = size.x * size.y;
+
+    bool bootstrap = trace->sampleWeight >= 1.0f;
+    PtMlt* mlt = trace->mlt;
+    if (!mlt)
+    {
+        mlt = Perm_Calloc(sizeof(*mlt));
+        PtMlt_New(mlt, texelCount);
+        trace->mlt = mlt;
+        bootstrap = true;
+    }
+    else if (mlt->texelCount != texelCount)
+    {
+        PtMlt_Del(mlt);
+        PtMlt_New(mlt, texelCount);
+        bootstrap = true;
+    }
+
+    const i32 chainCount = mlt->chainCount;
+    const PtMltView view = MltView_New(camera, size);
+    const i32 cacheBounce = ConVar_GetInt(&cv_pt_cache_bounce);
+
+    if (bootstrap)
+    {
+        PtMltTask* pim_noalias task = Temp_Calloc(sizeof(*task));
+        task->view = view;
+        task->dof = dof;
+        task->scene = scene;
+        task->mlt = mlt;
+        task->cacheBounce = cacheBounce;
+        Task_Run(task, MltBootstrapFn, chainCount);
+
+        float sum = 0.0f;
+        for (i32 i = 0; i < chainCount; ++i)
+        {
+            sum += mlt->chains[i].bootstrapSum;
+        }
+        mlt->bootstrap = sum / (chainCount * kMltBootstrapPerChain);
+    }
+
+    // roughly one mutation per pixel per frame
+    const i32 mutations = i1_max(1, texelCount / chainCount);
+    PtMltTask* pim_noalias task = Temp_Calloc(sizeof(*task));
+    task->view = view;
+    task->dof = dof;
+    task->scene = scene;
+    task->mlt = mlt;
+    task->mutations = mutations;
+    task->cacheBounce = cacheBounce;
+    Task_Run(task, MltMutateFn, chainCount);
+
+    PtMltResolveTask* pim_noalias resolve = Temp_Calloc(sizeof(*resolve));
+    resolve->mlt = mlt;
+    resolve->trace = trace;
+    resolve->scale = (mlt->bootstrap * texelCount) / ((float)mutations * chainCount);
+    Task_Run(resolve, MltResolveFn, texelCount);
+
+    ProfileEnd(pm_tracemlt);
+}
+
 typedef struct PtRayGenTask_s
 {
     Task task;
     float4 origin;
+    float spread;
     PtScene* pim_noalias scene;
     float4* pim_noalias colors;
     float4* pim_noalias directions;
@@ -2606,7 +4914,7 @@ static void RayGenFn(void* pBase, i32 begin, i32 end)
     {
         float4 rd = SampleUnitSphere(Sample2D(ctx));
         directions[i] = rd;
-        PtResult result = Pt_TraceRay(scene, ro, rd);
+        PtResult result = Pt_TraceRay(scene, ro, rd, task->spread);
         colors[i] = f3_f4(result.color, 0.0f);
     }
 }
@@ -2627,6 +4935,8 @@ PtResults Pt_RayGen(
     PtRayGenTask* pim_noalias task = Temp_Calloc(sizeof(*task));
     task->scene = scene;
     task->origin = origin;
+    // solid angle of the sphere divided among the rays
+    task->spread = sqrtf((4.0f * kPi) / i1_max(count, 1));
     task->colors = Temp_Alloc(sizeof(task->colors[0]) * count);
     task->directions = Temp_Alloc(sizeof(task->directions[0]) * count);
 
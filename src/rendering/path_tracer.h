@@ -11,6 +11,8 @@ typedef struct Camera_s Camera;
 typedef struct Task_s Task;
 
 typedef struct PtScene_s PtScene;
+typedef struct PtMlt_s PtMlt;
+typedef struct Crate_s Crate;
 
 typedef enum
 {
@@ -47,10 +49,28 @@ typedef struct PtTrace_s
     float3* pim_noalias albedo;
     float3* pim_noalias normal;
     float3* pim_noalias denoised;
+    // x: rays per sample, y: bounces per sample
+    float2* pim_noalias heat;
+    // metropolis chain state, created on demand when cv_pt_mlt is enabled
+    PtMlt* mlt;
     int2 imageSize;
     float sampleWeight;
 } PtTrace;
 
+typedef struct PtStats_s
+{
+    u64 rays;
+    u64 paths;
+    u64 bounces;
+    u64 rouletteKills;
+    u64 backfaceKills;
+    u64 escapes;
+    u64 mediaScatters;
+    u64 lightSamples;
+    u64 lightHits;
+    u64 cacheHits;
+} PtStats;
+
 typedef struct PtResult_s
 {
     float3 color;
@@ -67,11 +87,32 @@ typedef struct PtResults_s
 void PtSys_Init(void);
 void PtSys_Update(void);
 void PtSys_Shutdown(void);
+// resets the per-thread sample generators, for reproducible runs
+void PtSys_Seed(u32 seed);
+// total rays intersected since init
+u64 PtSys_RayCount(void);
+// sum of all threads' counters since init
+void PtSys_GetStats(PtStats* dst);
+// counters accumulated over the previous frame
+void PtSys_GetFrameStats(PtStats* dst);
+// rebuilds the sky's sampling distribution on the next scene update
+void PtSys_MarkSkyDirty(void);
+// drops the emission cache and any scene data staged from a crate,
+// so the next scene is built from scratch
+void PtSys_ClearCaches(void);
 
 PtScene* PtScene_New(void);
 void PtScene_Update(PtScene* scene);
 void PtScene_Del(PtScene* scene);
 void PtScene_Gui(PtScene* scene);
+// blocks until background work on the scene has completed
+void PtScene_Finish(PtScene* scene);
+
+// persists the flattened geometry, emissives and light grid of the scene,
+// keyed by a content hash of the entities they were derived from.
+bool PtScene_Save(Crate* crate, PtScene* scene);
+// stages derived scene data for the next scene build with matching entities.
+bool PtScene_Load(Crate* crate);
 
 void PtTrace_New(PtTrace* trace, int2 imageSize);
 void PtTrace_Del(PtTrace* trace);
@@ -86,10 +127,26 @@ PtRayHit VEC_CALL Pt_Intersect(
     float tNear,
     float tFar);
 
+// spread: ray cone spread angle in radians, selects texture mips
 PtResult VEC_CALL Pt_TraceRay(
     PtScene* pim_noalias scene,
     float4 ro,
-    float4 rd);
+    float4 rd,
+    float spread);
+
+// width of the coherent packets traced by Pt_TracePacket
+#define kPtPacket 16
+
+// traces up to kPtPacket paths as Pt_TraceRay would.
+// the first bounce of all paths is intersected as one packet,
+// so rays with nearby origins and directions trace fastest.
+void VEC_CALL Pt_TracePacket(
+    PtScene* pim_noalias scene,
+    const float4* pim_noalias ros,
+    const float4* pim_noalias rds,
+    i32 count,
+    float spread,
+    PtResult* pim_noalias results);
 
 void Pt_Trace(
     PtTrace* pim_noalias trace,
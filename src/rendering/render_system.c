@@ -23,6 +23,7 @@
 #include "math/float3_funcs.h"
 #include "math/float2_funcs.h"
 #include "math/float4x4_funcs.h"
+#include "math/quat_funcs.h"
 #include "math/box.h"
 #include "math/color.h"
 #include "math/sdf.h"
@@ -44,6 +45,7 @@
 #include "rendering/cubemap.h"
 #include "rendering/drawable.h"
 #include "rendering/lightmap.h"
+#include "rendering/lightmap_dist.h"
 #include "rendering/denoise.h"
 #include "rendering/rtcdraw.h"
 #include "rendering/exposure.h"
@@ -84,10 +86,22 @@ static PtTrace ms_trace;
 static PtDofInfo ms_dof;
 
 static i32 ms_lmSampleCount;
+// last tenth of lightmap bake progress logged by the batch
+static i32 ms_lmProgressStep;
+// map that lightmap bake checkpoints are named after, empty when unnamed
+static char ms_mapName[PIM_PATH];
+static u64 ms_lmCheckpointTick;
 static i32 ms_acSampleCount;
 static i32 ms_ptSampleCount;
 static i32 ms_cmapSampleCount;
 
+// bumped whenever path tracer accumulation restarts
+static u32 ms_ptEpoch;
+// epoch of the image in ms_trace.denoised
+static u32 ms_denoiseEpoch;
+static i32 ms_denoiseSample;
+static u64 ms_denoiseTick;
+
 // ----------------------------------------------------------------------------
 
 static FrameBuf* GetFrontBuf(void)
@@ -148,6 +162,7 @@ static bool EnsurePtTrace(void)
     {
         PtTrace_Del(&ms_trace);
         PtTrace_New(&ms_trace, i2_v(width, height));
+        ms_denoiseEpoch = 0;
     }
     return true;
 }
@@ -165,6 +180,7 @@ static void ShutdownPtScene(void)
 static void LightmapShutdown(void)
 {
     LmPack_Del(LmPack_Get());
+    ms_mapName[0] = 0;
 }
 
 static void LightmapRepack(void)
@@ -175,6 +191,63 @@ static void LightmapRepack(void)
     LmPack_Del(LmPack_Get());
     LmPack pack = LmPack_Pack(1024, ConVar_GetFloat(&cv_lm_density), 0.1f, 15.0f);
     *LmPack_Get() = pack;
+    ms_lmCheckpointTick = Time_Now();
+}
+
+static bool LightmapCheckpointPath(char* dst, i32 size)
+{
+    if (!ms_mapName[0] || (ConVar_GetFloat(&cv_lm_checkpoint) <= 0.0f))
+    {
+        return false;
+    }
+    SPrintf(dst, size, "data/%s.lmbake.crate", ms_mapName);
+    return true;
+}
+
+// continues an interrupted bake of the map, if it was at the current density
+static bool LightmapResume(void)
+{
+    char path[PIM_PATH] = { 0 };
+    if (!EnsurePtScene() || !LightmapCheckpointPath(ARGS(path)))
+        return false;
+
+    LmPack* pack = LmPack_Get();
+    if (LmPack_Resume(pack, path))
+    {
+        if (pack->texelsPerMeter == ConVar_GetFloat(&cv_lm_density))
+        {
+            ms_lmCheckpointTick = Time_Now();
+            return true;
+        }
+        LmPack_Del(pack);
+    }
+    return false;
+}
+
+// writes the lightmaps baked since the last checkpoint every lm_checkpoint
+// seconds, or now and to completion when forced
+static void LightmapCheckpoint(bool force)
+{
+    char path[PIM_PATH] = { 0 };
+    if (!LightmapCheckpointPath(ARGS(path)))
+        return;
+
+    const u64 now = Time_Now();
+    if (force)
+    {
+        LmPack_AwaitCheckpoint();
+    }
+    if (force || (Time_Sec(now - ms_lmCheckpointTick) >= ConVar_GetFloat(&cv_lm_checkpoint)))
+    {
+        if (LmPack_Checkpoint(LmPack_Get(), path))
+        {
+            ms_lmCheckpointTick = now;
+        }
+    }
+    if (force)
+    {
+        LmPack_AwaitCheckpoint();
+    }
 }
 
 ProfileMark(pm_Lightmap_Trace, Lightmap_Trace)
@@ -188,26 +261,18 @@ static void Lightmap_Trace(void)
     {
         bool dirty = LmPack_Get()->lmCount == 0;
         dirty |= ConVar_GetFloat(&cv_lm_density) != LmPack_Get()->texelsPerMeter;
-        if (dirty)
+        if (dirty && !LightmapResume())
         {
             LightmapRepack();
         }
 
         float timeslice = 1.0f / ConVar_GetInt(&cv_lm_timeslice);
         i32 spp = ConVar_GetInt(&cv_lm_spp);
-        LmPack_Bake(ms_ptscene, timeslice, spp);
+        LmPack_Bake(ms_ptscene, timeslice, spp, ConVar_GetFloat(&cv_lm_error));
+        LightmapCheckpoint(false);
 
-        static u64 s_lastUpload;
-        u64 now = Time_Now();
-        if (Time_Sec(now - s_lastUpload) > 10.0)
-        {
-            s_lastUpload = now;
-            LmPack* pack = LmPack_Get();
-            for (i32 i = 0; i < pack->lmCount; ++i)
-            {
-                Lightmap_Upload(&pack->lightmaps[i]);
-            }
-        }
+        // trickle baked tiles to the gpu instead of hitching on whole lightmaps
+        LmPack_Upload(LmPack_Get(), ConVar_GetInt(&cv_lm_upload_kb) << 10);
     }
     ProfileEnd(pm_Lightmap_Trace);
 }
@@ -272,6 +337,83 @@ static void TaskBlitNormalFn(void* pbase, i32 begin, i32 end)
     }
 }
 
+typedef struct TaskBlitHeat_s
+{
+    Task task;
+    const float2* pim_noalias src;
+    float4* pim_noalias dst;
+    i32 channel;
+} TaskBlitHeat;
+
+// heat at which the ramp saturates, in rays or bounces per sample
+#define kHeatMax 32.0f
+
+static void TaskBlitHeatFn(void* pbase, i32 begin, i32 end)
+{
+    TaskBlitHeat* task = pbase;
+    const float2* pim_noalias src = task->src;
+    float4* pim_noalias dst = task->dst;
+    const i32 channel = task->channel;
+    const float4 ramp[] =
+    {
+        { 0.0f, 0.0f, 1.0f, 1.0f },
+        { 0.0f, 1.0f, 1.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f, 1.0f },
+        { 1.0f, 1.0f, 0.0f, 1.0f },
+        { 1.0f, 0.0f, 0.0f, 1.0f },
+    };
+    const float scale = (NELEM(ramp) - 1) / log2f(1.0f + kHeatMax);
+    for (i32 i = begin; i < end; ++i)
+    {
+        float heat = channel ? src[i].y : src[i].x;
+        float t = f1_clamp(log2f(1.0f + heat) * scale, 0.0f, NELEM(ramp) - 1.0f);
+        i32 j = i1_min((i32)t, NELEM(ramp) - 2);
+        dst[i] = f4_lerpvs(ramp[j], ramp[j + 1], t - j);
+    }
+}
+
+// keeps the denoiser working on its own thread while tracing continues.
+// returns false if the denoiser failed.
+static bool DenoiseAsync(void)
+{
+    u32 tag = 0;
+    DenoiseStatus status = Denoise_Poll(ms_trace.imageSize, ms_trace.denoised, &tag);
+    switch (status)
+    {
+    default:
+        break;
+    case DenoiseStatus_Failed:
+        return false;
+    case DenoiseStatus_Busy:
+        return true;
+    case DenoiseStatus_Complete:
+        ms_denoiseEpoch = tag;
+        break;
+    }
+
+    // denoise a restarted accumulation right away,
+    // then every pt_denoise_spp samples or pt_denoise_ms milliseconds
+    bool due = ms_denoiseEpoch != ms_ptEpoch;
+    due |= (ms_ptSampleCount - ms_denoiseSample) >= ConVar_GetInt(&cv_pt_denoise_spp);
+    due |= Time_Milli(Time_Now() - ms_denoiseTick) >= ConVar_GetFloat(&cv_pt_denoise_ms);
+    if (due)
+    {
+        bool submitted = Denoise_Submit(
+            DenoiseType_Image,
+            ms_trace.imageSize,
+            ms_trace.color,
+            ms_trace.albedo,
+            ms_trace.normal,
+            ms_ptEpoch);
+        if (submitted)
+        {
+            ms_denoiseSample = ms_ptSampleCount;
+            ms_denoiseTick = Time_Now();
+        }
+    }
+    return true;
+}
+
 ProfileMark(pm_PathTrace, PathTrace)
 ProfileMark(pm_ptBlit, Blit)
 static bool PathTrace(void)
@@ -286,8 +428,10 @@ static bool PathTrace(void)
             Camera camera;
             Camera_Get(&camera);
 
+            static u32 s_mltLap;
             bool dirty = false;
             dirty |= ConVar_CheckDirty(&cv_pt_trace, &s_lap);
+            dirty |= ConVar_CheckDirty(&cv_pt_mlt, &s_mltLap);
             dirty |= memcmp(&camera, &ms_ptcam, sizeof(camera));
 
             if (dirty)
@@ -297,6 +441,10 @@ static bool PathTrace(void)
             }
         }
 
+        if (ms_ptSampleCount == 0)
+        {
+            ++ms_ptEpoch;
+        }
         ms_trace.sampleWeight = 1.0f / ++ms_ptSampleCount;
         const int2 size = ms_trace.imageSize;
         const i32 texCount = size.x * size.y;
@@ -305,20 +453,13 @@ static bool PathTrace(void)
         float3* pim_noalias output3 = ms_trace.color;
         if (ConVar_GetBool(&cv_pt_denoise))
         {
-            bool denoised = Denoise(
-                DenoiseType_Image,
-                size,
-                ms_trace.color,
-                ms_trace.albedo,
-                ms_trace.normal,
-                ms_trace.denoised);
-
-            if (!denoised)
+            if (!DenoiseAsync())
             {
                 ConVar_SetBool(&cv_pt_denoise, false);
             }
-            else
+            else if (ms_denoiseEpoch == ms_ptEpoch)
             {
+                // latest completed denoise of this accumulation
                 output3 = ms_trace.denoised;
             }
         }
@@ -339,6 +480,17 @@ static bool PathTrace(void)
 
                 output3 = NULL;
             }
+            const i32 heatmap = ConVar_GetInt(&cv_pt_heatmap);
+            if (heatmap)
+            {
+                TaskBlitHeat* task = Temp_Calloc(sizeof(*task));
+                task->src = ms_trace.heat;
+                task->dst = GetFrontBuf()->light;
+                task->channel = heatmap - 1;
+                Task_Run(task, TaskBlitHeatFn, texCount);
+
+                output3 = NULL;
+            }
 
             if (output3)
             {
@@ -489,6 +641,7 @@ static void BakeSky(void)
         task->sunLum = f3_s(sunLum);
         task->steps = ConVar_GetInt(&cv_r_sun_steps);
         Task_Run(&task->task, BakeSkyFn, Cubeface_COUNT * size * size);
+        PtSys_MarkSkyDirty();
         ms_ptSampleCount = 0;
     }
 }
@@ -585,6 +738,7 @@ void RenderSys_Shutdown(void)
     EntSys_Shutdown();
     PtSys_Shutdown();
     FrameBuf_Del(GetFrontBuf());
+    Denoise_Shutdown();
 
     TextureSys_Shutdown();
     MeshSys_Shutdown();
@@ -592,6 +746,320 @@ void RenderSys_Shutdown(void)
     vkrSys_Shutdown();
 }
 
+// ----------------------------------------------------------------------------
+// headless batch: bakes and traces a map on the cpu without a window or gpu
+
+typedef enum
+{
+    BatchStage_Lightmap = 0,
+    BatchStage_Cubemap,
+    BatchStage_Trace,
+    BatchStage_Save,
+    // baking lightmap texels for a coordinator, see LmDist_Join
+    BatchStage_Work,
+
+    BatchStage_COUNT
+} BatchStage;
+
+static RenderBatch ms_batch;
+static BatchStage ms_batchStage;
+static u64 ms_batchStart;
+static bool ms_batchFailed;
+static char ms_batchOutput[PIM_PATH];
+
+static bool BatchTimeout(void)
+{
+    return (ms_batch.seconds > 0.0f) &&
+        (Time_Sec(Time_Now() - ms_batchStart) >= ms_batch.seconds);
+}
+
+static void BatchNextStage(void)
+{
+    ++ms_batchStage;
+    ms_batchStart = Time_Now();
+}
+
+// returns true once the stage is finished
+static bool BatchLightmap(void)
+{
+    if (ms_batch.lmSpp <= 0)
+    {
+        return true;
+    }
+    if (ms_lmSampleCount == 0)
+    {
+        if (!LightmapResume())
+        {
+            LightmapRepack();
+        }
+        ms_lmProgressStep = 0;
+        LmDist_Serve(ms_batch.lmServe, ms_batch.lmWorkers);
+    }
+    // lmSpp caps the samples of the noisiest texels, the rest stop at lm_error
+    const i32 spp = i1_min(ConVar_GetInt(&cv_lm_spp), ms_batch.lmSpp - ms_lmSampleCount);
+    const float progress = LmDist_Bake(ms_ptscene, 1.0f, spp, ConVar_GetFloat(&cv_lm_error));
+    ms_lmSampleCount += spp;
+    const i32 step = (i32)(progress * 10.0f);
+    if (step > ms_lmProgressStep)
+    {
+        ms_lmProgressStep = step;
+        Con_Logf(LogSev_Info, "batch", "Lightmaps %d%% converged after %d spp", step * 10, ms_lmSampleCount);
+    }
+    const bool done = (progress >= 1.0f) || (ms_lmSampleCount >= ms_batch.lmSpp) || BatchTimeout();
+    LightmapCheckpoint(done);
+    if (done)
+    {
+        LmDist_Shutdown();
+    }
+    return done;
+}
+
+static bool BatchCubemap(void)
+{
+    if (ms_batch.cmSpp <= 0)
+    {
+        return true;
+    }
+    Guid skyname = Guid_FromStr("sky");
+    Cubemaps* maps = Cubemaps_Get();
+    float weight = 1.0f / ++ms_cmapSampleCount;
+    for (i32 i = 0; i < maps->count; ++i)
+    {
+        Cubemap* cubemap = maps->cubemaps + i;
+        if (!Guid_Equal(maps->names[i], skyname))
+        {
+            Cubemap_Bake(cubemap, ms_ptscene, box_center(maps->bounds[i]), weight);
+        }
+        Cubemap_Convolve(cubemap, 64, weight);
+    }
+    return (ms_cmapSampleCount >= ms_batch.cmSpp) || BatchTimeout();
+}
+
+static bool BatchWriteTrace(void)
+{
+    const int2 size = ms_trace.imageSize;
+    const float3* pim_noalias output3 = ms_trace.color;
+    if (ms_batch.denoise &&
+        Denoise(
+            DenoiseType_Image,
+            size,
+            ms_trace.color,
+            ms_trace.albedo,
+            ms_trace.normal,
+            ms_trace.denoised))
+    {
+        output3 = ms_trace.denoised;
+    }
+
+    char filename[PIM_PATH] = { 0 };
+    SPrintf(ARGS(filename), "screenshots/%s.hdr", ms_batch.output);
+    IO_MkDir("screenshots");
+    stbi_flip_vertically_on_write(1);
+    if (stbi_write_hdr(filename, size.x, size.y, 3, &output3[0].x))
+    {
+        Con_Logf(LogSev_Info, "batch", "Wrote '%s' at %d spp", filename, ms_ptSampleCount);
+        return true;
+    }
+    Con_Logf(LogSev_Error, "batch", "Failed to write '%s'", filename);
+    return false;
+}
+
+static bool BatchTrace(void)
+{
+    if (ms_batch.ptSpp <= 0)
+    {
+        return true;
+    }
+    if (!ms_trace.color)
+    {
+        PtTrace_New(&ms_trace, ms_batch.size);
+        Camera_Get(&ms_ptcam);
+        ms_ptSampleCount = 0;
+    }
+    ms_trace.sampleWeight = 1.0f / ++ms_ptSampleCount;
+    Pt_Trace(&ms_trace, &ms_dof, ms_ptscene, &ms_ptcam);
+    if ((ms_ptSampleCount >= ms_batch.ptSpp) || BatchTimeout())
+    {
+        ms_batchFailed |= !BatchWriteTrace();
+        return true;
+    }
+    return false;
+}
+
+static bool BatchSave(void)
+{
+    if (!ms_batch.output)
+    {
+        return true;
+    }
+    const char* args[] = { "mapsave", ms_batch.output };
+    return CmdSaveMap(NELEM(args), args) == cmdstat_ok;
+}
+
+bool RenderSys_InitHeadless(void)
+{
+    TextureSys_Init();
+    MeshSys_Init();
+    PtSys_Init();
+    EntSys_Init();
+    ms_batchStage = BatchStage_COUNT;
+    return true;
+}
+
+bool RenderSys_LoadMap(const char* name)
+{
+    ASSERT(name);
+    bool loaded = false;
+    if (StrICmp(name, PIM_PATH, "cornell_box") == 0)
+    {
+        const char* args[] = { "cornell_box", "spheres" };
+        loaded = CmdCornellBox(NELEM(args), args) == cmdstat_ok;
+    }
+    else
+    {
+        const char* args[] = { "mapload", name };
+        loaded = CmdLoadMap(NELEM(args), args) == cmdstat_ok;
+    }
+    if (loaded)
+    {
+        StrCpy(ARGS(ms_mapName), name);
+        Entities_UpdateTransforms(Entities_Get());
+        BakeSky();
+    }
+    else
+    {
+        Con_Logf(LogSev_Error, "batch", "Failed to load map '%s'", name);
+    }
+    return loaded;
+}
+
+bool RenderSys_BeginBatch(const RenderBatch* batch)
+{
+    ASSERT(batch);
+    ASSERT(batch->map);
+    ms_batch = *batch;
+    ms_batch.size.x = i1_max(ms_batch.size.x, 1);
+    ms_batch.size.y = i1_max(ms_batch.size.y, 1);
+    if (!ms_batch.output)
+    {
+        // never overwrite the map's own crate by default
+        SPrintf(ARGS(ms_batchOutput), "%s_batch", ms_batch.map);
+        ms_batch.output = ms_batchOutput;
+    }
+    ms_batchStage = BatchStage_Lightmap;
+    ms_batchFailed = false;
+
+    if (!RenderSys_LoadMap(ms_batch.map))
+    {
+        ms_batchStage = BatchStage_COUNT;
+        ms_batchFailed = true;
+        return false;
+    }
+
+    if (ms_batch.setCamera)
+    {
+        Camera camera;
+        Camera_Get(&camera);
+        camera.position = ms_batch.eye;
+        camera.position.w = 1.0f;
+        const float4 rd = f4_normalize3(f4_sub(ms_batch.at, ms_batch.eye));
+        camera.rotation = quat_lookat(rd, f4_v(0.0f, 1.0f, 0.0f, 0.0f));
+        Camera_Set(&camera);
+    }
+
+    if (ms_batch.lmJoin)
+    {
+        // workers only bake what the coordinator sends them
+        ms_batchStage = BatchStage_Work;
+        if (!LmDist_Join(ms_batch.lmJoin))
+        {
+            ms_batchStage = BatchStage_COUNT;
+            ms_batchFailed = true;
+            return false;
+        }
+    }
+
+    ms_batchStart = Time_Now();
+    return true;
+}
+
+ProfileMark(pm_updateheadless, RenderSys_UpdateHeadless)
+bool RenderSys_UpdateHeadless(void)
+{
+    ProfileBegin(pm_updateheadless);
+
+    Entities_UpdateTransforms(Entities_Get());
+    TextureSys_Update();
+    MeshSys_Update();
+    PtSys_Update();
+    EntSys_Update();
+    BakeSky();
+
+    bool running = EnsurePtScene();
+    ms_batchFailed |= !running;
+    if (running)
+    {
+        switch (ms_batchStage)
+        {
+        default:
+            running = false;
+            break;
+        case BatchStage_Lightmap:
+            if (BatchLightmap())
+            {
+                BatchNextStage();
+            }
+            break;
+        case BatchStage_Cubemap:
+            if (BatchCubemap())
+            {
+                BatchNextStage();
+            }
+            break;
+        case BatchStage_Trace:
+            if (BatchTrace())
+            {
+                BatchNextStage();
+            }
+            break;
+        case BatchStage_Save:
+            ms_batchFailed |= !BatchSave();
+            ms_batchStage = BatchStage_COUNT;
+            break;
+        case BatchStage_Work:
+            if (!LmDist_Work(ms_ptscene))
+            {
+                ms_batchStage = BatchStage_COUNT;
+            }
+            break;
+        }
+    }
+
+    ProfileEnd(pm_updateheadless);
+    return running;
+}
+
+bool RenderSys_BatchFailed(void)
+{
+    return ms_batchFailed;
+}
+
+void RenderSys_ShutdownHeadless(void)
+{
+    LmDist_Shutdown();
+    ShutdownPtScene();
+    LightmapShutdown();
+
+    EntSys_Shutdown();
+    PtSys_Shutdown();
+    Denoise_Shutdown();
+
+    TextureSys_Shutdown();
+    MeshSys_Shutdown();
+}
+
+// ----------------------------------------------------------------------------
+
 ProfileMark(pm_gui, RenderSys_Gui)
 void RenderSys_Gui(bool* pEnabled)
 {
@@ -1448,6 +1916,10 @@ static cmdstat_t CmdLoadMap(i32 argc, const char** argv)
             loaded = true;
             loaded &= Entities_Load(crate, Entities_Get());
             loaded &= LmPack_Load(crate, LmPack_Get());
+            if (!PtScene_Load(crate))
+            {
+                Con_Logf(LogSev_Info, "cmd", "mapload found no path tracer data in '%s'.", name);
+            }
             loaded &= Crate_Close(crate);
         }
     }
@@ -1462,6 +1934,7 @@ static cmdstat_t CmdLoadMap(i32 argc, const char** argv)
     {
         Entities_UpdateTransforms(Entities_Get());
         Entities_UpdateBounds(Entities_Get());
+        StrCpy(ARGS(ms_mapName), name);
         Con_Logf(LogSev_Info, "cmd", "mapload loaded '%s'.", name);
         return cmdstat_ok;
     }
@@ -1498,6 +1971,10 @@ static cmdstat_t CmdSaveMap(i32 argc, const char** argv)
         saved = true;
         saved &= Entities_Save(crate, Entities_Get());
         saved &= LmPack_Save(crate, LmPack_Get());
+        if (ms_ptscene)
+        {
+            saved &= PtScene_Save(crate, ms_ptscene);
+        }
         saved &= Crate_Close(crate);
     }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common/macro.h"
+#include "math/types.h"
 
 PIM_C_BEGIN
 
@@ -14,4 +15,39 @@ void RenderSys_Gui(bool* pEnabled);
 
 FrameBuf* RenderSys_FrontBuf(void);
 
+typedef struct RenderBatch_s
+{
+    // map name, or "cornell_box"
+    const char* map;
+    // output name of the crate and image, defaults to "<map>_batch"
+    const char* output;
+    // sample budgets per stage, a stage is skipped when zero
+    i32 lmSpp;
+    i32 cmSpp;
+    i32 ptSpp;
+    // time budget per stage in seconds, unlimited when zero
+    float seconds;
+    int2 size;
+    bool denoise;
+    bool setCamera;
+    float4 eye;
+    float4 at;
+    // coordinator: port to serve the lightmap bake on, and workers to wait for
+    u16 lmServe;
+    i32 lmWorkers;
+    // worker: "host:port" of a coordinator to bake lightmaps for, then exit
+    const char* lmJoin;
+} RenderBatch;
+
+// headless rendering: cpu side systems only, no window or gpu
+bool RenderSys_InitHeadless(void);
+void RenderSys_ShutdownHeadless(void);
+// loads a map by name, or the cornell box
+bool RenderSys_LoadMap(const char* name);
+bool RenderSys_BeginBatch(const RenderBatch* batch);
+// returns false once the batch has finished
+bool RenderSys_UpdateHeadless(void);
+// true when loading, tracing or saving the batch failed
+bool RenderSys_BatchFailed(void);
+
 PIM_C_END
@@ -235,6 +235,71 @@ pim_inline float2 VEC_CALL BilinearInvert(int2 size, int2 coord)
     return uv;
 }
 
+// ----------------------------------------------------------------------------
+// block linear layout: 4x4 texel tiles, row major within and between tiles.
+// a tile of 32 bit texels fills one 64 byte cache line.
+
+#define kTexTileShift   2
+#define kTexTileSize    (1 << kTexTileShift)
+#define kTexTileMask    (kTexTileSize - 1)
+#define kTexTileLen     (kTexTileSize * kTexTileSize)
+
+pim_inline i32 VEC_CALL CalcTileCount1D(i32 size)
+{
+    return (size + kTexTileMask) >> kTexTileShift;
+}
+
+pim_inline i32 VEC_CALL TiledIndex2D(int2 size, int2 coord)
+{
+    i32 tile = (coord.y >> kTexTileShift) * CalcTileCount1D(size.x) + (coord.x >> kTexTileShift);
+    i32 inner = ((coord.y & kTexTileMask) << kTexTileShift) | (coord.x & kTexTileMask);
+    return (tile << (2 * kTexTileShift)) | inner;
+}
+
+pim_inline i32 VEC_CALL CalcTiledLen(int2 size)
+{
+    return CalcTileCount1D(size.x) * CalcTileCount1D(size.y) * kTexTileLen;
+}
+
+pim_inline i32 VEC_CALL CalcTiledMipOffset(int2 size, i32 m)
+{
+    i32 y = 0;
+    m = i1_clamp(m, 0, CalcMipCount(size) - 1);
+    for (i32 i = 0; i < m; ++i)
+    {
+        y += CalcTiledLen(CalcMipSize(size, i));
+    }
+    return y;
+}
+
+pim_inline i32 VEC_CALL TiledMipChainLen(int2 size)
+{
+    return CalcTiledMipOffset(size, CalcMipCount(size) - 1) +
+        CalcTiledLen(CalcMipSize(size, CalcMipCount(size) - 1));
+}
+
+pim_inline i32 VEC_CALL PointWrapTiled2D(int2 size, float2 uv)
+{
+    return TiledIndex2D(size, PointWrap2D(size, uv));
+}
+
+pim_inline bilinear_t VEC_CALL BilinearWrapTiled(int2 size, float2 uv)
+{
+    uv.x = (uv.x >= 0.0f) ? uv.x : (1.0f - uv.x);
+    uv.y = (uv.y >= 0.0f) ? uv.y : (1.0f - uv.y);
+    uv = f2_frac(uv);
+    linear_t x = LinearClamp(size.x, uv.x);
+    linear_t y = LinearClamp(size.y, uv.y);
+    bilinear_t b;
+    b.frac.x = x.t;
+    b.frac.y = y.t;
+    b.a = TiledIndex2D(size, (int2) { x.a, y.a });
+    b.b = TiledIndex2D(size, (int2) { x.b, y.a });
+    b.c = TiledIndex2D(size, (int2) { x.a, y.b });
+    b.d = TiledIndex2D(size, (int2) { x.b, y.b });
+    return b;
+}
+
 // ----------------------------------------------------------------------------
 
 pim_inline float4 VEC_CALL BilinearBlend_c32(
@@ -378,6 +443,12 @@ pim_inline float4 VEC_CALL UvBilinearWrap_c32(
     return Bilinear_c32(buffer, size, BilinearWrap(size, uv));
 }
 
+pim_inline float4 VEC_CALL UvBilinearWrapTiled_c32(
+    R8G8B8A8_t const *const pim_noalias buffer, int2 size, float2 uv)
+{
+    return Bilinear_c32(buffer, size, BilinearWrapTiled(size, uv));
+}
+
 // ----------------------------------------------------------------------------
 
 pim_inline float4 VEC_CALL UvBilinearClamp_xy16(
@@ -390,6 +461,11 @@ pim_inline float4 VEC_CALL UvBilinearWrap_xy16(
 {
     return Bilinear_xy16(buffer, size, BilinearWrap(size, uv));
 }
+pim_inline float4 VEC_CALL UvBilinearWrapTiled_xy16(
+    short2 const *const pim_noalias buffer, int2 size, float2 uv)
+{
+    return Bilinear_xy16(buffer, size, BilinearWrapTiled(size, uv));
+}
 
 // ----------------------------------------------------------------------------
 
@@ -46,10 +46,131 @@ static bool IsCurrent(TextureId id)
 static void FreeTexture(Texture* tex)
 {
     Mem_Free(tex->texels);
-    vkrTexTable_Free(tex->slot);
+    Mem_Free(tex->mips);
+    if (vkrSys_Active())
+    {
+        vkrTexTable_Free(tex->slot);
+    }
     memset(tex, 0, sizeof(*tex));
 }
 
+static void GenMips_c32(
+    R8G8B8A8_t* pim_noalias dst, int2 dstSize,
+    R8G8B8A8_t const *const pim_noalias src, int2 srcSize)
+{
+    for (i32 y = 0; y < dstSize.y; ++y)
+    {
+        i32 y0 = i1_min(y * 2 + 0, srcSize.y - 1);
+        i32 y1 = i1_min(y * 2 + 1, srcSize.y - 1);
+        for (i32 x = 0; x < dstSize.x; ++x)
+        {
+            i32 x0 = i1_min(x * 2 + 0, srcSize.x - 1);
+            i32 x1 = i1_min(x * 2 + 1, srcSize.x - 1);
+            float4 sum = GammaDecode_rgba8(src[TiledIndex2D(srcSize, (int2) { x0, y0 })]);
+            sum = f4_add(sum, GammaDecode_rgba8(src[TiledIndex2D(srcSize, (int2) { x1, y0 })]));
+            sum = f4_add(sum, GammaDecode_rgba8(src[TiledIndex2D(srcSize, (int2) { x0, y1 })]));
+            sum = f4_add(sum, GammaDecode_rgba8(src[TiledIndex2D(srcSize, (int2) { x1, y1 })]));
+            dst[TiledIndex2D(dstSize, (int2) { x, y })] = GammaEncode_rgba8(f4_mulvs(sum, 0.25f));
+        }
+    }
+}
+
+static void GenMips_xy16(
+    short2* pim_noalias dst, int2 dstSize,
+    short2 const *const pim_noalias src, int2 srcSize)
+{
+    for (i32 y = 0; y < dstSize.y; ++y)
+    {
+        i32 y0 = i1_min(y * 2 + 0, srcSize.y - 1);
+        i32 y1 = i1_min(y * 2 + 1, srcSize.y - 1);
+        for (i32 x = 0; x < dstSize.x; ++x)
+        {
+            i32 x0 = i1_min(x * 2 + 0, srcSize.x - 1);
+            i32 x1 = i1_min(x * 2 + 1, srcSize.x - 1);
+            float4 sum = Xy16ToNormalTs(src[TiledIndex2D(srcSize, (int2) { x0, y0 })]);
+            sum = f4_add(sum, Xy16ToNormalTs(src[TiledIndex2D(srcSize, (int2) { x1, y0 })]));
+            sum = f4_add(sum, Xy16ToNormalTs(src[TiledIndex2D(srcSize, (int2) { x0, y1 })]));
+            sum = f4_add(sum, Xy16ToNormalTs(src[TiledIndex2D(srcSize, (int2) { x1, y1 })]));
+            dst[TiledIndex2D(dstSize, (int2) { x, y })] = NormalTsToXy16(sum);
+        }
+    }
+}
+
+// swizzles linear 32 bit texels into the tiled layout.
+// padding texels of partial tiles repeat the edge.
+static void TileTexels(
+    u32* pim_noalias dst,
+    u32 const *const pim_noalias src,
+    int2 size)
+{
+    const i32 tilesX = CalcTileCount1D(size.x);
+    const i32 tilesY = CalcTileCount1D(size.y);
+    for (i32 ty = 0; ty < tilesY; ++ty)
+    {
+        for (i32 tx = 0; tx < tilesX; ++tx)
+        {
+            u32* pim_noalias tile = dst + (ty * tilesX + tx) * kTexTileLen;
+            for (i32 iy = 0; iy < kTexTileSize; ++iy)
+            {
+                i32 y = i1_min(ty * kTexTileSize + iy, size.y - 1);
+                for (i32 ix = 0; ix < kTexTileSize; ++ix)
+                {
+                    i32 x = i1_min(tx * kTexTileSize + ix, size.x - 1);
+                    tile[iy * kTexTileSize + ix] = src[y * size.x + x];
+                }
+            }
+        }
+    }
+}
+
+// builds the tiled cpu mip chain, box filtered in the same space the path tracer samples in.
+ProfileMark(pm_genmips, GenMips)
+static void GenMips(Texture* tex)
+{
+    Mem_Free(tex->mips);
+    tex->mips = NULL;
+
+    switch (tex->format)
+    {
+    default:
+        return;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R16G16_SNORM:
+        break;
+    }
+
+    ProfileBegin(pm_genmips);
+
+    ASSERT(vkrFormatToBpp(tex->format) == 32);
+    const int2 size = tex->size;
+    const i32 mipCount = CalcMipCount(size);
+    u32* pim_noalias mips = Tex_Alloc(sizeof(mips[0]) * TiledMipChainLen(size));
+    tex->mips = mips;
+
+    TileTexels(mips, tex->texels, size);
+
+    const u32* pim_noalias src = mips;
+    int2 srcSize = size;
+    for (i32 m = 1; m < mipCount; ++m)
+    {
+        u32* pim_noalias dst = mips + CalcTiledMipOffset(size, m);
+        int2 dstSize = CalcMipSize(size, m);
+        if (tex->format == VK_FORMAT_R16G16_SNORM)
+        {
+            GenMips_xy16((short2*)dst, dstSize, (const short2*)src, srcSize);
+        }
+        else
+        {
+            GenMips_c32((R8G8B8A8_t*)dst, dstSize, (const R8G8B8A8_t*)src, srcSize);
+        }
+        src = dst;
+        srcSize = dstSize;
+    }
+
+    ProfileEnd(pm_genmips);
+}
+
 Table const *const Texture_GetTable(void)
 {
     return &ms_table;
@@ -132,18 +253,24 @@ bool Texture_New(
         {
             i32 width = tex->size.x;
             i32 height = tex->size.y;
-            tex->slot = vkrTexTable_Alloc(
-                VK_IMAGE_VIEW_TYPE_2D,
-                format,
-                clamp,
-                width,
-                height,
-                1, // depth
-                1, // layers
-                true); // mips
-            i32 bytes = (width * height * vkrFormatToBpp(format)) / 8;
-            if (vkrTexTable_Upload(tex->slot, 0, tex->texels, bytes))
+            bool uploaded = true;
+            if (vkrSys_Active())
+            {
+                tex->slot = vkrTexTable_Alloc(
+                    VK_IMAGE_VIEW_TYPE_2D,
+                    format,
+                    clamp,
+                    width,
+                    height,
+                    1, // depth
+                    1, // layers
+                    true); // mips
+                i32 bytes = (width * height * vkrFormatToBpp(format)) / 8;
+                uploaded = vkrTexTable_Upload(tex->slot, 0, tex->texels, bytes);
+            }
+            if (uploaded)
             {
+                GenMips(tex);
                 added = Table_Add(&ms_table, name, tex, &id);
             }
             ASSERT(added);
@@ -169,7 +296,9 @@ bool Texture_Upload(TextureId id)
         i32 width = tex->size.x;
         i32 height = tex->size.y;
         i32 bytes = (width * height * vkrFormatToBpp(tex->format)) / 8;
-        uploaded = vkrTexTable_Upload(tex->slot, 0, tex->texels, bytes);
+        uploaded = !vkrSys_Active() ||
+            vkrTexTable_Upload(tex->slot, 0, tex->texels, bytes);
+        GenMips(tex);
     }
     ProfileEnd(pm_upload);
     return uploaded;
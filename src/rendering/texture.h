@@ -26,6 +26,9 @@ typedef struct Texture_s
 {
     int2 size;
     void* pim_noalias texels;
+    // cpu mip chain for levels [0, CalcMipCount(size)) in 4x4 tiled layout,
+    // used by the path tracer. texels stays linear for gpu upload and edits.
+    void* pim_noalias mips;
     VkFormat format;
     vkrTextureId slot;
 } Texture;
@@ -54,7 +57,7 @@ bool Texture_New(
     Guid name,
     TextureId* idOut);
 
-// upload cpu changes to gpu
+// upload cpu changes to gpu, and rebuild the cpu mip chain
 bool Texture_Upload(TextureId id);
 
 bool Texture_Exists(TextureId id);
@@ -231,6 +231,11 @@ cleanup:
     return success;
 }
 
+bool vkrSys_Active(void)
+{
+    return g_vkr.dev != NULL;
+}
+
 ProfileMark(pm_update, vkrSys_Update)
 void vkrSys_Update(void)
 {
@@ -558,6 +558,8 @@ bool vkrSys_Init(void);
 bool vkrSys_WindowUpdate(void);
 void vkrSys_Update(void);
 void vkrSys_Shutdown(void);
+// false when running headless; gpu resources are then skipped
+bool vkrSys_Active(void);
 
 // frame in flight index
 u32 vkrGetSyncIndex(void);
@@ -463,6 +463,28 @@ bool vkrTexTable_Upload(
     return TexTable_Upload(GetTexTable(id.type), id, layer, data, bytes);
 }
 
+bool vkrTexTable_UploadRegion(
+    vkrTextureId id,
+    i32 layer,
+    i32 layerCount,
+    int2 offset,
+    int2 extent,
+    void const *const data,
+    i32 bytes)
+{
+    ASSERT(id.type == VK_IMAGE_VIEW_TYPE_2D_ARRAY);
+    ASSERT(layer >= 0);
+    ASSERT((layer + layerCount) <= 256);
+    TexTable* tt = GetTexTable(id.type);
+    ASSERT(id.type == tt->viewType);
+    if (TexTable_Exists(tt, id))
+    {
+        vkrTexture_UploadRegion(&tt->images[id.index], layer, layerCount, offset, extent, data, bytes);
+        return true;
+    }
+    return false;
+}
+
 bool vkrTexTable_SetSampler(
     vkrTextureId id,
     VkFilter filter,
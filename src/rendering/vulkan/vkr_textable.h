@@ -26,6 +26,15 @@ bool vkrTexTable_Upload(
     i32 layer,
     void const *const data,
     i32 bytes);
+// see vkrTexture_UploadRegion
+bool vkrTexTable_UploadRegion(
+    vkrTextureId id,
+    i32 layer,
+    i32 layerCount,
+    int2 offset,
+    int2 extent,
+    void const *const data,
+    i32 bytes);
 
 bool vkrTexTable_SetSampler(
     vkrTextureId id,
@@ -9,6 +9,7 @@
 #include "allocator/allocator.h"
 #include "common/time.h"
 #include "math/scalar.h"
+#include "math/int2_funcs.h"
 #include <string.h>
 
 i32 vkrFormatToBpp(VkFormat format)
@@ -211,13 +212,37 @@ void vkrTexture_Upload(
     i32 layer,
     void const *const data,
     i32 bytes)
+{
+    ASSERT(image);
+    vkrTexture_UploadRegion(
+        image,
+        layer,
+        1,
+        i2_0,
+        i2_v(image->width, image->height),
+        data,
+        bytes);
+}
+
+void vkrTexture_UploadRegion(
+    vkrImage *const image,
+    i32 layer,
+    i32 layerCount,
+    int2 offset,
+    int2 extent,
+    void const *const data,
+    i32 bytes)
 {
     ASSERT(image);
     ASSERT(image->handle);
     ASSERT(bytes >= 0);
     ASSERT(data || !bytes);
-    ASSERT((u32)layer < image->arrayLayers);
-    if (bytes <= 0)
+    ASSERT(layerCount > 0);
+    ASSERT((u32)(layer + layerCount) <= image->arrayLayers);
+    ASSERT((offset.x >= 0) && (offset.y >= 0));
+    ASSERT((u32)(offset.x + extent.x) <= image->width);
+    ASSERT((u32)(offset.y + extent.y) <= image->height);
+    if ((bytes <= 0) || (extent.x <= 0) || (extent.y <= 0))
     {
         return;
     }
@@ -255,20 +280,24 @@ void vkrTexture_Upload(
 
     vkrCmdBuf* cmd = vkrCmdGet_G();
     {
-        // copy buffer to image mip 0
+        // copy buffer to the region of mip 0, layers packed one after another
         const VkBufferImageCopy region =
         {
             .imageSubresource.aspectMask = aspect,
             .imageSubresource.mipLevel = 0,
             .imageSubresource.baseArrayLayer = layer,
-            .imageSubresource.layerCount = 1,
-            .imageExtent.width = width,
-            .imageExtent.height = height,
+            .imageSubresource.layerCount = layerCount,
+            .imageOffset = { offset.x, offset.y, 0 },
+            .imageExtent.width = extent.x,
+            .imageExtent.height = extent.y,
             .imageExtent.depth = depth,
         };
         vkrCmdCopyBufferToImage(cmd, &stagebuf, image, &region);
 
-        // generate mips
+        // regenerate the mips under the region.
+        // rounding out to whole texels of mip i keeps each blit 2:1
+        int2 lo = offset;
+        int2 hi = i2_add(offset, extent);
         for (i32 i = 1; i < mipCount; ++i)
         {
             // blit (i-1) into i
@@ -278,23 +307,28 @@ void vkrTexture_Upload(
             i32 dstWidth = i1_max(width >> i, 1);
             i32 dstHeight = i1_max(height >> i, 1);
             i32 dstDepth = i1_max(depth >> i, 1);
+            lo = i2_v(lo.x >> 1, lo.y >> 1);
+            hi = i2_v(i1_min((hi.x + 1) >> 1, dstWidth), i1_min((hi.y + 1) >> 1, dstHeight));
+            hi = i2_max(hi, i2_add(lo, i2_1));
             const VkImageBlit blit =
             {
-                .srcOffsets[1] = { srcWidth, srcHeight, srcDepth, },
-                .dstOffsets[1] = { dstWidth, dstHeight, dstDepth, },
+                .srcOffsets[0] = { i1_min(lo.x * 2, srcWidth - 1), i1_min(lo.y * 2, srcHeight - 1), 0, },
+                .srcOffsets[1] = { i1_min(hi.x * 2, srcWidth), i1_min(hi.y * 2, srcHeight), srcDepth, },
+                .dstOffsets[0] = { lo.x, lo.y, 0, },
+                .dstOffsets[1] = { hi.x, hi.y, dstDepth, },
                 .srcSubresource =
                 {
                     .aspectMask = aspect,
                     .mipLevel = i - 1,
                     .baseArrayLayer = layer,
-                    .layerCount = 1,
+                    .layerCount = layerCount,
                 },
                 .dstSubresource =
                 {
                     .aspectMask = aspect,
                     .mipLevel = i,
                     .baseArrayLayer = layer,
-                    .layerCount = 1,
+                    .layerCount = layerCount,
                 },
             };
             vkrCmdBlitImage(cmd, image, image, &blit);
@@ -24,5 +24,15 @@ void vkrTexture_Upload(
     i32 layer,
     void const *const data,
     i32 bytes);
+// data holds layerCount tightly packed extent.x * extent.y images.
+// mips under the region are regenerated.
+void vkrTexture_UploadRegion(
+    vkrImage *const image,
+    i32 layer,
+    i32 layerCount,
+    int2 offset,
+    int2 extent,
+    void const *const data,
+    i32 bytes);
 
 PIM_C_END
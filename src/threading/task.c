@@ -20,6 +20,7 @@
 // ----------------------------------------------------------------------------
 
 static i32 ms_numthreads;
+static i32 ms_threadlimit;
 static i32 ms_worksplit;
 static i32 ms_numThreadsRunning;
 static i32 ms_running;
@@ -68,6 +69,20 @@ static bool TryRunTask(i32 tid)
     return ExecuteTask(task);
 }
 
+// runs the next task of another thread's queue, stopping at background tasks
+static bool TryDrainTask(i32 tid)
+{
+    Task* task = PtrQueue_TryPop(&ms_queues[tid]);
+    if (task && load_i32(&task->background, MO_Acquire))
+    {
+        if (PtrQueue_TryPush(&ms_queues[tid], task))
+        {
+            return false;
+        }
+    }
+    return ExecuteTask(task);
+}
+
 static i32 TaskLoop(void* arg)
 {
     _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
@@ -110,24 +125,28 @@ TaskStatus Task_Stat(const void* pbase)
     return (TaskStatus)load_i32(&task->status, MO_Acquire);
 }
 
-void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
+static void SubmitTask(Task* task, TaskExecuteFn execute, i32 worksize, bool background)
 {
     ASSERT(execute);
-    Task *const task = pbase;
     if (task && worksize > 0)
     {
         ASSERT(Task_Stat(task) == TaskStatus_Init);
+        const i32 numthreads = load_i32(&ms_threadlimit, MO_Acquire);
+        // without workers the main thread has to run it
+        background = background && (numthreads > 1);
+        const i32 first = background ? 1 : 0;
+
         store_i32(&task->status, TaskStatus_Exec, MO_Release);
         task->execute = execute;
         store_i32(&task->worksize, worksize, MO_Release);
         store_i32(&task->head, 0, MO_Release);
         store_i32(&task->tail, 0, MO_Release);
+        store_i32(&task->background, background ? 1 : 0, MO_Release);
 
         bool anyFull = false;
         bool resubmit[kMaxThreads] = { 0 };
 
-        const i32 numthreads = ms_numthreads;
-        for (i32 t = 0; t < numthreads; ++t)
+        for (i32 t = first; t < numthreads; ++t)
         {
             bool full = !PtrQueue_TryPush(&ms_queues[t], task);
             anyFull |= full;
@@ -138,7 +157,7 @@ void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
         {
             anyFull = false;
             TaskSys_Schedule();
-            for (i32 t = 0; t < numthreads; ++t)
+            for (i32 t = first; t < numthreads; ++t)
             {
                 if (resubmit[t])
                 {
@@ -152,6 +171,16 @@ void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
     }
 }
 
+void Task_Submit(void* pbase, TaskExecuteFn execute, i32 worksize)
+{
+    SubmitTask(pbase, execute, worksize, false);
+}
+
+void Task_SubmitBackground(void* pbase, TaskExecuteFn execute, i32 worksize)
+{
+    SubmitTask(pbase, execute, worksize, true);
+}
+
 ProfileMark(pm_exec, Task_Exec);
 ProfileMark(pm_await, Task_Wait);
 void Task_Await(void* pbase)
@@ -212,6 +241,7 @@ void TaskSys_Init(void)
 
     const i32 numthreads = Thread_HardwareCount();
     ms_numthreads = numthreads;
+    ms_threadlimit = numthreads;
     ms_worksplit = numthreads * numthreads;
 
     const i32 kQueueSize = 64;
@@ -248,6 +278,18 @@ void TaskSys_Shutdown(void)
     memset(ms_threads, 0, sizeof(ms_threads));
     memset(ms_queues, 0, sizeof(ms_queues));
     ms_numthreads = 0;
+    ms_threadlimit = 0;
+}
+
+void TaskSys_SetThreadLimit(i32 count)
+{
+    count = i1_clamp(count, 1, ms_numthreads);
+    store_i32(&ms_threadlimit, count, MO_Release);
+}
+
+i32 TaskSys_GetThreadLimit(void)
+{
+    return load_i32(&ms_threadlimit, MO_Acquire);
 }
 
 ProfileMark(pm_endframe, TaskSys_EndFrame)
@@ -259,7 +301,7 @@ void TaskSys_EndFrame(void)
     const i32 numthreads = ms_numthreads;
     for (i32 tid = 0; tid < numthreads; ++tid)
     {
-        while (TryRunTask(tid)) {}
+        while (TryDrainTask(tid)) {}
     }
 
     ProfileEnd(pm_endframe);
@@ -20,12 +20,18 @@ typedef struct Task_s
     i32 worksize;
     i32 head;
     i32 tail;
+    // set by Task_SubmitBackground when worker threads take the task
+    i32 background;
 } Task;
 
 i32 Task_ThreadId(void);
 i32 Task_ThreadCount(void);
 
 void Task_Submit(void* task, TaskExecuteFn execute, i32 worksize);
+// Task_Submit for long running work that the main thread must not stall on.
+// only worker threads claim its work, unless there are none, or the main
+// thread awaits it.
+void Task_SubmitBackground(void* task, TaskExecuteFn execute, i32 worksize);
 TaskStatus Task_Stat(const void* task);
 void Task_Await(void* task);
 
@@ -38,4 +44,9 @@ void TaskSys_Update(void);
 void TaskSys_Shutdown(void);
 void TaskSys_EndFrame(void);
 
+// limits the number of threads that receive new tasks, for scaling tests.
+// Task_ThreadCount is unaffected, per-thread storage stays valid.
+void TaskSys_SetThreadLimit(i32 count);
+i32 TaskSys_GetThreadLimit(void);
+
 PIM_C_END